@@ -0,0 +1,570 @@
+#include <string.h>
+#include <math.h>
+
+#include "analyzer.h"
+#include "harmonics.h"
+#include "util.h"
+
+#ifndef M_PI
+#define M_PI 3.1415926538
+#endif
+
+#define AN_ALIGN 64 // a cache line
+
+/**
+ * FFTW's planner isn't thread safe, so plans are made up front and then
+ * executed from any thread with fftw_execute_dft_r2c on that thread's
+ * buffers (fftw_malloc'ed, so they have the alignment the plan expects).
+ */
+struct anPlan * anPlan_new(size_t length){
+	struct anPlan * ret = fmalloc(sizeof *ret);
+	size_t i;
+	double * in = fftw_malloc(length * sizeof *in);
+	fftw_complex * out = fftw_malloc((length / 2 + 1) * sizeof *out);
+	
+	if(in == NULL || out == NULL){
+		fprintf(stderr, "! fftw_malloc failed (%zu)\n", length * sizeof *out);
+		exit(EXIT_FAILURE);
+	}
+	
+	ret->length = length;
+	ret->panama = fftw_plan_dft_r2c_1d(length, in, out, FFTW_ESTIMATE);
+	ret->window = fmalloc(length * sizeof *ret->window);
+	for(i = 0; i < length; i++){
+		ret->window[i] = 0.5 - 0.5 * cos(2 * M_PI * (double)i / (double)length);
+	}
+	
+	fftw_free(in);
+	fftw_free(out);
+	
+	return ret;
+}
+
+void anPlan_free(struct anPlan * p){
+	if(p == NULL) return;
+	fftw_destroy_plan(p->panama);
+	free(p->window);
+	free(p);
+}
+
+struct anWorker * anWorker_new(struct anPlan * plan){
+	struct anWorker * ret = fmalloc(sizeof *ret);
+	size_t i;
+	
+	ret->plan = plan;
+	ret->fftIn = fftw_malloc(plan->length * sizeof *ret->fftIn);
+	ret->fftOut = fftw_malloc((plan->length / 2 + 1) * sizeof *ret->fftOut);
+	if(ret->fftIn == NULL || ret->fftOut == NULL){
+		fprintf(stderr, "! fftw_malloc failed (%zu)\n", plan->length * sizeof *ret->fftOut);
+		exit(EXIT_FAILURE);
+	}
+	
+	for(i = 0; i < plan->length; i++){
+		ret->fftIn[i] = 0.0;
+	}
+	
+	return ret;
+}
+
+void anWorker_free(struct anWorker * w){
+	if(w == NULL) return;
+	fftw_free(w->fftIn);
+	fftw_free(w->fftOut);
+	free(w);
+}
+
+// the header is padded to a whole cache line, the ring follows it
+static size_t analyzer_headerSize(void){
+	return (sizeof(struct analyzer) + AN_ALIGN - 1) / AN_ALIGN * AN_ALIGN;
+}
+
+// bytes of a stream's header and ring, the one allocation every stream has; tracking, smoothing and resampling add their own
+size_t analyzer_ringSize(size_t length, enum anFormat format){
+	return analyzer_headerSize() + length * (format == AN_INT16 ? sizeof(int16_t) : sizeof(float));
+}
+
+static struct analyzer * analyzer_alloc(size_t length, enum anFormat format, size_t hop, int samplerate, anCallback * callback, void * user){
+	struct analyzer * ret = fftw_malloc(analyzer_ringSize(length, format));
+	
+	if(ret == NULL){
+		fprintf(stderr, "! fftw_malloc failed (%zu)\n", analyzer_ringSize(length, format));
+		exit(EXIT_FAILURE);
+	}
+	
+	ret->worker = NULL;
+	ret->zoom = NULL;
+	ret->ring = NULL;
+	ret->ring16 = NULL;
+	if(format == AN_INT16){
+		ret->ring16 = (int16_t *)((char *)ret + analyzer_headerSize());
+		ret->scale = 1.0 / 32768.0;
+		memset(ret->ring16, 0, length * sizeof *ret->ring16);
+	}else{
+		ret->ring = (float *)((char *)ret + analyzer_headerSize());
+		ret->scale = 1.0;
+		memset(ret->ring, 0, length * sizeof *ret->ring);
+	}
+	ret->length = length;
+	ret->hop = hop;
+	ret->head = 0;
+	ret->sinceFrame = 0;
+	ret->total = 0;
+	ret->callback = callback;
+	ret->user = user;
+	ret->amplifier = 1.0;
+	ret->samplerate = samplerate;
+	ret->ownsWorker = 0;
+	
+	gate_init(&ret->gate, 0.0, 0.0, 1.0, 0);
+	ret->hopEnergy = 0.0;
+	ret->hopCrossings = 0;
+	ret->hopSamples = 0;
+	ret->last = 0.0f;
+	ret->skipped = 0;
+	
+	ret->numSizes = 0;
+	sizeChooser_init(&ret->chooser, 0);
+	ret->tracker = NULL;
+	ret->viterbi = NULL;
+	ret->pending = NULL;
+	ret->flushed = NULL;
+	ret->resampler = NULL;
+	ret->resampled = NULL;
+	ret->stats = NULL;
+	ret->mark = 0;
+	
+	return ret;
+}
+
+// a stream analysed on a (shared) worker, doesn't plan so it's safe from any thread
+struct analyzer * analyzer_newOn(struct anWorker * worker, enum anFormat format, size_t hop, int samplerate, anCallback * callback, void * user){
+	struct analyzer * ret = analyzer_alloc(worker->plan->length, format, hop, samplerate, callback, user);
+	
+	ret->worker = worker;
+	
+	return ret;
+}
+
+// a stream only looking at the band of the zoom plan, the ring holds what it needs
+struct analyzer * analyzer_newZoom(struct zoomWorker * zoom, enum anFormat format, size_t hop, int samplerate, anCallback * callback, void * user){
+	struct analyzer * ret = analyzer_alloc(zoom->plan->length, format, hop, samplerate, callback, user);
+	
+	ret->zoom = zoom;
+	
+	return ret;
+}
+
+// a stream with a plan and worker of its own
+struct analyzer * analyzer_new(size_t length, size_t hop, int samplerate, anCallback * callback, void * user){
+	struct analyzer * ret = analyzer_newOn(anWorker_new(anPlan_new(length)), AN_FLOAT32, hop, samplerate, callback, user);
+	
+	ret->ownsWorker = 1;
+	
+	return ret;
+}
+
+void analyzer_free(struct analyzer * a){
+	if(a == NULL) return;
+	if(a->ownsWorker){
+		anPlan_free(a->worker->plan);
+		anWorker_free(a->worker);
+	}
+	tracker_free(a->tracker);
+	viterbi_free(a->viterbi);
+	free(a->pending);
+	free(a->flushed);
+	resampler_free(a->resampler);
+	free(a->resampled);
+	fftw_free(a);
+}
+
+// end the stage that began at the mark, if anyone's counting
+static void analyzer_stage(struct analyzer * a, enum stage s){
+	if(a->stats != NULL) a->mark = stats_add(a->stats, s, a->mark);
+}
+
+/**
+ * Convert, apply the gain and window (if there is one) in one pass. There's
+ * nothing carried from one sample to the next, so at -O3 these are a few
+ * SIMD instructions per handful of samples.
+ */
+static void analyzer_convertFloat(double * restrict out, const double * restrict window, const float * restrict in, double gain, size_t n){
+	size_t i;
+	
+	if(window == NULL){
+		for(i = 0; i < n; i++) out[i] = gain * in[i];
+		return;
+	}
+	for(i = 0; i < n; i++) out[i] = gain * window[i] * in[i];
+}
+
+static void analyzer_convertInt16(double * restrict out, const double * restrict window, const int16_t * restrict in, double gain, size_t n){
+	size_t i;
+	
+	if(window == NULL){
+		for(i = 0; i < n; i++) out[i] = gain * in[i];
+		return;
+	}
+	for(i = 0; i < n; i++) out[i] = gain * window[i] * in[i];
+}
+
+// sum of squares, in four lanes so it vectorizes without reassociating a single sum
+static double analyzer_energy(const double * x, size_t n){
+	double lane[4] = {0.0, 0.0, 0.0, 0.0};
+	size_t i;
+	
+	for(i = 0; i + 4 <= n; i += 4){
+		lane[0] += x[i] * x[i];
+		lane[1] += x[i + 1] * x[i + 1];
+		lane[2] += x[i + 2] * x[i + 2];
+		lane[3] += x[i + 3] * x[i + 3];
+	}
+	for(; i < n; i++) lane[0] += x[i] * x[i];
+	
+	return lane[0] + lane[1] + lane[2] + lane[3];
+}
+
+// the newest n samples of the ring into out, oldest first, at full scale times the amplifier
+static void analyzer_unwrap(struct analyzer * a, double * out, const double * window, size_t n){
+	size_t start = (a->head + a->length - n) % a->length, older = a->length - start;
+	double gain = a->amplifier * a->scale;
+	
+	if(older > n) older = n;
+	if(a->ring16 != NULL){
+		analyzer_convertInt16(out, window, a->ring16 + start, gain, older);
+		analyzer_convertInt16(out + older, window != NULL ? window + older : NULL, a->ring16, gain, n - older);
+	}else{
+		analyzer_convertFloat(out, window, a->ring + start, gain, older);
+		analyzer_convertFloat(out + older, window != NULL ? window + older : NULL, a->ring, gain, n - older);
+	}
+}
+
+// unwrap the ring into the zoom worker and look at just its band
+static void analyzer_zoomFrame(struct analyzer * a, struct anResult * res){
+	double * samples = a->zoom->samples;
+	
+	analyzer_unwrap(a, samples, NULL, a->length);
+	
+	res->pos = a->total;
+	res->length = a->length;
+	res->energy = sqrt(analyzer_energy(samples, a->length) / a->length); // the zoom windows after decimating, this isn't
+	res->spectrum = NULL;
+	res->freq = zoom_execute(a->zoom, samples, &res->intens);
+	analyzer_stage(a, STAGE_FFT); // the zoom's peak search is a handful of bins
+	res->harmonic = freqToHarmonic(res->freq < 16.0 ? 16.0 : res->freq, NULL);
+	res->harmonicFreq = harmonicToFreq(res->harmonic);
+	res->silent = 0;
+}
+
+// transform the newest samples in the ring at the current size, oldest first
+void analyzer_frame(struct analyzer * a, struct anResult * res){
+	struct anWorker * w = a->worker;
+	struct anPlan * p;
+	const struct partial * partial;
+	size_t n, i;
+	
+	if(a->zoom != NULL){
+		analyzer_zoomFrame(a, res);
+		return;
+	}
+	
+	p = a->numSizes > 0 ? a->sizes[a->chooser.current] : w->plan;
+	n = p->length;
+	analyzer_unwrap(a, w->fftIn, p->window, n);
+	
+	// the worker's buffers fit the largest size, smaller plans just use less of them
+	fftw_execute_dft_r2c(p->panama, w->fftIn, w->fftOut);
+	analyzer_stage(a, STAGE_FFT);
+	
+	res->pos = a->total;
+	res->length = n;
+	res->energy = sqrt(analyzer_energy(w->fftIn, n) / n);
+	res->spectrum = w->fftOut;
+	if(a->tracker != NULL){
+		partial = tracker_frame(a->tracker, w->fftOut, n, a->samplerate);
+		res->freq = partial != NULL ? partial->freq : 0.0;
+		res->intens = partial != NULL ? partial->amp : 0.0;
+	}else{
+		i = highFreq(w->fftOut, n, &res->intens);
+		res->freq = (double)i / (double)n * (double)a->samplerate;
+	}
+	analyzer_stage(a, STAGE_PEAK);
+	res->harmonic = freqToHarmonic(res->freq < 16.0 ? 16.0 : res->freq, NULL);
+	res->harmonicFreq = harmonicToFreq(res->harmonic);
+	res->silent = 0;
+	
+	if(a->numSizes > 0) sizeChooser_update(&a->chooser, res->freq, n, a->samplerate);
+}
+
+/**
+ * Analyse with one of a few FFT sizes per frame instead of always the
+ * worker's: the smallest after an onset or when the pitch moves, a size
+ * larger every few frames it holds still. The plans are shared like the
+ * worker's, ascending and no longer than it. Returns 0 if they don't fit.
+ */
+int analyzer_setSizes(struct analyzer * a, struct anPlan ** plans, size_t n){
+	size_t i;
+	
+	if(n > AN_MAXSIZES || (n > 0 && a->zoom != NULL)) return 0;
+	for(i = 0; i < n; i++){
+		if(plans[i]->length > a->length || (i > 0 && plans[i]->length <= plans[i - 1]->length)) return 0;
+		a->sizes[i] = plans[i];
+	}
+	a->numSizes = n;
+	sizeChooser_init(&a->chooser, n);
+	
+	return 1;
+}
+
+/**
+ * Report the pitch of a partial tracker following up to partials peaks,
+ * rather than the loudest bin of every frame on its own. 0 turns it off.
+ * Zoomed streams don't track.
+ */
+void analyzer_setTracker(struct analyzer * a, size_t partials){
+	tracker_free(a->tracker);
+	a->tracker = partials > 0 ? tracker_new(partials) : NULL;
+}
+
+/**
+ * Smooth the reported notes with a Viterbi decoder that favours small steps
+ * and believes a frame's note when it has seen lookahead frames after it,
+ * so results come lookahead hops later. Negative turns it off.
+ */
+void analyzer_setSmoothing(struct analyzer * a, int lookahead){
+	viterbi_free(a->viterbi);
+	free(a->pending);
+	free(a->flushed);
+	a->viterbi = NULL;
+	a->pending = NULL;
+	a->flushed = NULL;
+	if(lookahead < 0) return;
+	
+	a->viterbi = viterbi_new(MIN_HARMONIC, MAX_HARMONIC, VITERBI_BAND, lookahead);
+	a->pending = fmalloc((lookahead + 1) * sizeof *a->pending);
+	a->flushed = fmalloc((lookahead + 1) * sizeof *a->flushed);
+}
+
+/**
+ * Time the stages of this stream in the counters of the thread pushing to
+ * it: ring, fft, peak, note and output (the callback). NULL stops counting.
+ */
+void analyzer_setStats(struct analyzer * a, struct statsBlock * stats){
+	a->stats = stats;
+}
+
+/**
+ * Push samples at rate from now on, they're resampled to the stream's
+ * samplerate (the one everything is analysed and reported at) on the way
+ * in. Its own samplerate turns resampling off. Returns 0 if they can't be
+ * resampled: int16 rings take their samples as they are.
+ */
+int analyzer_setInputRate(struct analyzer * a, int rate){
+	resampler_free(a->resampler);
+	free(a->resampled);
+	a->resampler = NULL;
+	a->resampled = NULL;
+	if(rate == a->samplerate) return 1;
+	if(a->ring16 != NULL || (a->resampler = resampler_new(rate, a->samplerate)) == NULL) return 0;
+	
+	a->resampled = fmalloc(resampler_maxOut(a->resampler, RS_CHUNK) * sizeof *a->resampled);
+	
+	return 1;
+}
+
+// hand out the results still waiting for their note, as it looks now
+void analyzer_flush(struct analyzer * a){
+	struct viterbi * v = a->viterbi;
+	size_t i, n, first;
+	struct anResult * res;
+	
+	if(v == NULL) return;
+	
+	first = v->frames - (v->frames < v->lookahead ? v->frames : v->lookahead);
+	n = viterbi_flush(v, a->flushed);
+	for(i = 0; i < n; i++){
+		res = a->pending + (first + i) % (v->lookahead + 1);
+		res->harmonic = a->flushed[i];
+		res->harmonicFreq = harmonicToFreq(res->harmonic);
+		if(a->callback != NULL) a->callback(a->user, res);
+	}
+}
+
+// to the callback, through the smoother if there is one
+static void analyzer_emit(struct analyzer * a, struct anResult * res){
+	struct viterbi * v = a->viterbi;
+	struct anResult * slot;
+	double cents;
+	int note;
+	
+	if(v == NULL || res->silent){
+		if(!res->silent) analyzer_stage(a, STAGE_NOTE);
+		analyzer_flush(a);
+		if(a->callback != NULL) a->callback(a->user, res);
+		analyzer_stage(a, STAGE_OUTPUT);
+		return;
+	}
+	
+	a->pending[v->frames % (v->lookahead + 1)] = *res;
+	a->pending[v->frames % (v->lookahead + 1)].spectrum = NULL; // gone by the time it's handed out
+	// in fractional harmonics of the current tuning
+	if(res->freq >= 16.0) freqsToHarmonics(&res->freq, 1, &note, &cents);
+	if(viterbi_push(v, res->freq >= 16.0 ? note + cents / 100.0 : NAN, &note)){
+		// the frame lookahead before the one just pushed
+		slot = a->pending + v->frames % (v->lookahead + 1);
+		slot->harmonic = note;
+		slot->harmonicFreq = harmonicToFreq(note);
+		analyzer_stage(a, STAGE_NOTE);
+		if(a->callback != NULL) a->callback(a->user, slot);
+		analyzer_stage(a, STAGE_OUTPUT);
+	}else{
+		analyzer_stage(a, STAGE_NOTE);
+	}
+}
+
+// "1024,2048,4096" into sizes, returns how many there were or 0 if it's not a list of sizes
+size_t analyzer_parseSizes(const char * list, size_t * sizes, size_t max){
+	size_t n = 0;
+	char * end = (char *)list;
+	
+	while(n < max){
+		sizes[n] = strtoul(list, &end, 10);
+		if(end == list || sizes[n] < 2) return 0;
+		n++;
+		if(*end != ',') break;
+		list = end + 1;
+	}
+	
+	return *end == '\0' ? n : 0;
+}
+
+/**
+ * The gate opens when a hop is louder than open (as RMS, after the
+ * amplifier) and tonal enough: fewer than zcr zero crossings per sample. It
+ * closes after hang hops quieter than close or too noisy. While it's closed frames aren't
+ * windowed, transformed or searched at all.
+ */
+void analyzer_setGate(struct analyzer * a, double open, double close, double zcr, int hang){
+	gate_init(&a->gate, open, close, zcr, hang);
+}
+
+// decide on the hop that just ended, returns whether to analyse it
+static int analyzer_gate(struct analyzer * a, struct anResult * res){
+	double rms, zcr;
+	int wasOpen = a->gate.state;
+	
+	if(a->gate.open <= 0.0) return 1;
+	
+	rms = a->amplifier * a->scale * sqrt(a->hopEnergy / (double)(a->hopSamples ? a->hopSamples : 1));
+	zcr = (double)a->hopCrossings / (double)(a->hopSamples ? a->hopSamples : 1);
+	a->hopEnergy = 0.0;
+	a->hopCrossings = 0;
+	a->hopSamples = 0;
+	
+	if(gate_hop(&a->gate, rms, zcr) && !wasOpen) sizeChooser_onset(&a->chooser);
+	
+	if(wasOpen && !a->gate.state){
+		if(a->tracker != NULL) tracker_clear(a->tracker);
+		memset(res, 0, sizeof *res);
+		res->pos = a->total;
+		res->silent = 1;
+		analyzer_emit(a, res);
+	}
+	if(!a->gate.state) a->skipped++;
+	
+	return a->gate.state;
+}
+
+// copy a chunk (that fits before the end of the ring) in, measuring it for the gate
+static void analyzer_store(struct analyzer * a, const void * in, size_t chunk){
+	const float * f = in;
+	const int16_t * s = in;
+	size_t i;
+	
+	if(a->ring16 != NULL){
+		memcpy(a->ring16 + a->head, in, chunk * sizeof *s);
+	}else{
+		memcpy(a->ring + a->head, in, chunk * sizeof *f);
+	}
+	if(a->gate.open <= 0.0) return;
+	
+	for(i = 0; i < chunk; i++){
+		float x = a->ring16 != NULL ? (float)s[i] : f[i];
+		
+		a->hopEnergy += (double)x * x;
+		a->hopCrossings += (x < 0.0f) != (a->last < 0.0f);
+		a->last = x;
+	}
+	a->hopSamples += chunk;
+}
+
+// n samples of the stream's format
+static void analyzer_feed(struct analyzer * a, const void * vin, size_t n){
+	const unsigned char * in = vin;
+	size_t size = a->ring16 != NULL ? sizeof *a->ring16 : sizeof *a->ring;
+	struct anResult res;
+	size_t chunk;
+	
+	if(a->stats != NULL) a->mark = stats_now();
+	while(n > 0){
+		chunk = a->length - a->head;
+		if(chunk > n) chunk = n;
+		if(a->total >= a->length && chunk > a->hop - a->sinceFrame) chunk = a->hop - a->sinceFrame;
+		if(a->total < a->length && chunk > a->length - a->total) chunk = a->length - a->total;
+		
+		analyzer_store(a, in, chunk);
+		a->head = (a->head + chunk) % a->length;
+		a->total += chunk;
+		in += chunk * size;
+		n -= chunk;
+		
+		if(a->total == a->length){
+			a->sinceFrame = a->hop;
+		}else if(a->total > a->length){
+			a->sinceFrame += chunk;
+		}
+		
+		if(a->sinceFrame == a->hop){
+			a->sinceFrame = 0;
+			analyzer_stage(a, STAGE_RING);
+			if(analyzer_gate(a, &res)){
+				analyzer_frame(a, &res);
+				analyzer_emit(a, &res);
+			}
+		}
+	}
+	analyzer_stage(a, STAGE_RING);
+}
+
+/**
+ * Feed n samples, every hop samples (once the ring has filled up) a frame is
+ * analysed and handed to the callback.
+ */
+void analyzer_push(struct analyzer * a, const float * in, size_t n){
+	size_t chunk;
+	
+	if(a->ring == NULL){
+		fprintf(stderr, "! float samples pushed to an int16 stream\n");
+		exit(EXIT_FAILURE);
+	}
+	if(a->resampler == NULL){
+		analyzer_feed(a, in, n);
+		return;
+	}
+	
+	while(n > 0){
+		chunk = n < RS_CHUNK ? n : RS_CHUNK;
+		analyzer_feed(a, a->resampled, resampler_process(a->resampler, in, chunk, a->resampled));
+		in += chunk;
+		n -= chunk;
+	}
+}
+
+// the same for a stream made with AN_INT16, its ring keeps them as they come
+void analyzer_pushInt16(struct analyzer * a, const int16_t * in, size_t n){
+	if(a->ring16 == NULL){
+		fprintf(stderr, "! int16 samples pushed to a float stream\n");
+		exit(EXIT_FAILURE);
+	}
+	analyzer_feed(a, in, n);
+}
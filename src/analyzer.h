@@ -0,0 +1,147 @@
+#ifndef HARK_ANALYZER_H
+#define HARK_ANALYZER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "fftw3.h"
+#include "util.h"
+#include "zoom.h"
+#include "tracker.h"
+#include "viterbi.h"
+#include "stats.h"
+#include "resample.h"
+
+#define AN_MAXSIZES 8
+
+// what a stream's ring keeps its samples as, int16 halves the memory (and the bytes to capture)
+enum anFormat{
+	AN_FLOAT32,
+	AN_INT16
+};
+
+struct anResult{
+	size_t pos; // sample (since the start of the stream) just after the frame
+	size_t length; // FFT size of the frame
+	double freq;
+	double intens;
+	int harmonic;
+	double harmonicFreq;
+	double energy; // RMS of the frame after the amplifier: Hann windowed, but not with zoom (about 1.63 times that for a steady tone)
+	fftw_complex * spectrum; // length / 2 + 1 bins to look at, only during the callback and NULL with zoom or smoothing
+	int silent; // the gate just closed, nothing else is filled in
+};
+
+typedef void anCallback(void * user, const struct anResult * res);
+
+// a plan and window for one FFT size, shared by every stream and thread
+struct anPlan{
+	size_t length;
+	fftw_plan panama;
+	double * window; // Hann
+};
+
+// the scratch buffers a thread transforms in, streams analysed on it share them
+struct anWorker{
+	struct anPlan * plan;
+	double * fftIn;
+	fftw_complex * fftOut; // length / 2 + 1
+};
+
+/**
+ * The analysis that the programs do in their FFT threads, fed by pushing
+ * samples instead of a PortAudio callback: keep the last length samples in a
+ * ring and every hop samples FFT them and report the loudest frequency.
+ * A stream must only be pushed to from the thread owning its worker.
+ * Its header and ring are one aligned allocation, the tracker, smoother and
+ * resampler are allocated when they're set; plans, windows and spectra live
+ * in the anPlan and anWorker.
+ */
+struct analyzer{
+	struct anWorker * worker;
+	struct zoomWorker * zoom; // set instead of worker for band limited analysis
+	float * ring; // raw input, the amplifier and window are applied per frame
+	int16_t * ring16; // set instead of ring for int16 streams
+	double scale; // of a raw sample to full scale 1.0
+	size_t length;
+	size_t hop;
+	size_t head; // where the next sample goes in the ring
+	size_t sinceFrame; // samples pushed since the last frame
+	size_t total;
+	
+	anCallback * callback;
+	void * user;
+	
+	double amplifier;
+	int samplerate;
+	int ownsWorker;
+	
+	// silence gate, measured over every hop as it's pushed
+	struct gate gate;
+	double hopEnergy;
+	size_t hopCrossings;
+	size_t hopSamples;
+	float last;
+	size_t skipped; // frames not transformed because of the gate
+	
+	// adaptive FFT size, the ring always holds enough history for the largest
+	size_t numSizes; // 0 always uses the worker's plan
+	struct anPlan * sizes[AN_MAXSIZES]; // ascending
+	struct sizeChooser chooser;
+	
+	struct tracker * tracker; // follow partials instead of taking the loudest bin, NULL doesn't
+	
+	// note smoothing, results wait lookahead frames for their note to be decided
+	struct viterbi * viterbi; // NULL reports every frame's note straight away
+	struct anResult * pending; // lookahead + 1, by frame
+	int * flushed;
+	
+	struct resampler * resampler; // from the rate samples are pushed at to samplerate, NULL when they're the same
+	float * resampled; // its output for RS_CHUNK samples
+	
+	struct statsBlock * stats; // the owning thread's counters, NULL doesn't count
+	uint64_t mark; // when the stage being timed began
+};
+
+struct anPlan * anPlan_new(size_t length);
+
+void anPlan_free(struct anPlan * p);
+
+struct anWorker * anWorker_new(struct anPlan * plan);
+
+void anWorker_free(struct anWorker * w);
+
+struct analyzer * analyzer_newOn(struct anWorker * worker, enum anFormat format, size_t hop, int samplerate, anCallback * callback, void * user);
+
+struct analyzer * analyzer_newZoom(struct zoomWorker * zoom, enum anFormat format, size_t hop, int samplerate, anCallback * callback, void * user);
+
+struct analyzer * analyzer_new(size_t length, size_t hop, int samplerate, anCallback * callback, void * user);
+
+void analyzer_free(struct analyzer * a);
+
+size_t analyzer_ringSize(size_t length, enum anFormat format);
+
+void analyzer_setGate(struct analyzer * a, double open, double close, double zcr, int hang);
+
+int analyzer_setSizes(struct analyzer * a, struct anPlan ** plans, size_t n);
+
+size_t analyzer_parseSizes(const char * list, size_t * sizes, size_t max);
+
+void analyzer_setTracker(struct analyzer * a, size_t partials);
+
+void analyzer_setSmoothing(struct analyzer * a, int lookahead);
+
+void analyzer_setStats(struct analyzer * a, struct statsBlock * stats);
+
+int analyzer_setInputRate(struct analyzer * a, int rate);
+
+void analyzer_flush(struct analyzer * a);
+
+void analyzer_push(struct analyzer * a, const float * in, size_t n);
+
+void analyzer_pushInt16(struct analyzer * a, const int16_t * in, size_t n);
+
+void analyzer_frame(struct analyzer * a, struct anResult * res);
+
+#endif
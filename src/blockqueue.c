@@ -0,0 +1,98 @@
+#include <string.h>
+
+#include "blockqueue.h"
+#include "util.h"
+
+#define TAIL(q, r) ((q)->tails + (r) * (BQ_LINE / sizeof(size_t)))
+
+struct blockQueue * blockQueue_new(size_t blockSize, size_t numBlocks, size_t numReaders){
+	struct blockQueue * ret;
+	
+	if(blockSize < 1 || numBlocks < 2 || numReaders < 1 || numReaders > BQ_MAXREADERS){
+		fprintf(stderr, "! Bad block queue (%zu blocks of %zu for %zu readers)\n", numBlocks, blockSize, numReaders);
+		return NULL;
+	}
+	
+	ret = fmalloc(sizeof *ret);
+	ret->blockSize = blockSize;
+	ret->numBlocks = numBlocks;
+	ret->numReaders = numReaders;
+	ret->data = fmalloc(numBlocks * blockSize * sizeof *ret->data);
+	ret->lengths = fmalloc(numBlocks * sizeof *ret->lengths);
+	ret->head = 0;
+	ret->dropped = 0;
+	ret->closed = 0;
+	memset(ret->tails, 0, sizeof ret->tails);
+	
+	return ret;
+}
+
+void blockQueue_free(struct blockQueue * q){
+	if(q == NULL) return;
+	free(q->data);
+	free(q->lengths);
+	free(q);
+}
+
+// the block the slowest reader is at
+static size_t blockQueue_oldest(struct blockQueue * q){
+	size_t oldest = q->head, r, tail;
+	
+	for(r = 0; r < q->numReaders; r++){
+		tail = ATOMIC_LOAD(TAIL(q, r));
+		if(tail < oldest) oldest = tail;
+	}
+	
+	return oldest;
+}
+
+/**
+ * Producer only. Copies n samples into as many blocks as they need, returns
+ * how many fit; the rest is counted in dropped.
+ */
+size_t blockQueue_push(struct blockQueue * q, const float * in, size_t n){
+	size_t head = q->head, oldest = blockQueue_oldest(q), chunk, done = 0;
+	
+	while(done < n && head - oldest < q->numBlocks){
+		chunk = n - done < q->blockSize ? n - done : q->blockSize;
+		memcpy(q->data + (head % q->numBlocks) * q->blockSize, in + done, chunk * sizeof *in);
+		q->lengths[head % q->numBlocks] = chunk;
+		done += chunk;
+		head++;
+	}
+	ATOMIC_STORE(&q->head, head);
+	q->dropped += n - done;
+	
+	return done;
+}
+
+// producer only, whole blocks' worth of samples a push could take right now (the readers only make more)
+size_t blockQueue_room(struct blockQueue * q){
+	return (q->numBlocks - (q->head - blockQueue_oldest(q))) * q->blockSize;
+}
+
+// producer only, after its last push
+void blockQueue_close(struct blockQueue * q){
+	ATOMIC_STORE(&q->closed, 1);
+}
+
+// reader's next block and its length in n, NULL if there is none yet
+const float * blockQueue_peek(struct blockQueue * q, size_t reader, size_t * n){
+	size_t tail = *TAIL(q, reader);
+	
+	if(tail == ATOMIC_LOAD(&q->head)) return NULL;
+	
+	*n = q->lengths[tail % q->numBlocks];
+	return q->data + (tail % q->numBlocks) * q->blockSize;
+}
+
+// reader is done with the block it peeked at
+void blockQueue_pop(struct blockQueue * q, size_t reader){
+	ATOMIC_STORE(TAIL(q, reader), *TAIL(q, reader) + 1);
+}
+
+// the queue is closed and reader has taken everything, checked after a NULL peek
+int blockQueue_finished(struct blockQueue * q, size_t reader){
+	// closed is stored after the last head, so once it's seen head is final
+	return ATOMIC_LOAD(&q->closed) && *TAIL(q, reader) == ATOMIC_LOAD(&q->head);
+}
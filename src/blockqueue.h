@@ -0,0 +1,50 @@
+#ifndef HARK_BLOCKQUEUE_H
+#define HARK_BLOCKQUEUE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BQ_MAXREADERS 4
+#define BQ_LINE 64 // a cache line, what one side writes is kept apart from the other's
+
+/**
+ * Lock-free queue of sample blocks from one producer (a capture callback,
+ * which must never wait) to a few readers that each see every block, like
+ * a disk writer and an analysis thread. A block is reused once the slowest
+ * reader is done with it; when there's none free the producer drops what it
+ * was given and counts it instead of blocking.
+ * Only the producer stores head and dropped, only reader r stores tails[r],
+ * with acquire/release ordering so a block's samples are visible before the
+ * index that publishes them.
+ */
+struct blockQueue{
+	size_t blockSize; // samples per block
+	size_t numBlocks;
+	size_t numReaders;
+	float * data; // numBlocks * blockSize
+	size_t * lengths; // samples in every block
+	
+	size_t head; // blocks pushed
+	size_t dropped; // samples that didn't fit
+	int closed; // nothing more is coming
+	char pad[BQ_LINE];
+	size_t tails[BQ_MAXREADERS * (BQ_LINE / sizeof(size_t))]; // blocks taken by reader r at r * BQ_LINE / sizeof(size_t)
+};
+
+struct blockQueue * blockQueue_new(size_t blockSize, size_t numBlocks, size_t numReaders);
+
+void blockQueue_free(struct blockQueue * q);
+
+size_t blockQueue_push(struct blockQueue * q, const float * in, size_t n);
+
+size_t blockQueue_room(struct blockQueue * q);
+
+void blockQueue_close(struct blockQueue * q);
+
+const float * blockQueue_peek(struct blockQueue * q, size_t reader, size_t * n);
+
+void blockQueue_pop(struct blockQueue * q, size_t reader);
+
+int blockQueue_finished(struct blockQueue * q, size_t reader);
+
+#endif
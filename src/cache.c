@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "util.h"
+
+#define PRIME1 0x9E3779B185EBCA87ull
+#define PRIME2 0xC2B2AE3D27D4EB4Full
+#define PRIME3 0x165667B19E3779F9ull
+
+static uint64_t rotl(uint64_t x, int r){
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t cache_round(uint64_t acc, uint64_t word){
+	return rotl(acc + word * PRIME2, 31) * PRIME1;
+}
+
+static uint64_t cache_mix(uint64_t h){
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	
+	return h;
+}
+
+// the four lanes are independent, so the multiplies overlap
+static void cache_block(struct cacheHash * h, const unsigned char * block){
+	uint64_t word;
+	int i;
+	
+	for(i = 0; i < 4; i++){
+		memcpy(&word, block + 8 * i, sizeof word);
+		h->lane[i] = cache_round(h->lane[i], word);
+	}
+}
+
+void cacheHash_init(struct cacheHash * h){
+	h->lane[0] = PRIME1 + PRIME2;
+	h->lane[1] = PRIME2;
+	h->lane[2] = 0;
+	h->lane[3] = -PRIME1;
+	h->length = 0;
+	h->tailLength = 0;
+}
+
+void cacheHash_update(struct cacheHash * h, const void * data, size_t n){
+	const unsigned char * in = data;
+	size_t first;
+	
+	h->length += n;
+	if(h->tailLength > 0){
+		first = n < sizeof h->tail - h->tailLength ? n : sizeof h->tail - h->tailLength;
+		memcpy(h->tail + h->tailLength, in, first);
+		h->tailLength += first;
+		in += first;
+		n -= first;
+		if(h->tailLength < sizeof h->tail) return;
+		cache_block(h, h->tail);
+		h->tailLength = 0;
+	}
+	for(; n >= sizeof h->tail; in += sizeof h->tail, n -= sizeof h->tail){
+		cache_block(h, in);
+	}
+	memcpy(h->tail, in, n);
+	h->tailLength = n;
+}
+
+// doesn't change h, more can be hashed after it
+struct cacheKey cacheHash_final(const struct cacheHash * h){
+	struct cacheKey ret;
+	uint64_t acc = h->length * PRIME1, word;
+	size_t i;
+	
+	for(i = 0; i < 4; i++){
+		acc = rotl(acc ^ cache_round(0, h->lane[i]), 27) * PRIME1 + PRIME3;
+	}
+	for(i = 0; i + 8 <= h->tailLength; i += 8){
+		memcpy(&word, h->tail + i, sizeof word);
+		acc = rotl(acc ^ cache_round(0, word), 27) * PRIME1 + PRIME3;
+	}
+	for(; i < h->tailLength; i++){
+		acc = rotl(acc ^ (h->tail[i] * PRIME3), 11) * PRIME1;
+	}
+	
+	ret.h[0] = cache_mix(acc);
+	ret.h[1] = cache_mix(acc ^ rotl(h->lane[0] + h->lane[2], 17) ^ (h->lane[1] - h->lane[3]));
+	
+	return ret;
+}
+
+// every byte of the file at path into h, returns 0 if it can't be read
+int cache_hashFile(struct cacheHash * h, const char * path){
+	FILE * fp = fopen(path, "rb");
+	unsigned char * chunk;
+	size_t n;
+	int ok;
+	
+	if(fp == NULL){
+		fprintf(stderr, "! Can't open %s\n", path);
+		return 0;
+	}
+	chunk = fmalloc(CACHE_CHUNK);
+	while((n = fread(chunk, 1, CACHE_CHUNK, fp)) > 0){
+		cacheHash_update(h, chunk, n);
+	}
+	ok = !ferror(fp);
+	if(!ok) fprintf(stderr, "! Can't read %s\n", path);
+	free(chunk);
+	fclose(fp);
+	
+	return ok;
+}
+
+static char * cache_path(const char * dir, struct cacheKey key, const char * suffix){
+	size_t size = strlen(dir) + 1 + 32 + strlen(suffix) + 1;
+	char * ret = fmalloc(size);
+	
+	snprintf(ret, size, "%s/%016llx%016llx%s", dir,
+		(unsigned long long)key.h[0], (unsigned long long)key.h[1], suffix);
+	
+	return ret;
+}
+
+/**
+ * The results stored under key in dir, NULL if there are none (or they're
+ * damaged). They're followed by a 0 that length doesn't count, free them.
+ */
+char * cache_load(const char * dir, struct cacheKey key, size_t * length){
+	char * path = cache_path(dir, key, "");
+	FILE * fp = fopen(path, "rb");
+	char magic[8];
+	struct cacheKey stored;
+	uint64_t n, header = sizeof magic + sizeof stored.h + sizeof n;
+	struct stat st;
+	char * ret = NULL;
+	
+	free(path);
+	if(fp == NULL) return NULL;
+	
+	// a length that isn't what's in the file is a broken (or foreign) entry, not something to allocate
+	if(fstat(fileno(fp), &st) == 0 && (uint64_t)st.st_size >= header
+		&& fread(magic, sizeof magic, 1, fp) == 1 && memcmp(magic, CACHE_MAGIC, sizeof magic) == 0
+		&& fread(stored.h, sizeof stored.h, 1, fp) == 1 && memcmp(stored.h, key.h, sizeof key.h) == 0
+		&& fread(&n, sizeof n, 1, fp) == 1 && n == (uint64_t)st.st_size - header){
+		
+		ret = fmalloc(n + 1);
+		if(fread(ret, 1, n, fp) == n){
+			ret[n] = '\0';
+			*length = n;
+		}else{
+			free(ret);
+			ret = NULL;
+		}
+	}
+	fclose(fp);
+	
+	return ret;
+}
+
+// store length bytes of results under key in dir (made if needed), returns 0 if that failed
+int cache_store(const char * dir, struct cacheKey key, const char * data, size_t length){
+	char suffix[32];
+	char * path = cache_path(dir, key, "");
+	char * tmp;
+	uint64_t n = length;
+	FILE * fp;
+	int ok;
+	
+#ifdef _WIN32
+	mkdir(dir);
+#else
+	mkdir(dir, 0755);
+#endif
+	snprintf(suffix, sizeof suffix, ".%ld.tmp", (long)getpid());
+	tmp = cache_path(dir, key, suffix);
+	
+	fp = fopen(tmp, "wb");
+	if(fp == NULL){
+		fprintf(stderr, "! Can't write %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		free(path);
+		return 0;
+	}
+	ok = fwrite(CACHE_MAGIC, 8, 1, fp) == 1 && fwrite(key.h, sizeof key.h, 1, fp) == 1
+		&& fwrite(&n, sizeof n, 1, fp) == 1 && fwrite(data, 1, length, fp) == length;
+	ok = fclose(fp) == 0 && ok;
+#ifdef _WIN32
+	// rename doesn't replace an existing file there
+	if(ok) remove(path);
+#endif
+	ok = ok && rename(tmp, path) == 0;
+	if(!ok){
+		fprintf(stderr, "! Can't store %s\n", path);
+		remove(tmp);
+	}
+	free(tmp);
+	free(path);
+	
+	return ok;
+}
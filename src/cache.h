@@ -0,0 +1,42 @@
+#ifndef HARK_CACHE_H
+#define HARK_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define CACHE_MAGIC "harkcch1"
+#define CACHE_CHUNK (1 << 20) // bytes of a file hashed at a time
+
+/*
+ * An entry is a file named after its key (32 hex digits) in the cache
+ * directory, native endian:
+ *   magic[8] key:u64[2] length:u64 then length bytes of results
+ * Entries are written to a temporary name and renamed into place, so jobs
+ * sharing a directory never read half an entry.
+ */
+struct cacheKey{
+	uint64_t h[2];
+};
+
+// 128 bit, four lanes of 64 bit multiply-rotate: fast on audio, not cryptographic
+struct cacheHash{
+	uint64_t lane[4];
+	uint64_t length;
+	unsigned char tail[32]; // bytes waiting for a full block
+	size_t tailLength;
+};
+
+void cacheHash_init(struct cacheHash * h);
+
+void cacheHash_update(struct cacheHash * h, const void * data, size_t n);
+
+struct cacheKey cacheHash_final(const struct cacheHash * h);
+
+int cache_hashFile(struct cacheHash * h, const char * path);
+
+char * cache_load(const char * dir, struct cacheKey key, size_t * length);
+
+int cache_store(const char * dir, struct cacheKey key, const char * data, size_t length);
+
+#endif
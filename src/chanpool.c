@@ -0,0 +1,229 @@
+#define _POSIX_C_SOURCE 200112L // nanosleep
+
+#include <string.h>
+#include <time.h>
+
+#include "chanpool.h"
+#include "util.h"
+
+static void chanPool_idle(void){
+	struct timespec ts = {0, CP_IDLE_US * 1000L};
+	
+	nanosleep(&ts, NULL);
+}
+
+struct chanPool * chanPool_new(struct anPlan * plan, struct zoomPlan * zoom, size_t numChannels, int mix,
+	size_t numThreads, size_t blockSize, size_t numBlocks){
+	
+	struct chanPool * ret;
+	size_t i;
+	
+	if(numChannels < 1 || numChannels > CP_MAXCHANNELS || numThreads < 1){
+		fprintf(stderr, "! Bad channel pool (%zu channels on %zu threads)\n", numChannels, numThreads);
+		return NULL;
+	}
+	
+	ret = fmalloc(sizeof *ret);
+	ret->numChannels = numChannels;
+	ret->mix = mix && numChannels > 1;
+	ret->numStreams = ret->mix ? 1 : numChannels;
+	ret->blockSize = blockSize;
+	ret->dropped = 0;
+	ret->started = 0;
+	// more threads than streams would only wait
+	ret->numThreads = numThreads < ret->numStreams ? numThreads : ret->numStreams;
+	
+	for(i = 0; i < ret->numStreams; i++){
+		ret->queues[i] = blockQueue_new(blockSize, numBlocks, 1);
+		if(ret->queues[i] == NULL) exit(EXIT_FAILURE);
+		ret->an[i] = NULL;
+		ret->planes[i] = fmalloc(blockSize * sizeof *ret->planes[i]);
+	}
+	
+	ret->threads = fmalloc(ret->numThreads * sizeof *ret->threads);
+	for(i = 0; i < ret->numThreads; i++){
+		ret->threads[i].pool = ret;
+		ret->threads[i].index = i;
+		ret->threads[i].worker = plan != NULL ? anWorker_new(plan) : NULL;
+		ret->threads[i].zoom = zoom != NULL ? zoomWorker_new(zoom) : NULL;
+	}
+	
+	return ret;
+}
+
+/**
+ * The analyzer of a stream (a channel, or the mix), on the worker of the
+ * thread it will be analysed on, zoomed if the pool has a zoom plan. The
+ * pool frees it. Only before chanPool_start.
+ */
+struct analyzer * chanPool_analyzer(struct chanPool * p, size_t stream, enum anFormat format, size_t hop, int samplerate,
+	anCallback * callback, void * user){
+	
+	struct chanThread * t = p->threads + stream % p->numThreads;
+	
+	analyzer_free(p->an[stream]);
+	if(t->zoom != NULL){
+		p->an[stream] = analyzer_newZoom(t->zoom, format, hop, samplerate, callback, user);
+	}else{
+		p->an[stream] = analyzer_newOn(t->worker, format, hop, samplerate, callback, user);
+	}
+	
+	return p->an[stream];
+}
+
+static void * chanPool_thread(void * vdata){
+	struct chanThread * t = vdata;
+	struct chanPool * p = t->pool;
+	const float * block;
+	size_t s, n, finished;
+	int busy;
+	
+	while(1){
+		busy = 0;
+		finished = 0;
+		for(s = t->index; s < p->numStreams; s += p->numThreads){
+			block = blockQueue_peek(p->queues[s], 0, &n);
+			if(block == NULL){
+				finished += blockQueue_finished(p->queues[s], 0);
+				continue;
+			}
+			analyzer_push(p->an[s], block, n);
+			blockQueue_pop(p->queues[s], 0);
+			busy = 1;
+		}
+		if(finished == (p->numStreams - t->index + p->numThreads - 1) / p->numThreads) break;
+		if(!busy) chanPool_idle();
+	}
+	
+	for(s = t->index; s < p->numStreams; s += p->numThreads){
+		analyzer_flush(p->an[s]);
+	}
+	
+	return NULL;
+}
+
+// every stream needs its analyzer by now, returns 0 if a thread can't be started (none run then)
+int chanPool_start(struct chanPool * p){
+	size_t i, j;
+	int err;
+	
+	for(i = 0; i < p->numThreads; i++){
+		if((err = pthread_create(&p->threads[i].thread, NULL, chanPool_thread, p->threads + i)) != 0){
+			fprintf(stderr, "! pthread_create: %s\n", strerror(err));
+			// nobody would take the missing thread's streams
+			for(j = 0; j < p->numStreams; j++){
+				blockQueue_close(p->queues[j]);
+			}
+			for(j = 0; j < i; j++){
+				pthread_join(p->threads[j].thread, NULL);
+			}
+			return 0;
+		}
+	}
+	p->started = 1;
+	
+	return 1;
+}
+
+/**
+ * Every channel of n interleaved frames into a plane of its own, or their
+ * mean into the first plane. Each loop reads with a fixed stride and writes
+ * one plane straight through, which GCC vectorizes with shuffles at -O3;
+ * a block is small enough to still be in the cache for the next channel.
+ */
+static void chanPool_split(struct chanPool * p, const float * in, size_t n){
+	size_t c, i, channels = p->numChannels;
+	float * out;
+	float scale;
+	
+	if(!p->mix){
+		for(c = 0; c < channels; c++){
+			out = p->planes[c];
+			for(i = 0; i < n; i++) out[i] = in[i * channels + c];
+		}
+		return;
+	}
+	
+	out = p->planes[0];
+	scale = 1.0f / channels;
+	for(i = 0; i < n; i++) out[i] = in[i * channels];
+	for(c = 1; c < channels; c++){
+		for(i = 0; i < n; i++) out[i] += in[i * channels + c];
+	}
+	for(i = 0; i < n; i++) out[i] *= scale;
+}
+
+/**
+ * Producer only: deinterleave frames into the queues of the streams. If any
+ * stream is too far behind to take them all, they're dropped for every
+ * stream so the channels stay in step, and 0 is returned. Never waits.
+ */
+int chanPool_push(struct chanPool * p, const float * in, size_t frames){
+	size_t s, chunk;
+	
+	for(s = 0; s < p->numStreams; s++){
+		if(blockQueue_room(p->queues[s]) < frames){
+			p->dropped += frames;
+			return 0;
+		}
+	}
+	
+	while(frames > 0){
+		chunk = frames < p->blockSize ? frames : p->blockSize;
+		chanPool_split(p, in, chunk);
+		for(s = 0; s < p->numStreams; s++){
+			blockQueue_push(p->queues[s], p->planes[s], chunk);
+		}
+		in += chunk * p->numChannels;
+		frames -= chunk;
+	}
+	
+	return 1;
+}
+
+// the same for a producer that can wait (reading a file): until they fit, nothing is dropped
+void chanPool_pushWait(struct chanPool * p, const float * in, size_t frames){
+	size_t s, chunk;
+	
+	while(frames > 0){
+		chunk = frames < p->blockSize ? frames : p->blockSize;
+		for(s = 0; s < p->numStreams; s++){
+			while(blockQueue_room(p->queues[s]) < chunk) chanPool_idle();
+		}
+		chanPool_push(p, in, chunk);
+		in += chunk * p->numChannels;
+		frames -= chunk;
+	}
+}
+
+// after the last push: the threads analyse what's queued, flush and end
+void chanPool_finish(struct chanPool * p){
+	size_t i;
+	
+	for(i = 0; i < p->numStreams; i++){
+		blockQueue_close(p->queues[i]);
+	}
+	if(!p->started) return;
+	for(i = 0; i < p->numThreads; i++){
+		pthread_join(p->threads[i].thread, NULL);
+	}
+	p->started = 0;
+}
+
+// the plans stay, they're the caller's
+void chanPool_free(struct chanPool * p){
+	size_t i;
+	
+	if(p == NULL) return;
+	for(i = 0; i < p->numStreams; i++){
+		analyzer_free(p->an[i]);
+		blockQueue_free(p->queues[i]);
+		free(p->planes[i]);
+	}
+	for(i = 0; i < p->numThreads; i++){
+		anWorker_free(p->threads[i].worker);
+		zoomWorker_free(p->threads[i].zoom);
+	}
+	free(p->threads);
+	free(p);
+}
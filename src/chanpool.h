@@ -0,0 +1,66 @@
+#ifndef HARK_CHANPOOL_H
+#define HARK_CHANPOOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include "analyzer.h"
+#include "blockqueue.h"
+#include "zoom.h"
+
+#define CP_MAXCHANNELS 64
+#define CP_IDLE_US 1000 // how long a thread sleeps when its channels have caught up
+
+// one thread of the pool, analysing the streams s with s % numThreads == its index
+struct chanThread{
+	pthread_t thread;
+	struct chanPool * pool;
+	size_t index;
+	struct anWorker * worker;
+	struct zoomWorker * zoom;
+};
+
+/**
+ * Analysis of every channel of an interleaved stream on its own, spread
+ * over a few threads. The producer (a capture callback, which must never
+ * wait, or a file reader) deinterleaves each block into per channel queues
+ * in one pass, or mixes the channels down into a single one in the same
+ * pass; each thread takes its channels' blocks from there and pushes them to
+ * their analyzers, which share the thread's worker like harkd's clients do.
+ * Pushing neither locks nor allocates.
+ */
+struct chanPool{
+	size_t numChannels; // interleaved in what's pushed
+	size_t numStreams; // analysed: numChannels, 1 when they're mixed down
+	int mix;
+	size_t blockSize; // frames per queue block
+	size_t dropped; // frames that didn't fit, for every stream alike
+	
+	struct blockQueue * queues[CP_MAXCHANNELS]; // per stream, one reader
+	struct analyzer * an[CP_MAXCHANNELS]; // per stream
+	float * planes[CP_MAXCHANNELS]; // the producer's scratch, blockSize each
+	
+	size_t numThreads;
+	struct chanThread * threads;
+	int started;
+};
+
+struct chanPool * chanPool_new(struct anPlan * plan, struct zoomPlan * zoom, size_t numChannels, int mix,
+	size_t numThreads, size_t blockSize, size_t numBlocks);
+
+struct analyzer * chanPool_analyzer(struct chanPool * p, size_t stream, enum anFormat format, size_t hop, int samplerate,
+	anCallback * callback, void * user);
+
+int chanPool_start(struct chanPool * p);
+
+int chanPool_push(struct chanPool * p, const float * in, size_t frames);
+
+void chanPool_pushWait(struct chanPool * p, const float * in, size_t frames);
+
+void chanPool_finish(struct chanPool * p);
+
+void chanPool_free(struct chanPool * p);
+
+#endif
@@ -0,0 +1,310 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "featfile.h"
+#include "util.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0 // only Windows reads files as text unless told
+#endif
+
+#define FEAT_ALIGN 8 // chunks start at a multiple of this, so frames can be read in place
+#define FEAT_READ (1 << 30) // bytes per read() without mmap, Windows' takes an unsigned int
+
+static size_t featFile_chunkSize(size_t count, size_t bins){
+	size_t n = count * (sizeof(struct featFrame) + bins);
+	
+	return (n + FEAT_ALIGN - 1) / FEAT_ALIGN * FEAT_ALIGN;
+}
+
+static int featFile_write(struct featWriter * w, const void * data, size_t n){
+	if(!w->failed && n > 0 && fwrite(data, 1, n, w->fp) != n) w->failed = 1;
+	
+	return !w->failed;
+}
+
+/**
+ * Start the feature file at path, for an analysis of hop at samplerate.
+ * bins > 0 keeps that many quantized magnitudes per frame, the spectrum
+ * pooled into bands of equal width. Returns NULL if it can't be made.
+ */
+struct featWriter * featFile_create(const char * path, int samplerate, size_t hop, size_t bins){
+	struct featWriter * ret = fmalloc(sizeof *ret);
+	
+	ret->fp = fopen(path, "wb");
+	if(ret->fp == NULL){
+		fprintf(stderr, "! Can't open %s for writing\n", path);
+		free(ret);
+		return NULL;
+	}
+	
+	memset(&ret->header, 0, sizeof ret->header);
+	memcpy(ret->header.magic, FEAT_MAGIC, sizeof ret->header.magic);
+	ret->header.samplerate = samplerate;
+	ret->header.hop = hop;
+	ret->header.bins = bins;
+	ret->frames = fmalloc(FEAT_CHUNK * sizeof *ret->frames);
+	ret->spectra = bins > 0 ? fmalloc(FEAT_CHUNK * bins) : NULL;
+	ret->count = 0;
+	ret->capacity = 64;
+	ret->index = fmalloc(ret->capacity * sizeof *ret->index);
+	ret->numChunks = 0;
+	ret->offset = sizeof ret->header;
+	ret->numFrames = 0;
+	ret->failed = 0;
+	
+	if(!featFile_write(ret, &ret->header, sizeof ret->header)){
+		fprintf(stderr, "! Can't write feature header to %s\n", path);
+		featFile_close(ret);
+		return NULL;
+	}
+	
+	return ret;
+}
+
+// the frames buffered so far as a chunk, with its entry in the index
+static void featFile_flush(struct featWriter * w){
+	struct featChunk * c;
+	static const unsigned char zeros[FEAT_ALIGN];
+	size_t size, used;
+	
+	if(w->count == 0) return;
+	
+	if(w->numChunks == w->capacity){
+		w->capacity *= 2;
+		w->index = realloc(w->index, w->capacity * sizeof *w->index);
+		if(w->index == NULL){
+			fprintf(stderr, "! realloc failed (%zu)\n", w->capacity * sizeof *w->index);
+			exit(EXIT_FAILURE);
+		}
+	}
+	c = w->index + w->numChunks++;
+	c->firstPos = w->frames[0].pos;
+	c->lastPos = w->frames[w->count - 1].pos;
+	c->offset = w->offset;
+	c->count = w->count;
+	
+	size = featFile_chunkSize(w->count, w->header.bins);
+	used = w->count * (sizeof *w->frames + w->header.bins);
+	featFile_write(w, w->frames, w->count * sizeof *w->frames);
+	featFile_write(w, w->spectra, w->count * w->header.bins);
+	featFile_write(w, zeros, size - used);
+	w->offset += size;
+	w->count = 0;
+}
+
+// magnitudes in dB (a full scale sine through the Hann window is 0), the loudest bin of each of bins bands
+static void featFile_quantize(unsigned char * out, size_t bins, fftw_complex * spectrum, size_t length){
+	size_t k, b, n = length / 2 + 1;
+	double power, p, scale = 4.0 / length, q;
+	
+	for(b = 0, k = 0; b < bins; b++){
+		power = 0.0;
+		for(; k < n && k * bins / n == b; k++){
+			p = spectrum[k][0] * spectrum[k][0] + spectrum[k][1] * spectrum[k][1];
+			if(p > power) power = p;
+		}
+		q = power > 0.0 ? (10.0 * log10(power * scale * scale) - FEAT_DB_FLOOR) / FEAT_DB_STEP : 0.0;
+		out[b] = q <= 0.0 ? 0 : q >= 255.0 ? 255 : (unsigned char)q;
+	}
+}
+
+// append res, a chunk is written every FEAT_CHUNK frames
+void featFile_add(struct featWriter * w, const struct anResult * res){
+	struct featFrame * f = w->frames + w->count;
+	unsigned char * spectrum = w->spectra + w->count * w->header.bins;
+	
+	memset(f, 0, sizeof *f);
+	f->pos = res->pos;
+	if(res->silent){
+		f->flags = FEAT_SILENT;
+	}else{
+		f->freq = res->freq;
+		f->intens = res->intens;
+		f->energy = res->energy;
+		f->harmonic = res->harmonic;
+		f->length = res->length;
+	}
+	if(w->header.bins > 0){
+		if(res->spectrum != NULL && !res->silent){
+			featFile_quantize(spectrum, w->header.bins, res->spectrum, res->length);
+		}else{
+			memset(spectrum, 0, w->header.bins);
+		}
+	}
+	
+	w->numFrames++;
+	if(++w->count == FEAT_CHUNK) featFile_flush(w);
+}
+
+// write the last chunk, the index and the trailer, returns 0 if anything couldn't be written
+int featFile_close(struct featWriter * w){
+	struct featTrailer trailer;
+	int ok;
+	
+	featFile_flush(w);
+	memset(&trailer, 0, sizeof trailer);
+	trailer.indexOffset = w->offset;
+	trailer.numChunks = w->numChunks;
+	trailer.numFrames = w->numFrames;
+	memcpy(trailer.magic, FEAT_INDEX_MAGIC, sizeof trailer.magic);
+	featFile_write(w, w->index, w->numChunks * sizeof *w->index);
+	featFile_write(w, &trailer, sizeof trailer);
+	
+	ok = fclose(w->fp) == 0 && !w->failed;
+	free(w->frames);
+	free(w->spectra);
+	free(w->index);
+	free(w);
+	
+	return ok;
+}
+
+// the trailer, index and every chunk must lie inside the file, all but the last chunk full
+static int featFile_check(struct featReader * r){
+	const struct featTrailer * trailer;
+	size_t i;
+	
+	if(r->size < sizeof *r->header + sizeof *trailer) return 0;
+	r->header = (const struct featHeader *)r->data;
+	trailer = (const struct featTrailer *)(r->data + r->size - sizeof *trailer);
+	if(memcmp(r->header->magic, FEAT_MAGIC, sizeof r->header->magic) != 0) return 0;
+	if(memcmp(trailer->magic, FEAT_INDEX_MAGIC, sizeof trailer->magic) != 0) return 0;
+	if(trailer->indexOffset % FEAT_ALIGN != 0 || trailer->indexOffset > r->size - sizeof *trailer
+		|| trailer->numChunks > (r->size - sizeof *trailer - trailer->indexOffset) / sizeof *r->index) return 0;
+	
+	r->index = (const struct featChunk *)(r->data + trailer->indexOffset);
+	r->numChunks = trailer->numChunks;
+	r->numFrames = 0;
+	for(i = 0; i < r->numChunks; i++){
+		if(r->index[i].count == 0 || r->index[i].count > FEAT_CHUNK) return 0;
+		if(i + 1 < r->numChunks && r->index[i].count != FEAT_CHUNK) return 0;
+		if(r->index[i].offset % FEAT_ALIGN != 0 || r->index[i].offset > trailer->indexOffset
+			|| featFile_chunkSize(r->index[i].count, r->header->bins) > trailer->indexOffset - r->index[i].offset) return 0;
+		r->numFrames += r->index[i].count;
+	}
+	
+	return r->numFrames == trailer->numFrames;
+}
+
+/**
+ * Map the feature file at path. Returns NULL if it can't be read or isn't
+ * a complete feature file.
+ */
+struct featReader * featFile_open(const char * path){
+	struct featReader * ret = fmalloc(sizeof *ret);
+	struct stat st;
+#ifdef _WIN32
+	size_t done;
+	int n;
+#endif
+	int fd = open(path, O_RDONLY | O_BINARY);
+	
+	if(fd < 0 || fstat(fd, &st) < 0){
+		fprintf(stderr, "! %s: %s\n", path, strerror(errno));
+		if(fd >= 0) close(fd);
+		free(ret);
+		return NULL;
+	}
+	ret->size = st.st_size;
+#ifdef _WIN32
+	// no mmap, read it all, read may return less than asked for
+	ret->data = fmalloc(ret->size > 0 ? ret->size : 1);
+	for(done = 0; done < ret->size; done += n){
+		n = read(fd, (unsigned char *)ret->data + done, ret->size - done < FEAT_READ ? ret->size - done : FEAT_READ);
+		if(n <= 0) break;
+	}
+	if(done != ret->size){
+		fprintf(stderr, "! Can't read %s\n", path);
+		close(fd);
+		free((void *)ret->data);
+		free(ret);
+		return NULL;
+	}
+#else
+	ret->data = ret->size > 0 ? mmap(NULL, ret->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	if(ret->data == MAP_FAILED){
+		fprintf(stderr, "! mmap %s: %s\n", path, strerror(errno));
+		close(fd);
+		free(ret);
+		return NULL;
+	}
+#endif
+	close(fd);
+	
+	if(!featFile_check(ret)){
+		fprintf(stderr, "! %s isn't a complete feature file\n", path);
+		featFile_free(ret);
+		return NULL;
+	}
+	
+	return ret;
+}
+
+void featFile_free(struct featReader * r){
+	if(r == NULL) return;
+#ifdef _WIN32
+	free((void *)r->data);
+#else
+	munmap((void *)r->data, r->size);
+#endif
+	free(r);
+}
+
+/**
+ * Frame i of the file, its magnitudes in spectrum (if it's not NULL, and
+ * NULL when the file has none).
+ */
+const struct featFrame * featFile_frame(const struct featReader * r, size_t i, const unsigned char ** spectrum){
+	const struct featChunk * c = r->index + i / FEAT_CHUNK;
+	const unsigned char * base = r->data + c->offset;
+	size_t j = i % FEAT_CHUNK;
+	
+	if(spectrum != NULL){
+		*spectrum = r->header->bins > 0 ? base + c->count * sizeof(struct featFrame) + j * r->header->bins : NULL;
+	}
+	
+	return (const struct featFrame *)base + j;
+}
+
+// the first frame ending at or after sample pos, numFrames if there's none
+size_t featFile_find(const struct featReader * r, uint64_t pos){
+	const struct featFrame * frames;
+	size_t low = 0, high = r->numChunks, mid, chunk;
+	
+	// the first chunk that ends at or after pos
+	while(low < high){
+		mid = low + (high - low) / 2;
+		if(r->index[mid].lastPos < pos){
+			low = mid + 1;
+		}else{
+			high = mid;
+		}
+	}
+	if(low == r->numChunks) return r->numFrames;
+	
+	chunk = low;
+	frames = (const struct featFrame *)(r->data + r->index[chunk].offset);
+	low = 0;
+	high = r->index[chunk].count;
+	while(low < high){
+		mid = low + (high - low) / 2;
+		if(frames[mid].pos < pos){
+			low = mid + 1;
+		}else{
+			high = mid;
+		}
+	}
+	
+	return chunk * FEAT_CHUNK + low;
+}
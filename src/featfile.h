@@ -0,0 +1,99 @@
+#ifndef HARK_FEATFILE_H
+#define HARK_FEATFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "analyzer.h"
+
+#define FEAT_MAGIC "harkfeat"
+#define FEAT_INDEX_MAGIC "harkidx1"
+#define FEAT_CHUNK 1024 // frames per chunk, every chunk but the last is full
+#define FEAT_DB_STEP 0.5 // of a quantized magnitude
+#define FEAT_DB_FLOOR -127.5 // what 0 stands for, 255 is 0 dB: a full scale sine
+
+#define FEAT_SILENT 1 // the gate closed here
+
+/*
+ * A feature file holds the analyzer's results of a recording, native endian:
+ *   header
+ *   chunks: up to FEAT_CHUNK frames, then bins magnitudes (one byte each) per frame
+ *   index: one featChunk per chunk
+ *   trailer, at the very end
+ * It's written as the analysis goes, a chunk at a time, and the index only
+ * when it's closed: a file without a trailer was cut short. A frame the
+ * analyzer had no spectrum for (silent, zoomed or smoothed) has all 0
+ * magnitudes.
+ */
+struct featHeader{
+	char magic[8];
+	uint32_t samplerate;
+	uint32_t hop;
+	uint32_t bins; // magnitudes per frame, 0 for none
+	uint32_t pad;
+};
+
+struct featFrame{
+	uint64_t pos; // sample just after the frame
+	float freq;
+	float intens;
+	float energy; // RMS
+	int32_t harmonic;
+	uint32_t length; // FFT size
+	uint32_t flags;
+};
+
+struct featChunk{
+	uint64_t firstPos;
+	uint64_t lastPos;
+	uint64_t offset; // of its first frame
+	uint64_t count;
+};
+
+struct featTrailer{
+	uint64_t indexOffset;
+	uint64_t numChunks;
+	uint64_t numFrames;
+	char magic[8];
+};
+
+struct featWriter{
+	FILE * fp;
+	struct featHeader header;
+	struct featFrame * frames; // the chunk being filled
+	unsigned char * spectra;
+	size_t count;
+	struct featChunk * index;
+	size_t numChunks;
+	size_t capacity;
+	uint64_t offset; // where the next chunk goes
+	uint64_t numFrames;
+	int failed;
+};
+
+// a feature file mapped for reading, frames are found by position in O(log n)
+struct featReader{
+	const unsigned char * data;
+	size_t size;
+	const struct featHeader * header;
+	const struct featChunk * index;
+	size_t numChunks;
+	size_t numFrames;
+};
+
+struct featWriter * featFile_create(const char * path, int samplerate, size_t hop, size_t bins);
+
+void featFile_add(struct featWriter * w, const struct anResult * res);
+
+int featFile_close(struct featWriter * w);
+
+struct featReader * featFile_open(const char * path);
+
+void featFile_free(struct featReader * r);
+
+size_t featFile_find(const struct featReader * r, uint64_t pos);
+
+const struct featFrame * featFile_frame(const struct featReader * r, size_t i, const unsigned char ** spectrum);
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * fft-load: stress the analyzer with many synthetic whistlers at once
+ *
+ * Usage: fft-load [streams] [seconds] [threads] [fftSize] [hop] [gate] [sizes] [band] [partials] [lookahead] [format]
+ * Every stream is a random melody of whistle-like notes (a strong fundamental
+ * with a weak second harmonic and some noise) and rests, rendered with
+ * pianer's voices. gate is the RMS that opens the silence gate, 0 turns it off.
+ * sizes is a comma separated list of smaller FFT sizes to switch between
+ * adaptively, fftSize is always the largest. band (like 400-4000) zooms into
+ * just those frequencies at the resolution of fftSize instead. partials turns
+ * on the partial tracker, following that many. lookahead smooths the notes
+ * with a Viterbi decoder deciding every frame that many frames later.
+ * format is float32 (the default) or int16, which the streams are captured
+ * and kept in.
+ * The streams are pushed through the analyzer one hop at a time, as if they
+ * came from capture callbacks, but as fast as possible. Since we know which
+ * note was whistled we can report the accuracy, next to throughput and
+ * per-frame latency, and where the time went stage by stage.
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "analyzer.h"
+#include "harmonics.h"
+#include "score.h"
+#include "stats.h"
+#include "util.h"
+
+#define SAMPLERATE 44100
+#define NOISE 0.02
+#define LOW_NOTE 3 // D#4, whistles live roughly between here..
+#define HIGH_NOTE 31 // ..and G6
+#define REST (MIN_HARMONIC - 1)
+
+struct melodyNote{
+	size_t pos;
+	size_t len;
+	int harmonic;
+};
+
+struct loadStream{
+	size_t numMelody;
+	struct melodyNote * melody;
+	size_t cursor; // melody note the last frame fell in
+	struct score * score;
+	struct sched * sched;
+	struct analyzer * an;
+	uint32_t seed;
+	
+	size_t frames;
+	size_t correct;
+	size_t silences; // silence events while resting
+	double sizeTotal; // sum of the FFT sizes used
+	int lastHarmonic;
+	size_t changes; // reported note changes, compare with numMelody
+	double nsTotal; // time spent pushing frames through the analyzer
+	double nsMax;
+};
+
+struct loadJob{
+	struct anWorker * worker;
+	struct zoomWorker * zoom;
+	struct statsBlock * stats;
+	struct loadStream * streams;
+	size_t numStreams;
+	size_t numThreads;
+	size_t threadId;
+	size_t length; // in samples
+	size_t hop;
+	enum anFormat format;
+};
+
+static double nowNs(void){
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static uint32_t xorshift(uint32_t * s){
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+// note lengths between 150 and 600 ms, fundamental plus a weak octave, one in five is a rest
+void makeMelody(struct loadStream * s, size_t length, uint32_t seed){
+	struct noteParams * notes;
+	size_t pos = 0, n = 0, cap = 16;
+	
+	s->seed = seed ? seed : 1;
+	s->melody = fmalloc(cap * sizeof *s->melody);
+	
+	while(pos < length){
+		if(n == cap){
+			cap *= 2;
+			s->melody = realloc(s->melody, cap * sizeof *s->melody);
+			if(s->melody == NULL){
+				fprintf(stderr, "! realloc failed (%zu)\n", cap * sizeof *s->melody);
+				exit(EXIT_FAILURE);
+			}
+		}
+		s->melody[n].pos = pos;
+		s->melody[n].len = SAMPLERATE * (150 + xorshift(&s->seed) % 450) / 1000;
+		s->melody[n].harmonic = LOW_NOTE + xorshift(&s->seed) % (HIGH_NOTE - LOW_NOTE + 1);
+		if(xorshift(&s->seed) % 5 == 0) s->melody[n].harmonic = REST;
+		pos += s->melody[n].len;
+		n++;
+	}
+	s->numMelody = n;
+	
+	notes = fmalloc(2 * n * sizeof *notes);
+	for(pos = 0; pos < n; pos++){
+		// a rest is just an inaudible note
+		notes[2 * pos].a = s->melody[pos].harmonic == REST ? 0.0 : 0.5;
+		notes[2 * pos].g = 0.5;
+		notes[2 * pos].f = harmonicToFreq(s->melody[pos].harmonic);
+		notes[2 * pos].pos = s->melody[pos].pos;
+		notes[2 * pos].len = s->melody[pos].len;
+		notes[2 * pos + 1] = notes[2 * pos];
+		notes[2 * pos + 1].a = notes[2 * pos].a / 10.0;
+		notes[2 * pos + 1].f *= 2.0;
+	}
+	s->score = score_new(notes, 2 * n, SAMPLERATE);
+	s->sched = sched_new(s->score, 64);
+	s->cursor = 0;
+	free(notes);
+}
+
+// compare with the note whistled in the middle of the frame
+void onResult(void * user, const struct anResult * res){
+	struct loadStream * s = user;
+	size_t mid = res->pos - res->length / 2;
+	
+	while(s->cursor + 1 < s->numMelody && s->melody[s->cursor + 1].pos <= mid) s->cursor++;
+	
+	if(res->silent){
+		if(s->melody[s->cursor].harmonic == REST) s->silences++;
+		return;
+	}
+	s->frames++;
+	s->sizeTotal += res->length;
+	if(res->harmonic != s->lastHarmonic) s->changes++;
+	s->lastHarmonic = res->harmonic;
+	if(res->harmonic == s->melody[s->cursor].harmonic) s->correct++;
+}
+
+void * loadThread(void * vdata){
+	struct loadJob * job = vdata;
+	float * block = fmalloc(job->hop * sizeof *block);
+	int16_t * block16 = fmalloc(job->hop * sizeof *block16);
+	struct loadStream * s;
+	size_t pos, i, j, frames;
+	double t0, dt;
+	uint64_t capture;
+	
+	// round-robin over this thread's streams, one hop at a time like callbacks would
+	for(pos = 0; pos < job->length; pos += job->hop){
+		for(i = job->threadId; i < job->numStreams; i += job->numThreads){
+			s = job->streams + i;
+			
+			capture = stats_now();
+			sched_render(s->sched, block, job->hop);
+			for(j = 0; j < job->hop; j++){
+				block[j] += NOISE * ((double)xorshift(&s->seed) / (double)UINT32_MAX - 0.5);
+			}
+			// as a paInt16 stream would deliver it
+			if(job->format == AN_INT16){
+				for(j = 0; j < job->hop; j++){
+					block16[j] = block[j] >= 1.0f ? 32767 : block[j] <= -1.0f ? -32768 : (int16_t)lrintf(block[j] * 32767.0f);
+				}
+			}
+			stats_add(job->stats, STAGE_CAPTURE, capture);
+			
+			frames = s->frames;
+			t0 = nowNs();
+			if(job->format == AN_INT16){
+				analyzer_pushInt16(s->an, block16, job->hop);
+			}else{
+				analyzer_push(s->an, block, job->hop);
+			}
+			dt = nowNs() - t0;
+			
+			s->nsTotal += dt;
+			if(s->frames > frames && dt > s->nsMax) s->nsMax = dt;
+		}
+	}
+	
+	for(i = job->threadId; i < job->numStreams; i += job->numThreads){
+		analyzer_flush(job->streams[i].an);
+	}
+	
+	free(block);
+	free(block16);
+	return NULL;
+}
+
+int main(int argc, char ** argv){
+	size_t numStreams = 16, numThreads = 4, seconds = 10;
+	size_t fftSize = 1024 * 4, hop = 1024;
+	double gate = 0.01;
+	struct loadStream * streams;
+	struct loadJob * jobs;
+	struct anPlan * plan;
+	struct anPlan * plans[AN_MAXSIZES];
+	struct zoomPlan * zoom = NULL;
+	double low = 0.0, high = 0.0;
+	char * end;
+	size_t sizes[AN_MAXSIZES], numSizes = 0;
+	pthread_t * threads;
+	struct statsPage * stats;
+	struct statsBlock total;
+	int lookahead = -1, err;
+	enum anFormat format = AN_FLOAT32;
+	size_t partials = 0, local = 0, changes = 0, notes = 0, i, j, frames = 0, correct = 0, skipped = 0, silences = 0;
+	double t0, wall, nsTotal = 0.0, nsMax = 0.0, sizeTotal = 0.0;
+	
+	if(argc > 1) numStreams = strtoul(argv[1], NULL, 10);
+	if(argc > 2) seconds = strtoul(argv[2], NULL, 10);
+	if(argc > 3) numThreads = strtoul(argv[3], NULL, 10);
+	if(argc > 4) fftSize = strtoul(argv[4], NULL, 10);
+	if(argc > 5) hop = strtoul(argv[5], NULL, 10);
+	if(argc > 6) gate = strtod(argv[6], NULL);
+	if(argc > 7) numSizes = analyzer_parseSizes(argv[7], sizes, AN_MAXSIZES - 1);
+	if(argc > 9) partials = strtoul(argv[9], NULL, 10);
+	if(argc > 10) lookahead = atoi(argv[10]);
+	if(argc > 11 && strcmp(argv[11], "int16") == 0) format = AN_INT16;
+	if(argc > 8 && strcmp(argv[8], "0") != 0){
+		low = strtod(argv[8], &end);
+		high = *end == '-' ? strtod(end + 1, NULL) : 0.0;
+	}
+	if(numStreams < 1 || numThreads < 1 || seconds < 1 || fftSize < 2 || hop < 1 || (argc > 7 && numSizes == 0 && strcmp(argv[7], "0") != 0)
+		|| (argc > 11 && format != AN_INT16 && strcmp(argv[11], "float32") != 0)){
+		fprintf(stderr, "! Usage: %s [streams] [seconds] [threads] [fftSize] [hop] [gate] [sizes] [band] [partials] [lookahead] [float32|int16]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(numThreads > numStreams) numThreads = numStreams;
+	
+	// one plan for everyone, one set of scratch buffers per thread
+	plan = anPlan_new(fftSize);
+	for(i = 0; i < numSizes; i++){
+		plans[i] = anPlan_new(sizes[i]);
+	}
+	if(numSizes > 0) plans[numSizes++] = plan;
+	if(argc > 8 && strcmp(argv[8], "0") != 0 && (zoom = zoomPlan_new(SAMPLERATE, low, high, fftSize)) == NULL) return EXIT_FAILURE;
+	stats = stats_new(NULL, numThreads, NULL, 0);
+	jobs = fmalloc(numThreads * sizeof *jobs);
+	threads = fmalloc(numThreads * sizeof *threads);
+	for(i = 0; i < numThreads; i++){
+		jobs[i].worker = anWorker_new(plan);
+		jobs[i].zoom = zoom != NULL ? zoomWorker_new(zoom) : NULL;
+		jobs[i].stats = stats->blocks + i;
+	}
+	
+	streams = fmalloc(numStreams * sizeof *streams);
+	for(i = 0; i < numStreams; i++){
+		memset(streams + i, 0, sizeof *streams);
+		makeMelody(streams + i, seconds * SAMPLERATE, 2654435761u * (i + 1));
+		if(zoom != NULL){
+			streams[i].an = analyzer_newZoom(jobs[i % numThreads].zoom, format, hop, SAMPLERATE, onResult, streams + i);
+		}else{
+			streams[i].an = analyzer_newOn(jobs[i % numThreads].worker, format, hop, SAMPLERATE, onResult, streams + i);
+		}
+		analyzer_setGate(streams[i].an, gate, gate / 2.0, 0.25, 2);
+		analyzer_setTracker(streams[i].an, partials);
+		analyzer_setSmoothing(streams[i].an, lookahead);
+		analyzer_setStats(streams[i].an, jobs[i % numThreads].stats);
+		if(!analyzer_setSizes(streams[i].an, plans, numSizes)){
+			fprintf(stderr, "! FFT sizes must be ascending and smaller than %zu\n", fftSize);
+			return EXIT_FAILURE;
+		}
+	}
+	
+	printf("Streams: %zu\nThreads: %zu\nAudio per stream: %zus\nFFT-size: %zu\nWindow-inc: %zu\n",
+		numStreams, numThreads, seconds, fftSize, hop);
+	if(zoom != NULL){
+		printf("Zoom: %.0f-%.0f Hz, decimation %zu, %zu-point complex FFT, %zu taps\n",
+			zoom->low, zoom->high, zoom->decimation, zoom->bins, zoom->taps);
+	}
+	printf("Header and ring per stream: %zu bytes (%s)\n", analyzer_ringSize(streams[0].an->length, format), format == AN_INT16 ? "int16" : "float32");
+	
+	t0 = nowNs();
+	for(i = 0; i < numThreads; i++){
+		jobs[i].streams = streams;
+		jobs[i].numStreams = numStreams;
+		jobs[i].numThreads = numThreads;
+		jobs[i].threadId = i;
+		jobs[i].length = seconds * SAMPLERATE;
+		jobs[i].hop = hop;
+		jobs[i].format = format;
+		if((err = pthread_create(threads + i, NULL, loadThread, jobs + i)) != 0){
+			fprintf(stderr, "! pthread_create: %s\n", strerror(err));
+			break;
+		}
+	}
+	// a missing thread's streams aren't analysed, there's nothing to report
+	for(j = 0; j < i; j++){
+		pthread_join(threads[j], NULL);
+	}
+	if(i < numThreads) return EXIT_FAILURE;
+	wall = (nowNs() - t0) / 1e9;
+	
+	printf("---- ----\n stream   frames   accuracy   mean ms   max ms\n");
+	for(i = 0; i < numStreams; i++){
+		printf("%7zu %8zu %9.2f%% %9.3f %8.3f\n", i, streams[i].frames,
+			streams[i].frames ? 100.0 * streams[i].correct / streams[i].frames : 0.0,
+			streams[i].frames ? streams[i].nsTotal / streams[i].frames / 1e6 : 0.0, streams[i].nsMax / 1e6);
+		frames += streams[i].frames;
+		correct += streams[i].correct;
+		skipped += streams[i].an->skipped;
+		silences += streams[i].silences;
+		sizeTotal += streams[i].sizeTotal;
+		changes += streams[i].changes;
+		notes += streams[i].numMelody;
+		if(partials > 0) local += streams[i].an->tracker->frames - streams[i].an->tracker->fullFrames;
+		nsTotal += streams[i].nsTotal;
+		if(streams[i].nsMax > nsMax) nsMax = streams[i].nsMax;
+	}
+	
+	printf("---- ----\n");
+	printf("Accuracy: %.2f%% (%zu / %zu frames)\n", frames ? 100.0 * correct / frames : 0.0, correct, frames);
+	if(numSizes > 0) printf("Adaptive: mean FFT-size %.0f\n", frames ? sizeTotal / frames : 0.0);
+	if(lookahead >= 0) printf("Smoothing: %i frames (%.1f ms) lookahead\n", lookahead, 1000.0 * lookahead * hop / SAMPLERATE);
+	if(partials > 0) printf("Tracker: %zu of %zu frames searched locally\n", local, frames);
+	printf("Note changes: %zu reported for %zu notes and rests\n", changes, notes);
+	printf("Gated: %zu frames skipped, %zu silence events in rests\n", skipped, silences);
+	printf("Wall time: %.3fs, %.1fx realtime per stream incl. synthesis\n",
+		wall, (double)seconds / wall);
+	printf("Analysis: %.3f CPU-s, %.1f realtime streams per core\n",
+		nsTotal / 1e9, (double)(seconds * numStreams) / (nsTotal / 1e9));
+	printf("Latency: window %.1f ms + analysis %.3f ms mean, %.3f ms max per frame\n",
+		1000.0 * (numSizes > 0 && frames ? sizeTotal / frames : (double)fftSize) / SAMPLERATE, frames ? nsTotal / frames / 1e6 : 0.0, nsMax / 1e6);
+	
+	// capture is the synthesis here
+	stats_sum(stats->blocks, numThreads, &total);
+	printf("---- ----\n  stage      calls    mean us     max us   CPU-s\n");
+	for(i = 0; i < NUM_STAGES; i++){
+		printf("%7s %10llu %10.2f %10.2f %7.3f\n", stageNames[i], (unsigned long long)total.stage[i].calls,
+			total.stage[i].calls ? total.stage[i].totalNs / 1e3 / total.stage[i].calls : 0.0,
+			total.stage[i].maxNs / 1e3, total.stage[i].totalNs / 1e9);
+	}
+	
+	for(i = 0; i < numStreams; i++){
+		analyzer_free(streams[i].an);
+		sched_free(streams[i].sched);
+		score_free(streams[i].score);
+		free(streams[i].melody);
+	}
+	for(i = 0; i < numThreads; i++){
+		anWorker_free(jobs[i].worker);
+		zoomWorker_free(jobs[i].zoom);
+	}
+	for(i = 0; i + 1 < numSizes; i++){
+		anPlan_free(plans[i]);
+	}
+	anPlan_free(plan);
+	zoomPlan_free(zoom);
+	free(streams);
+	free(jobs);
+	free(threads);
+	stats_free(stats);
+	
+	return 0;
+}
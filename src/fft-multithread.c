@@ -1,157 +1,105 @@
+/*
+ * fft-multithread: the loudest note of the default input, as a pipeline
+ *
+ * Usage: fft-multithread [amplifier] [threads] [fft-size] [window-inc] [decimation] [stats]
+ * threads gives the thread of every stage, one digit each for source,
+ * decimate, window, transform, peak, note and sink (0 is the capture
+ * callback, "0000000" runs everything there, "0111222" the default, the
+ * analysis and the printing on threads of their own). Runs until enter is
+ * pressed, then prints what every stage cost. With stats the counters are
+ * in that file as well, for hark-top to watch.
+ */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <fftw3.h>
 #include <portaudio.h>
-#include <pthread.h>
 
-#include "util.h"
+#include "pipeline.h"
 #include "harmonics.h"
+#include "util.h"
 
-struct fftBuf;
+#define NUM_PIPE_STAGES 7
 
-struct aBuf{
-	int samplerate;
-	int fftSize;
-	int fftWinInc;
-	double amplifier;
+int recordCallback(const void * vin, void * vout, unsigned long frameCount,
+	const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void * vdata){
 	
-	size_t length;
-	size_t pos;
-	double * samples;
+	pipeline_push(vdata, vin, frameCount);
 	
-	size_t numThreads;
-	struct fftBuf * ffts;
-};
-
-struct fftBuf{
-	fftw_plan panama;
-	double * fftIn;
-	fftw_complex * fftOut;
-	
-	pthread_t thread;
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
-	int threadId;
-	
-	struct aBuf * info;
-};
+	return paContinue;
+}
 
-void * fftThread(void * vdata){
-	struct aBuf * data = vdata;
-	double freq, intens;
-	int harmonic = 0, octave = 0;
-	const char * note;
-	const char * line;
-	
-	pthread_mutex_lock(&data->mutex);
-	while(1){
-		pthread_cond_wait(&data->cond, &data->mutex);
-		
-		fftw_execute(data->panama);
-		freq = highFreq(data->fftOut, data->length, data->samplerate, &intens);
-		
-		if(freq < 16.0) freq = 16.0;
-		
-		harmonic = freqToHarmonic(freq);
-		note = harmonicToNote(harmonic, &octave);
-		line = harmonicToLine(harmonic);
-		printf("%12.6f:   % 3i   %s%s%i   %s   %12.6f\n", 
-			freq, harmonic, note, strlen(note) == 1 ? " " : "", octave, line, intens);
-	}
+static void onNote(void * user, const struct pipeItem * item){
+	int octave = 0;
+	const char * note = harmonicToNote(item->harmonic, &octave);
+	const char * line = harmonicToLine(item->harmonic);
 	
-	return NULL;
+	printf("%12.6f:   % 3i   %s%s%i   %s   %12.6f\n",
+		item->freq, item->harmonic, note, strlen(note) == 1 ? " " : "", octave, line, item->intens);
 }
 
-int recordCallback(const void * vin, void * vout, unsigned long frameCount, 
-	const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void * vdata){
-	
-	struct aBuf * data = vdata;
-	const float * in = vin;
-	size_t i;
-	
-	for(i = 0; i < frameCount; i++){
-		if(data->pos == data->length) break;
-		if(data->pos > data->length) return paAbort;
-		data->samples[data->pos] = data->amplifier * in[i];
-		data->pos++;
-	}
-	// either the buffer is full or we ran out of input
-	if(data->pos == data->length){
-		/*if(pthread_mutex_trylock(&data->mutex)){ // FFT'ing took too long, bail
-			// fprintf(stderr, "! recordCallback's trylock failed\n");
-			return paAbort;
-		}*/
-		pthread_mutex_lock(&data->mutex);
-		memcpy(data->fftIn, data->samples, data->length);
-		pthread_cond_signal(&data->cond);
-		pthread_mutex_unlock(&data->mutex);
-		
-		// shift data
-		data->pos -= data->fftWinInc; // == data->length - data->fftWinInc
-		memmove(data->samples, data->samples + data->fftWinInc, data->pos * sizeof *data->samples);
-	}
+// the samplerate the default input runs at by itself, after Pa_Initialize
+static int deviceRate(void){
+	PaDeviceIndex device = Pa_GetDefaultInputDevice();
 	
-	// in case we haven't run out of input yet
-	for(; i < frameCount; i++){
-		if(data->pos >= data->length) break;
-		data->samples[data->pos] = data->amplifier * in[i];
-		data->pos++;
-	}
-	
-	return paContinue;
+	return device == paNoDevice ? 44100 : (int)Pa_GetDeviceInfo(device)->defaultSampleRate;
 }
 
 int main(int argc, char ** argv){
-	size_t i, j;
-	size_t numThreads = 2;
-	// FFT stuff
+	// fft stuff
+	int samplerate;
 	int fftSize = 1024 * 4;
 	int fftWinInc = fftSize / 4;
-	// Portaudio stuff
+	size_t decimation = 1;
+	double amplifier = 1.0;
+	const char * threads = "0111222";
+	const char * statsPath = NULL;
+	// portaudio stuff
 	PaError paer;
 	PaStream * stream;
 	
-	struct fftBuf ffts[numThreads];
-	struct aBuf buf = {44100, fftSize, fftWinInc, 1.0, fftSize, 0, NULL, numThreads, ffts};
-	
-	buf.samples = fmalloc(buf.length * sizeof *buf.samples);
-	for(j = 0; j < buf.length; j++) buf.samples[j] = 0.0;
+	struct pipeline * pipe = pipeline_new();
+	struct statsBlock total;
+	struct stageCounter * c;
+	size_t i, s;
 	
-	for(i = 0; i < numThreads; i++){
-		ffts[i].fftIn = fmalloc(ffts[i].length * sizeof *ffts[i].samples);
-		for(j = 0; j < ffts[i].length; j++) ffts[i].fftIn[j] = 0.0;
-		ffts[i].fftOut = fftw_malloc(ffts[i].length * sizeof *ffts[i].fftOut);
-		for(j = 0; j < ffts[i].length; j++){
-			ffts[i].fftOut[j][0] = 0.0;
-			ffts[i].fftOut[j][1] = 0.0;
-		}
-		
-		ffts[i].panama = fftw_plan_dft_r2c_1d(buf.length, buf.fftIn, buf.fftOut, FFTW_ESTIMATE);
-		
-		ffts[i].mutex = PTHREAD_MUTEX_INITIALIZER;
-		ffts[i].cond = PTHREAD_COND_INITIALIZER;
-		
-		ffts[i].info = &buf;
-	}
+	if(argc > 1 && ((amplifier = strtod(argv[1], NULL)) < 1.0)) amplifier = 1.0;
+	if(argc > 2) threads = argv[2];
+	if(argc > 3) fftSize = atoi(argv[3]);
+	fftWinInc = argc > 4 ? atoi(argv[4]) : fftSize / 4;
+	if(argc > 5) decimation = strtoul(argv[5], NULL, 10);
+	if(argc > 6) statsPath = argv[6];
 	
-	if(argc > 1 && ((buf.amplifier = strtod(argv[1], NULL)) < 1.0)){
-		buf.amplifier = 1.0;
+	if(strlen(threads) != NUM_PIPE_STAGES || strspn(threads, "0123456789") != NUM_PIPE_STAGES || fftSize < 2 || fftWinInc < 1){
+		fprintf(stderr, "! Usage: %s [amplifier] [threads] [fft-size] [window-inc] [decimation] [stats]\n", argv[0]);
+		return EXIT_FAILURE;
 	}
 	
-	printf("---- ----\nInit done\n---- ----\n");
-	
-	printf("FFT-size: %i\nWindow-length: %f\nWindow-inc: %i\n", fftSize, (double)fftSize/(double)buf.samplerate, fftWinInc);
-	
-	pthread_create(&ffThread1, NULL, fftThread, &buf);
-	//pthread_create(&ffThread2, NULL, fftThread, &buf);
-	
 	paer = Pa_Initialize();
 	if(paer != paNoError){
 		fprintf(stderr, "! Pa_Initialize failed: %s\n", Pa_GetErrorText(paer));
 		return EXIT_FAILURE;
 	}
-	paer = Pa_OpenDefaultStream(&stream, 1, 0, paFloat32, buf.samplerate, fftWinInc, recordCallback, &buf);
+	samplerate = deviceRate();
+	
+	if(!pipeline_add(pipe, pipe_source(fftSize, fftWinInc, samplerate, amplifier), threads[0] - '0')
+		|| (decimation > 1 && !pipeline_add(pipe, pipe_decimate(decimation), threads[1] - '0'))
+		|| !pipeline_add(pipe, pipe_window(), threads[2] - '0')
+		|| !pipeline_add(pipe, pipe_transform(), threads[3] - '0')
+		|| !pipeline_add(pipe, pipe_peak(), threads[4] - '0')
+		|| !pipeline_add(pipe, pipe_note(), threads[5] - '0')
+		|| !pipeline_add(pipe, pipe_sink(PIPE_NOTE, onNote, NULL), threads[6] - '0')
+		|| !pipeline_start(pipe, statsPath)){
+		
+		pipeline_free(pipe);
+		return EXIT_FAILURE;
+	}
+	
+	printf("Samplerate: %i\nFFT-size: %i\nWindow-length: %f\nWindow-inc: %i\nDecimation: %zu\nThreads: %zu\n",
+		samplerate, fftSize, (double)fftSize / (double)samplerate, fftWinInc, decimation, pipe->numThreads);
+	
+	paer = Pa_OpenDefaultStream(&stream, 1, 0, paFloat32, samplerate, fftWinInc, recordCallback, pipe);
 	if(paer != paNoError){
 		fprintf(stderr, "! Pa_OpenDefaultStream failed: %s\n", Pa_GetErrorText(paer));
 		return EXIT_FAILURE;
@@ -162,14 +110,29 @@ int main(int argc, char ** argv){
 		return EXIT_FAILURE;
 	}
 	
-	while(Pa_IsStreamActive(stream)) Pa_Sleep(100);
+	printf("- Listening, press enter to stop\n");
+	getchar();
 	
+	Pa_StopStream(stream);
 	Pa_CloseStream(stream);
 	Pa_Terminate();
-	free(buf.samples);
-	free(buf.fftIn);
-	fftw_free(buf.fftOut);
-	fftw_destroy_plan(buf.panama);
+	pipeline_stop(pipe);
+	
+	printf("---- ----\n");
+	for(i = 0; i < pipe->numStages; i++){
+		printf("%9s on thread %i: %s -> %s\n", pipe->stages[i].name, pipe->stages[i].thread,
+			pipeTypeNames[pipe->stages[i].in], pipeTypeNames[pipe->stages[i].out]);
+	}
+	stats_sum(pipe->stats->blocks, pipe->numThreads, &total);
+	printf("---- ----\n    stage      calls    mean us     max us   depth   drops\n");
+	for(s = 0; s < pipe->stats->numStages; s++){
+		c = total.stage + s;
+		printf("%9s %10llu %10.2f %10.2f %7llu %7llu\n", pipe->stats->names[s], (unsigned long long)c->calls,
+			c->calls ? c->totalNs / 1e3 / c->calls : 0.0, c->maxNs / 1e3,
+			(unsigned long long)c->depth, (unsigned long long)c->drops);
+	}
+	
+	pipeline_free(pipe);
 	
 	return 0;
 }
@@ -1,105 +1,310 @@
+/*
+ * fft-record: record from the default input, analysing while it records
+ *
+ * Usage: fft-record [-T trace] [-R trace speed] [-F file.feat bins]
+ *                   [-C channels threads] [-M channels] [-S rate analysis-rate]
+ *                   [seconds] [file.wav]
+ * Records for seconds (3 by default, 0 until enter is pressed) and prints
+ * the loudest frequency of every frame as it comes in. With a file name the
+ * recording is also streamed to that 16 bit WAV file, so it can go on for
+ * hours: the callback only copies its block into queues, a writer thread
+ * and the analysis threads take every block from there, and nothing grows
+ * with the duration.
+ * -C records that many channels and analyses each on its own, on up to
+ * threads threads, printing the channel before every frame; the callback
+ * deinterleaves them into a queue per channel. -M mixes them down to one
+ * instead. The WAV file and trace keep every channel.
+ * -T records every callback (block sizes, timing and samples) to a trace,
+ * -R plays one back through the same callback instead of recording, at
+ * speed times its original pace or as fast as possible with 0. 0 seconds
+ * plays all of it.
+ * -F keeps every frame (and bins quantized magnitudes of it, 0 for none) in
+ * a feature file as it's analysed, for hark-query to look things up in;
+ * with several channels channel n goes to file.n.feat.
+ * -S records at rate instead of the default input's own samplerate (0), and
+ * resamples to analysis-rate (0 for the same) before the analysis, so the
+ * FFT only covers the band whistles are in. A trace is replayed at 44100
+ * Hz unless -S says otherwise.
+ */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
-#include "fftw3.h"
-#include "portaudio.h"
+#include <fftw3.h>
+#include <portaudio.h>
+#include <pthread.h>
 
+#include "analyzer.h"
+#include "blockqueue.h"
+#include "chanpool.h"
+#include "featfile.h"
 #include "harmonics.h"
+#include "trace.h"
 #include "util.h"
+#include "wav.h"
+
+#define QUEUE_BLOCKS 512 // hops the readers may fall behind, 12 s with the default hop
+#define IDLE_MS 10 // how long the writer sleeps when it has caught up
+
+// a channel (or the mix) as its analysis thread sees it
+struct recStream{
+	size_t index;
+	size_t numStreams;
+	struct featWriter * features;
+	size_t frames; // analysed
+};
 
 struct aBuf{
 	int samplerate;
-	size_t duration;
-	size_t length;
+	int channels;
+	size_t length; // frames to record, 0 for no limit
 	size_t pos;
-	double * samples;
+	struct chanPool * pool; // the analysis
+	struct blockQueue * queue; // interleaved, for the writer
+	struct wavFile * wav;
+	struct recStream streams[CP_MAXCHANNELS];
+	size_t written;
 };
 
-int recordCallback(const void * vin, void * vout, unsigned long frameCount, 
+int recordCallback(const void * vin, void * vout, unsigned long frameCount,
 	const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void * vdata){
 	
 	struct aBuf * data = vdata;
-	const float * in = vin;
-	size_t i;
+	size_t n = frameCount;
 	
-	if(data->pos + frameCount >= data->length) return paComplete;
+	if(data->length > 0 && data->pos + n >= data->length) n = data->length - data->pos;
 	
-	for(i = 0; i < frameCount; i++){
-		data->samples[data->pos++] = in[i];
-	}
+	// never waits: if the readers are that far behind the block is dropped
+	chanPool_push(data->pool, vin, n);
+	if(data->queue != NULL) blockQueue_push(data->queue, vin, n * data->channels);
+	data->pos += n;
 	
-	return paContinue;
+	return data->length > 0 && data->pos >= data->length ? paComplete : paContinue;
 }
 
-void doFFT(struct aBuf * buf, fftw_plan panama, double * fftIn, fftw_complex * fftOut, int fftSize, int windowInc){
-	size_t i = 0;
-	double freq;
-	int harmonic;
+static void onResult(void * user, const struct anResult * res){
+	struct recStream * s = user;
+	int octave = 0;
+	const char * note = harmonicToNote(res->harmonic, &octave);
+	char channel[32] = "";
 	
-	while(i*windowInc + fftSize < buf->pos){
-		memcpy(fftIn, buf->samples + i*windowInc, fftSize * sizeof *fftIn);
-		
-		fftw_execute(panama);
-		
-		freq = highFreq(fftOut, fftSize, buf->samplerate, NULL);
-		harmonic = freqToHarmonic(freq);
-		printf("#%4i@%i - %i: f = %f -> %i (%s)\n", i, i*windowInc, i*windowInc + fftSize, freq, harmonic, harmonicToNote(harmonic, NULL));
-		
-		i++;
+	if(s->features != NULL) featFile_add(s->features, res);
+	if(s->numStreams > 1) sprintf(channel, "%zu: ", s->index);
+	printf("%s#%4zu@%zu - %zu: f = %f -> %i (%s%i)\n",
+		channel, s->frames++, res->pos - res->length, res->pos, res->freq, res->harmonic, note, octave);
+}
+
+// file.feat for channel n into file.n.feat
+static char * featName(const char * path, size_t n){
+	size_t len = strlen(path);
+	char * ret = fmalloc(len + 32);
+	
+	if(len > 5 && strcmp(path + len - 5, ".feat") == 0) len -= 5;
+	sprintf(ret, "%.*s.%zu%s", (int)len, path, n, path + len);
+	
+	return ret;
+}
+
+// the samplerate the default input runs at by itself, after Pa_Initialize
+static int deviceRate(void){
+	PaDeviceIndex device = Pa_GetDefaultInputDevice();
+	
+	return device == paNoDevice ? 44100 : (int)Pa_GetDeviceInfo(device)->defaultSampleRate;
+}
+
+// wav's stdio buffer turns the blocks into large sequential writes
+void * writerThread(void * vdata){
+	struct aBuf * data = vdata;
+	const float * block;
+	size_t n;
+	
+	while(1){
+		block = blockQueue_peek(data->queue, 0, &n);
+		if(block == NULL){
+			if(blockQueue_finished(data->queue, 0)) break;
+			Pa_Sleep(IDLE_MS);
+			continue;
+		}
+		data->written += wav_writeFloat(data->wav, block, n / data->channels);
+		blockQueue_pop(data->queue, 0);
 	}
+	
+	return NULL;
 }
 
 int main(int argc, char ** argv){
 	// fft stuff
 	int fftSize = 1024 * 4;
 	int fftWinInc = fftSize / 4;
-	fftw_plan panama; // a man, a plan a canal: panama!
-	fftw_complex * fftOut;
 	// portaudio stuff
 	PaError paer;
 	PaStream * stream;
 	
-	double * fftIn = fmalloc(fftSize * sizeof *fftIn);
-	struct aBuf buf = {44100, 3, 3*44100, 0, NULL};
-	buf.samples = fmalloc(buf.length * sizeof *buf.samples);
+	struct aBuf buf;
+	pthread_t writer;
+	struct anPlan * plan;
+	struct analyzer * an;
+	const char * replay = NULL, * tracePath = NULL;
+	struct traceTap * tap = NULL;
+	double speed = 1.0;
+	const char * featPath = NULL;
+	char * name;
+	size_t bins = 0, numThreads = 1, i;
+	int mix = 0, analysisRate = 0;
+	
+	memset(&buf, 0, sizeof buf);
+	buf.channels = 1;
 	
-	fftOut = fftw_malloc(fftSize * sizeof *fftOut);
-	if(fftOut == NULL){
-		fprintf(stderr, "! fftw_malloc failed (%i)\n", fftSize * sizeof *fftOut);
+	while(argc > 2 && (strcmp(argv[1], "-T") == 0 || strcmp(argv[1], "-R") == 0 || strcmp(argv[1], "-F") == 0
+		|| strcmp(argv[1], "-C") == 0 || strcmp(argv[1], "-M") == 0 || strcmp(argv[1], "-S") == 0)){
+		
+		if(argv[1][1] == 'T'){
+			tracePath = argv[2];
+			argv[2] = argv[0];
+			argv += 2;
+			argc -= 2;
+		}else if(argv[1][1] == 'F' && argc > 3){
+			featPath = argv[2];
+			bins = strtoul(argv[3], NULL, 10);
+			argv[3] = argv[0];
+			argv += 3;
+			argc -= 3;
+		}else if(argv[1][1] == 'R' && argc > 3){
+			replay = argv[2];
+			speed = strtod(argv[3], NULL);
+			argv[3] = argv[0];
+			argv += 3;
+			argc -= 3;
+		}else if(argv[1][1] == 'C' && argc > 3){
+			buf.channels = atoi(argv[2]);
+			numThreads = strtoul(argv[3], NULL, 10);
+			mix = 0;
+			argv[3] = argv[0];
+			argv += 3;
+			argc -= 3;
+		}else if(argv[1][1] == 'S' && argc > 3){
+			buf.samplerate = atoi(argv[2]);
+			analysisRate = atoi(argv[3]);
+			argv[3] = argv[0];
+			argv += 3;
+			argc -= 3;
+		}else if(argv[1][1] == 'M'){
+			buf.channels = atoi(argv[2]);
+			mix = 1;
+			argv[2] = argv[0];
+			argv += 2;
+			argc -= 2;
+		}else{
+			break;
+		}
+	}
+	if((argc > 1 && argv[1][0] == '-') || buf.channels < 1 || buf.channels > CP_MAXCHANNELS || numThreads < 1
+		|| buf.samplerate < 0 || analysisRate < 0){
+		fprintf(stderr, "! Usage: %s [-T trace] [-R trace speed] [-F file.feat bins] [-C channels threads] [-M channels] [-S rate analysis-rate] [seconds] [file.wav]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
-	panama = fftw_plan_dft_r2c_1d(fftSize, fftIn, fftOut, FFTW_ESTIMATE);
 	
-	paer = Pa_Initialize();
-	if(paer != paNoError){
-		fprintf(stderr, "! Pa_Initialize failed: %s\n", Pa_GetErrorText(paer));
-		return EXIT_FAILURE;
+	// the device's rate is only known once PortAudio is up
+	if(replay == NULL){
+		paer = Pa_Initialize();
+		if(paer != paNoError){
+			fprintf(stderr, "! Pa_Initialize failed: %s\n", Pa_GetErrorText(paer));
+			return EXIT_FAILURE;
+		}
 	}
-	paer = Pa_OpenDefaultStream(&stream, 1, 0, paFloat32, buf.samplerate, fftWinInc, recordCallback, &buf);
-	if(paer != paNoError){
-		fprintf(stderr, "! Pa_OpenDefaultStream failed: %s\n", Pa_GetErrorText(paer));
-		return EXIT_FAILURE;
+	if(buf.samplerate == 0) buf.samplerate = replay == NULL ? deviceRate() : 44100;
+	if(analysisRate == 0) analysisRate = buf.samplerate;
+	buf.length = 3 * buf.samplerate;
+	
+	if(argc > 1) buf.length = strtoul(argv[1], NULL, 10) * buf.samplerate;
+	if(tracePath != NULL && (tap = trace_create(tracePath, buf.samplerate, buf.channels, recordCallback, &buf)) == NULL) return EXIT_FAILURE;
+	if(argc > 2 && (buf.wav = wav_create(argv[2], buf.samplerate, buf.channels)) == NULL) return EXIT_FAILURE;
+	
+	// one plan, every analysis thread has its worker and its channels' rings
+	plan = anPlan_new(fftSize);
+	buf.pool = chanPool_new(plan, NULL, buf.channels, mix, numThreads, fftWinInc, QUEUE_BLOCKS);
+	if(buf.pool == NULL) return EXIT_FAILURE;
+	for(i = 0; i < buf.pool->numStreams; i++){
+		buf.streams[i].index = i;
+		buf.streams[i].numStreams = buf.pool->numStreams;
+		if(featPath != NULL){
+			name = buf.pool->numStreams > 1 ? featName(featPath, i) : NULL;
+			buf.streams[i].features = featFile_create(name != NULL ? name : featPath, analysisRate, fftWinInc, bins);
+			free(name);
+			if(buf.streams[i].features == NULL) return EXIT_FAILURE;
+		}
+		an = chanPool_analyzer(buf.pool, i, AN_FLOAT32, fftWinInc, analysisRate, onResult, buf.streams + i);
+		if(!analyzer_setInputRate(an, buf.samplerate)) return EXIT_FAILURE;
 	}
-	paer = Pa_StartStream(stream);
-	if(paer != paNoError){
-		fprintf(stderr, "! Pa_StartStream failed: %s\n", Pa_GetErrorText(paer));
-		return EXIT_FAILURE;
+	if(buf.wav != NULL) buf.queue = blockQueue_new(fftWinInc * buf.channels, QUEUE_BLOCKS, 1);
+	
+	printf("FFT-size: %i (%f sec)\nWindow-width: %i\nSamplerate: %i\n",
+		fftSize, (double)fftSize/analysisRate, fftWinInc, buf.samplerate);
+	if(analysisRate != buf.samplerate) printf("Resampled to: %i\n", analysisRate);
+	if(buf.channels > 1){
+		printf("Channels: %i, %s\n", buf.channels, mix ? "mixed down" : "analysed each");
+		printf("Analysis threads: %zu\n", buf.pool->numThreads);
 	}
+	if(buf.wav != NULL) printf("Recording to: %s\n", argv[2]);
 	
-	while(Pa_IsStreamActive(stream)) Pa_Sleep(100);
+	if(!chanPool_start(buf.pool)) return EXIT_FAILURE;
+	if(buf.wav != NULL && pthread_create(&writer, NULL, writerThread, &buf) != 0){
+		fprintf(stderr, "! Can't start the WAV writer\n");
+		return EXIT_FAILURE;
+	}
 	
-	Pa_CloseStream(stream);
+	if(replay != NULL){
+		printf("Replaying: %s\n", replay);
+		if(trace_replay(replay, buf.samplerate, buf.channels, recordCallback, &buf, speed) < 0) return EXIT_FAILURE;
+	}else{
+		paer = Pa_OpenDefaultStream(&stream, buf.channels, 0, paFloat32, buf.samplerate, fftWinInc,
+			tap != NULL ? trace_callback : recordCallback, tap != NULL ? (void *)tap : (void *)&buf);
+		if(paer != paNoError){
+			fprintf(stderr, "! Pa_OpenDefaultStream failed: %s\n", Pa_GetErrorText(paer));
+			return EXIT_FAILURE;
+		}
+		paer = Pa_StartStream(stream);
+		if(paer != paNoError){
+			fprintf(stderr, "! Pa_StartStream failed: %s\n", Pa_GetErrorText(paer));
+			return EXIT_FAILURE;
+		}
+		
+		if(buf.length == 0){
+			printf("- Recording, press enter to stop\n");
+			getchar();
+			Pa_StopStream(stream);
+		}else{
+			while(Pa_IsStreamActive(stream)) Pa_Sleep(100);
+		}
+		
+		Pa_CloseStream(stream);
+		Pa_Terminate();
+		if(tap != NULL && !trace_close(tap)) fprintf(stderr, "! Can't finish the trace\n");
+	}
 	
-	printf("FFT-size: %i (%f sec)\nWindow-width: %i\npos %zu / %zu\n", 
-		fftSize, (double)fftSize/buf.samplerate, fftWinInc, buf.pos, buf.length);
+	// the callback can't run anymore, let the readers finish what's queued
+	chanPool_finish(buf.pool);
+	if(buf.wav != NULL){
+		blockQueue_close(buf.queue);
+		pthread_join(writer, NULL);
+	}
 	
-	doFFT(&buf, panama, fftIn, fftOut, fftSize, fftWinInc);
+	printf("Recorded: %zu samples (%.1f sec), %zu dropped\n",
+		buf.pos, (double)buf.pos / buf.samplerate, buf.pool->dropped);
+	for(i = 0; i < buf.pool->numStreams; i++){
+		if(buf.streams[i].features == NULL || featFile_close(buf.streams[i].features)) continue;
+		name = buf.pool->numStreams > 1 ? featName(featPath, i) : NULL;
+		fprintf(stderr, "! Can't finish %s\n", name != NULL ? name : featPath);
+		free(name);
+	}
+	if(buf.wav != NULL){
+		printf("Written: %zu samples, %zu dropped\n", buf.written, buf.queue->dropped / buf.channels);
+		if(!wav_close(buf.wav)) fprintf(stderr, "! Can't finish %s\n", argv[2]);
+	}
 	
-	Pa_Terminate();
-	fftw_destroy_plan(panama);
-	fftw_free(fftOut);
-	free(buf.samples);
-	free(fftIn);
+	chanPool_free(buf.pool);
+	anPlan_free(plan);
+	blockQueue_free(buf.queue);
 	
 	return 0;
 }
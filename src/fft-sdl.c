@@ -160,8 +160,6 @@ int main(int argc, char ** argv){
 		buf.samples[i] = 0.0;
 	}
 	
-	genHarmonics();
-	
 	//pthread_create(&ffThread1, NULL, fftThread, &buf);
 	
 	printf("- Init done\n");
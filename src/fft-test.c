@@ -1,3 +1,22 @@
+/*
+ * fft-test: the loudest frequency of every frame of sound files
+ *
+ * Usage: fft-test [-c cachedir] [-s fft-size window-inc] [-z low high]
+ *                 [-p partials] [-l lookahead] [-f featdir] [-b bins]
+ *                 [-j threads] [-m] [-r rate] [file...]
+ * With -c the results of every file are kept in cachedir under a hash of
+ * the file's bytes and of the settings that change them, a file that was
+ * analysed before with the same settings is printed from there without
+ * being decoded. Only changed files or changed settings are analysed again.
+ * With -f every file's frames also go to featdir/<file name>.feat, with bins
+ * quantized magnitudes per frame with -b (not with -z or -l, which have no
+ * full spectrum to keep), for hark-query to look up.
+ * Every channel of a file is analysed on its own, on up to threads threads
+ * (1 by default), and printed after a "Channel: n" line; its features go to
+ * featdir/<file name>.<n>.feat. -m mixes the channels down to one instead.
+ * Files are analysed at their own samplerate, or with -r resampled to rate
+ * first (positions are then at rate too).
+ */
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,102 +25,318 @@
 #include "fftw3.h"
 #include "sndfile.h"
 
-#include "clock_gettime.h"
+#include "analyzer.h"
+#include "cache.h"
+#include "chanpool.h"
+#include "featfile.h"
 #include "harmonics.h"
 #include "util.h"
 
-void FFTandPrint(fftw_plan panama, fftw_complex * fftOut, int fftSize, int samplerate, size_t i){
-	double freq;
-	int harmonic; 
-	const char * note;
-	
-	fftw_execute(panama);
-	freq = highFreq(fftOut, fftSize, samplerate, NULL);
-	harmonic = freqToHarmonic(freq);
-	note = harmonicToNote(harmonic, NULL);
-	printf("#%4i: f = %f -> %i (%s)\n", i, freq, harmonic, note == NULL ? "" : note);
-}
+#define RESULTS_VERSION 2 // bump whenever the analysis or the lines it prints change
+#define QUEUE_BLOCKS 16 // hops the reader may be ahead of a channel's analysis
 
-void readAndFFT(fftw_plan panama, double * samples, fftw_complex * fftOut, SNDFILE * sndHandle, int samplerate, int fftSize, int windowInc){
-	// int halfSize = fftSize / 2 + 1;
-	sf_count_t itemsRead = 0;
-	size_t i = 0;
-	
-	// first read full size, then increments of half-size to do windowy stuff
-	itemsRead = sf_read_double(sndHandle, samples, fftSize);
-	if(itemsRead < fftSize){
-		fprintf(stderr, "! sf_read_double read too few items to do even one FFT (%llu)\n", itemsRead);
-		exit(EXIT_FAILURE);
-		return;
+// everything the results depend on besides the file, hashed as it is
+struct testConfig{
+	uint32_t version;
+	uint32_t fftSize;
+	uint32_t hop;
+	uint32_t partials;
+	int32_t lookahead;
+	uint32_t window; // 0: Hann, the only one there is
+	double low; // zoom band, 0 - 0 without
+	double high;
+	uint32_t mix; // channels mixed down before the analysis
+	uint32_t rate; // resampled to, 0 analyses every file at its own
+};
+
+struct testOut{
+	char * data;
+	size_t length;
+	size_t capacity;
+	size_t frames;
+	struct featWriter * features; // NULL doesn't keep them
+};
+
+static void testOut_append(struct testOut * out, const char * data, size_t n){
+	while(out->length + n > out->capacity){
+		out->capacity *= 2;
+		out->data = realloc(out->data, out->capacity);
+		if(out->data == NULL){
+			fprintf(stderr, "! realloc failed (%zu)\n", out->capacity);
+			exit(EXIT_FAILURE);
+		}
 	}
+	memcpy(out->data + out->length, data, n);
+	out->length += n;
+}
+
+static void onResult(void * user, const struct anResult * res){
+	struct testOut * out = user;
+	char line[256];
+	int octave = 0, n;
+	const char * note = harmonicToNote(res->harmonic, &octave);
 	
-	FFTandPrint(panama, fftOut, fftSize, samplerate, i);
-	
-	memmove(samples, samples + windowInc, (fftSize - windowInc) * sizeof *samples);
+	if(out->features != NULL) featFile_add(out->features, res);
+	if(res->silent) return;
+	n = snprintf(line, sizeof line, "#%4zu@%zu - %zu: f = %f -> %i (%s%i)\n",
+		out->frames, res->pos - res->length, res->pos, res->freq, res->harmonic, note == NULL ? "" : note, octave);
+	if(n < 0 || (size_t)n >= sizeof line) return;
+	testOut_append(out, line, n);
+	out->frames++;
+}
+
+// featBase.feat for one stream, featBase.<stream>.feat for each of several
+static char * featName(const char * featBase, size_t stream, size_t numStreams){
+	char * ret = fmalloc(strlen(featBase) + 32);
 	
-	while((itemsRead = sf_read_double(sndHandle, samples + (fftSize - windowInc), windowInc)) == windowInc){
-		i++;
-		FFTandPrint(panama, fftOut, fftSize, samplerate, i);
-		
-		memmove(samples, samples + windowInc, (fftSize - windowInc) * sizeof *samples);
+	if(numStreams > 1){
+		sprintf(ret, "%s.%zu.feat", featBase, stream);
+	}else{
+		sprintf(ret, "%s.feat", featBase);
 	}
+	
+	return ret;
 }
 
-int main(int argc, char ** argv){
-	// sndfile stuff
+/**
+ * The results of every channel of fileName (or of their mix) into outs,
+ * their frames into feature files named after featBase. Returns how many
+ * streams were analysed, 0 if the file can't be.
+ */
+static size_t analyse(const char * fileName, const struct testConfig * config, const char * featBase, size_t bins,
+	size_t numThreads, struct anPlan * plan, struct zoomPlan ** zoom, struct testOut * outs){
+	
 	SNDFILE * sndHandle;
 	SF_INFO sndInfo = {0};
-	// fft stuff
-	int fftSize = 1024 * 4;
-	fftw_plan panama; // a man, a plan a canal: panama!
-	fftw_complex * fftOut;
+	struct chanPool * pool;
+	struct analyzer * an;
+	char * featPath;
+	float * block;
+	sf_count_t itemsRead;
+	size_t s, numStreams;
+	int ok = 1, rate;
 	
-	double * samples;
-	const char * fileName = "440.wav";
+	sndHandle = sf_open(fileName, SFM_READ, &sndInfo);
+	if(sndHandle == NULL){
+		fprintf(stderr, "! sf_open failed: %s\n", sf_strerror(sndHandle));
+		return 0;
+	}
+	if(sndInfo.channels > CP_MAXCHANNELS){
+		fprintf(stderr, "! Can only process up to %i channels (%i)\n", CP_MAXCHANNELS, sndInfo.channels);
+		sf_close(sndHandle);
+		return 0;
+	}
+	if(sndInfo.frames < config->fftSize){
+		fprintf(stderr, "! %s is too short to do even one FFT (%lld)\n", fileName, (long long)sndInfo.frames);
+		sf_close(sndHandle);
+		return 0;
+	}
 	
-	if(argc > 1){
-		fileName = argv[1];
+	// a zoom plan is made for a samplerate, files at another one get their own
+	rate = config->rate > 0 ? (int)config->rate : sndInfo.samplerate;
+	if(config->high > 0.0 && (*zoom == NULL || (*zoom)->samplerate != rate)){
+		zoomPlan_free(*zoom);
+		*zoom = zoomPlan_new(rate, config->low, config->high, config->fftSize);
+		if(*zoom == NULL){
+			sf_close(sndHandle);
+			return 0;
+		}
 	}
 	
-	printf("File: %s\n", fileName);
+	pool = chanPool_new(config->high > 0.0 ? NULL : plan, config->high > 0.0 ? *zoom : NULL, sndInfo.channels, config->mix,
+		numThreads, config->hop, QUEUE_BLOCKS);
+	if(pool == NULL){
+		sf_close(sndHandle);
+		return 0;
+	}
+	numStreams = pool->numStreams;
 	
-	sndHandle = sf_open(fileName, SFM_READ, &sndInfo);
-	if(sndHandle == NULL){
-		fprintf(stderr, "! sf_open failed: %s\n", sf_strerror(sndHandle));
-		return EXIT_FAILURE;
+	for(s = 0; s < numStreams; s++){
+		outs[s].length = 0;
+		outs[s].frames = 0;
+		if(outs[s].data == NULL) outs[s].data = fmalloc(outs[s].capacity);
+		if(featBase != NULL){
+			featPath = featName(featBase, s, numStreams);
+			outs[s].features = featFile_create(featPath, rate, config->hop, bins);
+			ok = ok && outs[s].features != NULL;
+			free(featPath);
+		}
+		an = chanPool_analyzer(pool, s, AN_FLOAT32, config->hop, rate, onResult, outs + s);
+		ok = ok && analyzer_setInputRate(an, sndInfo.samplerate);
+		analyzer_setTracker(an, config->partials);
+		analyzer_setSmoothing(an, config->lookahead);
 	}
 	
-	printf("File info:\n\tframes: %llu\n\tsample-rate: %i\n\tchannels: %i\n\tformat: %i\n\tsections: %i\n\tseekable: %i\n", 
-		sndInfo.frames, sndInfo.samplerate, sndInfo.channels, sndInfo.format, sndInfo.sections, sndInfo.seekable);
-		
-	printf("Audio info:\n\tlength: %us\n", sndInfo.frames/sndInfo.samplerate);
+	if(ok && (ok = chanPool_start(pool))){
+		block = fmalloc(config->hop * sndInfo.channels * sizeof *block);
+		while((itemsRead = sf_readf_float(sndHandle, block, config->hop)) > 0){
+			chanPool_pushWait(pool, block, itemsRead);
+		}
+		free(block);
+	}
+	chanPool_finish(pool);
 	
-	if(sndInfo.channels > 1){
-		fprintf(stderr, "! Can only process mono sound (%i)\n", sndInfo.channels);
-		return EXIT_FAILURE;
+	for(s = 0; s < numStreams; s++){
+		if(outs[s].features != NULL && !featFile_close(outs[s].features)) fprintf(stderr, "! Can't finish the features of %s\n", fileName);
+		outs[s].features = NULL;
 	}
 	
-	samples = fmalloc(fftSize * sizeof *samples);
-	//memset(samples, 0, fftSize * sizeof *samples);
-	fftOut = fftw_malloc(fftSize * sizeof *fftOut);
-	//memset(fftOut, 0, fftSize * sizeof *fftOut);
-	if(fftOut == NULL){
-		fprintf(stderr, "! fftw_malloc failed (%i)\n", fftSize * sizeof *samples);
+	chanPool_free(pool);
+	sf_close(sndHandle);
+	
+	return ok ? numStreams : 0;
+}
+
+int main(int argc, char ** argv){
+	struct testConfig config;
+	struct testOut outs[CP_MAXCHANNELS];
+	struct testOut out = {NULL, 0, 4096, 0, NULL}; // all of a file's streams, as printed and cached
+	struct cacheHash settings, hash;
+	struct cacheKey key;
+	struct anPlan * plan = NULL;
+	struct zoomPlan * zoom = NULL;
+	const char * name = argv[0];
+	const char * cacheDir = NULL;
+	const char * featDir = NULL;
+	const char * base;
+	char * featBase = NULL;
+	char * featPath;
+	char header[32];
+	size_t bins = 0, numThreads = 1, numStreams, s;
+	FILE * fp;
+	const char * defaultFile = "440.wav";
+	const char ** files;
+	char * cached;
+	size_t length, hits = 0, analysed = 0, failed = 0;
+	int i, numFiles, taken;
+	
+	memset(&config, 0, sizeof config); // the padding is hashed too
+	config.version = RESULTS_VERSION;
+	config.fftSize = 1024 * 4;
+	config.hop = config.fftSize / 4;
+	config.lookahead = -1;
+	
+	while(argc > 1 && argv[1][0] == '-'){
+		taken = 2; // the option and its value
+		if(strcmp(argv[1], "-m") == 0){
+			config.mix = 1;
+			taken = 1;
+		}else if(argc < 3){
+			break;
+		}else if(strcmp(argv[1], "-c") == 0){
+			cacheDir = argv[2];
+		}else if(strcmp(argv[1], "-s") == 0 && argc > 3){
+			config.fftSize = strtoul(argv[2], NULL, 10);
+			config.hop = strtoul(argv[3], NULL, 10);
+			taken = 3;
+		}else if(strcmp(argv[1], "-z") == 0 && argc > 3){
+			config.low = strtod(argv[2], NULL);
+			config.high = strtod(argv[3], NULL);
+			taken = 3;
+		}else if(strcmp(argv[1], "-p") == 0){
+			config.partials = strtoul(argv[2], NULL, 10);
+		}else if(strcmp(argv[1], "-l") == 0){
+			config.lookahead = atoi(argv[2]);
+		}else if(strcmp(argv[1], "-f") == 0){
+			featDir = argv[2];
+		}else if(strcmp(argv[1], "-b") == 0){
+			bins = strtoul(argv[2], NULL, 10);
+		}else if(strcmp(argv[1], "-j") == 0){
+			numThreads = strtoul(argv[2], NULL, 10);
+		}else if(strcmp(argv[1], "-r") == 0){
+			config.rate = strtoul(argv[2], NULL, 10);
+		}else{
+			break;
+		}
+		argc -= taken;
+		argv += taken;
+	}
+	if((argc > 1 && argv[1][0] == '-') || config.fftSize < 2 || config.hop < 1 || numThreads < 1){
+		fprintf(stderr, "! Usage: %s [-c cachedir] [-s fft-size window-inc] [-z low high] [-p partials] [-l lookahead] [-f featdir] [-b bins] [-j threads] [-m] [-r rate] [file...]\n", name);
 		return EXIT_FAILURE;
 	}
-	panama = fftw_plan_dft_r2c_1d(fftSize, samples, fftOut, FFTW_ESTIMATE);
+	if(bins > 0 && (config.high > 0.0 || config.lookahead >= 0)){
+		fprintf(stderr, "! -b needs every frame's full spectrum, -z and -l don't keep one\n");
+		return EXIT_FAILURE;
+	}
+	files = (const char **)argv + 1;
+	numFiles = argc - 1;
+	if(numFiles == 0){
+		files = &defaultFile;
+		numFiles = 1;
+	}
 	
-	printf("FFT-size: %i\nWindow-width = %fs\n", fftSize, (double)fftSize/(double)sndInfo.samplerate);
+	printf("FFT-size: %u\nWindow-inc: %u\n", config.fftSize, config.hop);
+	if(config.rate > 0) printf("Samplerate: %u\n", config.rate);
+	if(cacheDir != NULL) printf("Cache: %s\n", cacheDir);
 	
-	genHarmonics();
+	// the settings are hashed once, every file continues from there
+	cacheHash_init(&settings);
+	cacheHash_update(&settings, &config, sizeof config);
+	out.data = fmalloc(out.capacity);
+	for(s = 0; s < CP_MAXCHANNELS; s++){
+		outs[s] = out;
+		outs[s].data = NULL; // made when a file has that many channels
+	}
+	if(config.high <= 0.0) plan = anPlan_new(config.fftSize);
 	
-	sf_seek(sndHandle, 0, SEEK_SET);
+	for(i = 0; i < numFiles; i++){
+		printf("File: %s\n", files[i]);
+		
+		if(featDir != NULL){
+			base = strrchr(files[i], '/') != NULL ? strrchr(files[i], '/') + 1 : files[i];
+			free(featBase);
+			featBase = fmalloc(strlen(featDir) + strlen(base) + 2);
+			sprintf(featBase, "%s/%s", featDir, base);
+		}
+		
+		if(cacheDir != NULL){
+			hash = settings;
+			if(!cache_hashFile(&hash, files[i])){
+				failed++;
+				continue;
+			}
+			key = cacheHash_final(&hash);
+			// the features aren't cached, a file without them is analysed again to make them (the first will do)
+			fp = NULL;
+			for(s = 1; featDir != NULL && fp == NULL && s <= 2; s++){
+				featPath = featName(featBase, 0, s);
+				fp = fopen(featPath, "rb");
+				free(featPath);
+			}
+			if(fp != NULL) fclose(fp);
+			if((featDir == NULL || fp != NULL) && (cached = cache_load(cacheDir, key, &length)) != NULL){
+				fwrite(cached, 1, length, stdout);
+				free(cached);
+				hits++;
+				continue;
+			}
+		}
+		
+		numStreams = analyse(files[i], &config, featBase, bins, numThreads, plan, &zoom, outs);
+		if(numStreams == 0){
+			failed++;
+			continue;
+		}
+		out.length = 0;
+		for(s = 0; s < numStreams; s++){
+			if(numStreams > 1) testOut_append(&out, header, sprintf(header, "Channel: %zu\n", s));
+			testOut_append(&out, outs[s].data, outs[s].length);
+		}
+		fwrite(out.data, 1, out.length, stdout);
+		analysed++;
+		if(cacheDir != NULL) cache_store(cacheDir, key, out.data, out.length);
+	}
 	
-	readAndFFT(panama, samples, fftOut, sndHandle, sndInfo.samplerate, fftSize, fftSize / 4);
+	printf("Files: %i, %zu from the cache, %zu analysed, %zu failed\n", numFiles, hits, analysed, failed);
 	
-	fftw_destroy_plan(panama);
-	fftw_free(fftOut);
-	free(samples);
-	sf_close(sndHandle);
-	return 0;
+	free(out.data);
+	for(s = 0; s < CP_MAXCHANNELS; s++){
+		free(outs[s].data);
+	}
+	free(featBase);
+	anPlan_free(plan);
+	zoomPlan_free(zoom);
+	
+	return failed > 0 ? EXIT_FAILURE : 0;
 }
@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include <assert.h>
 
 #include <fftw3.h>
@@ -8,6 +10,36 @@
 
 #include "util.h"
 #include "harmonics.h"
+#include "zoom.h"
+#include "tracker.h"
+#include "multipitch.h"
+#include "trace.h"
+#include "rt.h"
+
+#ifndef M_PI
+#define M_PI 3.1415926538
+#endif
+
+#define MAXRES 8
+#define MAXNOTES 5 // simultaneous notes reported with MULTIFREQ
+#define GATE_ZCR 0.25 // zero crossings per sample the gate still takes for a whistle
+#define GATE_HANG 2 // quiet hops before it closes
+
+struct aBuf;
+
+// one FFT size in multi-resolution mode, each has its own thread
+struct resBuf{
+	size_t length;
+	fftw_plan panama;
+	double * window;
+	double * fftIn;
+	fftw_complex * fftOut;
+	double freq; // peak of the last frame
+	double intens;
+	
+	pthread_t thread;
+	struct aBuf * info;
+};
 
 struct aBuf{
 	size_t length;
@@ -21,53 +53,244 @@ struct aBuf{
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	double amplifier;
+	
+	// multi-resolution mode: several FFT sizes over the same samples, ascending
+	size_t numRes;
+	struct resBuf res[MAXRES];
+	size_t frame; // frames handed out so far
+	size_t pending; // resolutions still busy with the current frame
+	size_t dropped; // hops skipped because the last frame wasn't done yet
+	
+	// adaptive mode: only one of the resolutions per hop, picked by pitch stability
+	int adaptive;
+	size_t chosen; // resolution the current frame is for
+	struct sizeChooser chooser;
+	
+	// zoom mode: only look at a band, fftIn holds zoom->plan->length samples
+	struct zoomWorker * zoom;
+	
+	struct tracker * tracker; // follow partials instead of taking the loudest bin
+	struct gate gate; // on the newest hop of every frame in the audio thread, nothing is handed on while it's closed
+	int silence; // the gate just closed, for the analysis to say so
+	int onset; // it just opened, for the chooser to start small
+	
+	struct rtOptions rt; // thread 0 is the audio thread, the analysis threads come after it
+	int audioReady; // the audio thread has been made realtime
+	int stop; // the input has ended, the analysis threads return
 };
 
 void * fftThread(void * vdata){
 	struct aBuf * data = vdata;
-	double freq, intens, hDiff;
-	int harmonic = 0, octave = 0;
+	int octave = 0;
 	const char * note;
-	const char * line;
 	size_t i;
 #ifdef MULTIFREQ
-	int freqs[5] = {0};
-	struct heap * h = heap_new(5);
+	struct pitch pitches[MAXNOTES];
+	double freqs[MAXNOTES], cents[MAXNOTES];
+	int harmonics[MAXNOTES];
+	struct multiPitch * mp = multiPitch_new(data->length, data->samplerate, -24, 48); // C2..C8
+	size_t n;
+#else
+	double freq, intens, hDiff;
+	int harmonic = 0;
+	const char * line;
+	const struct partial * partial;
 #endif
 	
+	rt_thread(&data->rt, 1, 0);
 	pthread_mutex_lock(&data->mutex);
-	while(1){
+	while(!data->stop){
 		pthread_cond_wait(&data->cond, &data->mutex);
+		if(data->stop) break;
 		
-		fftw_execute(data->panama);
-#ifdef MULTIFREQ
-		threshFreq(data->fftOut, data->length, 1000, freqs, 5, h);
+		if(data->silence){
+			data->silence = 0;
+			if(data->tracker != NULL) tracker_clear(data->tracker);
+			printf("silence\n");
+			continue;
+		}
 		
+#ifdef MULTIFREQ
+		fftw_execute(data->panama);
+		n = multiPitch_find(mp, data->fftOut, pitches, MAXNOTES);
+		for(i = 0; i < n; i++){
+			freqs[i] = pitches[i].freq;
+		}
+		freqsToHarmonics(freqs, n, harmonics, cents);
 		
-		for(i = 0; i < 5; i++){
-			freq = (double)freqs[i]/(double)data->length*(double)data->samplerate;
-			harmonic = freqToHarmonic(freq < 16.0 ? 16.0 : freq, &hDiff);
-			note = harmonicToNote(harmonic, &octave);
-			printf(" %12.6f % 3i %2s", freq, harmonic, note);
+		for(i = 0; i < n; i++){
+			note = harmonicToNote(harmonics[i], &octave);
+			printf(" %12.6f % 3i %2s%s%i %+5.1fc %10.1f", freqs[i], harmonics[i], note, strlen(note) == 1 ? " " : "", octave, cents[i], pitches[i].salience);
 		}
 		putchar('\n');
 #else
-		i = highFreq(data->fftOut, data->length, &intens);
-		freq = (double)i/(double)data->length*(double)data->samplerate;
+		if(data->zoom != NULL){
+			freq = zoom_execute(data->zoom, data->fftIn, &intens);
+		}else if(data->tracker != NULL){
+			fftw_execute(data->panama);
+			partial = tracker_frame(data->tracker, data->fftOut, data->length, data->samplerate);
+			freq = partial != NULL ? partial->freq : 0.0;
+			intens = partial != NULL ? partial->amp : 0.0;
+		}else{
+			fftw_execute(data->panama);
+			i = highFreq(data->fftOut, data->length, &intens);
+			freq = (double)i/(double)data->length*(double)data->samplerate;
+		}
+		
+		// DC or nothing found (the tracker lost everything): no note to print
+		if(freq < 16.0) continue;
 		
-		//if(intens > 1000){
-			harmonic = freqToHarmonic(freq < 16.0 ? 16.0 : freq, &hDiff);
-			note = harmonicToNote(harmonic, &octave);
-			line = harmonicToLine(harmonic);
-			printf("%12.6f: (~%12.6f)   % 3i   %s%s%i   %s   %12.6f\n", 
-				freq, harmonicToFreq(harmonic) - freq, harmonic, note, strlen(note) == 1 ? " " : "", octave, line, intens);
-		//}
+		harmonic = freqToHarmonic(freq, &hDiff);
+		note = harmonicToNote(harmonic, &octave);
+		line = harmonicToLine(harmonic);
+		printf("%12.6f: (~%12.6f)   % 3i   %s%s%i   %s   %12.6f\n", 
+			freq, harmonicToFreq(harmonic) - freq, harmonic, note, strlen(note) == 1 ? " " : "", octave, line, intens);
 #endif
 	}
+	pthread_mutex_unlock(&data->mutex);
+#ifdef MULTIFREQ
+	multiPitch_free(mp);
+#endif
 	
 	return NULL;
 }
 
+// called with the mutex held by whichever resolution finished last
+void printMerged(struct aBuf * data){
+	double freqs[MAXRES], hDiff;
+	size_t lengths[MAXRES], i, k;
+	int harmonic, octave = 0;
+	const char * note;
+	
+	for(i = 0; i < data->numRes; i++){
+		freqs[i] = data->res[i].freq;
+		lengths[i] = data->res[i].length;
+	}
+	k = mergeResolutions(freqs, lengths, data->numRes, data->samplerate);
+	
+	harmonic = freqToHarmonic(freqs[k] < 16.0 ? 16.0 : freqs[k], &hDiff);
+	note = harmonicToNote(harmonic, &octave);
+	printf("%12.6f: [%6zu]   % 3i   %s%s%i   %s   %12.6f  ", 
+		freqs[k], lengths[k], harmonic, note, strlen(note) == 1 ? " " : "", octave, harmonicToLine(harmonic), data->res[k].intens);
+	for(i = 0; i < data->numRes; i++){
+		printf(" %10.3f", freqs[i]);
+	}
+	putchar('\n');
+}
+
+// called with the mutex held, after the chosen resolution has its peak
+void printAdaptive(struct aBuf * data, struct resBuf * r){
+	double hDiff;
+	int harmonic, octave = 0;
+	const char * note;
+	
+	harmonic = freqToHarmonic(r->freq < 16.0 ? 16.0 : r->freq, &hDiff);
+	note = harmonicToNote(harmonic, &octave);
+	printf("%12.6f: [%6zu]   % 3i   %s%s%i   %s   %12.6f\n", 
+		r->freq, r->length, harmonic, note, strlen(note) == 1 ? " " : "", octave, harmonicToLine(harmonic), r->intens);
+	
+	sizeChooser_update(&data->chooser, r->freq, r->length, data->samplerate);
+}
+
+void * resThread(void * vdata){
+	struct resBuf * r = vdata;
+	struct aBuf * data = r->info;
+	size_t seen = 0, i;
+	
+	rt_thread(&data->rt, 1 + (r - data->res), 0);
+	pthread_mutex_lock(&data->mutex);
+	while(1){
+		// the first resolution says when the gate closes
+		while(data->frame == seen && !data->stop && !(data->silence && r == data->res)) pthread_cond_wait(&data->cond, &data->mutex);
+		if(data->stop) break;
+		if(data->frame == seen){
+			data->silence = 0;
+			printf("silence\n");
+			continue;
+		}
+		seen = data->frame;
+		if(data->adaptive && data->res + data->chosen != r) continue;
+		pthread_mutex_unlock(&data->mutex);
+		
+		fftw_execute(r->panama);
+		i = highFreq(r->fftOut, r->length, &r->intens);
+		r->freq = peakInterp(r->fftOut, r->length, i) / (double)r->length * (double)data->samplerate;
+		
+		pthread_mutex_lock(&data->mutex);
+		if(data->adaptive){
+			printAdaptive(data, r);
+			data->pending--;
+		}else if(--data->pending == 0){
+			printMerged(data);
+		}
+	}
+	pthread_mutex_unlock(&data->mutex);
+	
+	return NULL;
+}
+
+/**
+ * Hand the newest samples to every resolution (or in adaptive mode only to
+ * the one the chooser picked): each gets the last length samples of the
+ * buffer, windowed. The buffer always holds enough for the largest, so
+ * switching sizes never waits for samples. If they aren't all done with the
+ * last frame this hop is skipped rather than blocking the audio thread.
+ */
+void dispatchRes(struct aBuf * data){
+	struct resBuf * r;
+	size_t i, j, start;
+	
+	pthread_mutex_lock(&data->mutex);
+	if(data->pending > 0){
+		data->dropped++;
+		pthread_mutex_unlock(&data->mutex);
+		return;
+	}
+	
+	if(data->onset){
+		sizeChooser_onset(&data->chooser);
+		data->onset = 0;
+	}
+	data->chosen = data->chooser.current;
+	for(i = 0; i < data->numRes; i++){
+		if(data->adaptive && i != data->chosen) continue;
+		r = data->res + i;
+		start = data->length - r->length;
+		for(j = 0; j < r->length; j++){
+			r->fftIn[j] = r->window[j] * data->samples[start + j];
+		}
+	}
+	data->pending = data->adaptive ? 1 : data->numRes;
+	data->frame++;
+	pthread_cond_broadcast(&data->cond);
+	pthread_mutex_unlock(&data->mutex);
+}
+
+/**
+ * The silence gate on the newest hop, in the audio thread so nothing is
+ * copied or woken while it's closed. Returns 0 then; when it closes the
+ * analysis is woken once to say so.
+ */
+static int gateHop(struct aBuf * data, const double * hop){
+	double rms, zcr;
+	int wasOpen = data->gate.state;
+	
+	if(data->gate.open <= 0.0) return 1;
+	rms = gate_measure(hop, data->fftWinInc, &zcr);
+	if(gate_hop(&data->gate, rms, zcr)){
+		if(!wasOpen) data->onset = 1;
+		return 1;
+	}
+	if(wasOpen){
+		pthread_mutex_lock(&data->mutex);
+		data->silence = 1;
+		pthread_cond_broadcast(&data->cond);
+		pthread_mutex_unlock(&data->mutex);
+	}
+	
+	return 0;
+}
+
 // do a sliding window
 int recordCallback(const void * vin, void * vout, unsigned long frameCount, 
 	const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void * vdata){
@@ -76,6 +299,12 @@ int recordCallback(const void * vin, void * vout, unsigned long frameCount,
 	const float * in = vin;
 	size_t i;
 	
+	// PortAudio makes the thread, this is the first chance to get at it
+	if(!data->audioReady){
+		rt_thread(&data->rt, 0, 1);
+		data->audioReady = 1;
+	}
+	
 	for(i = 0; i < frameCount; i++){
 		if(data->pos == data->length) break;
 		if(data->pos > data->length) return paAbort;
@@ -88,10 +317,17 @@ int recordCallback(const void * vin, void * vout, unsigned long frameCount,
 			// fprintf(stderr, "! recordCallback's trylock failed\n");
 			return paAbort;
 		}*/
-		pthread_mutex_lock(&data->mutex);
-		memcpy(data->fftIn, data->samples, data->length);
-		pthread_cond_signal(&data->cond);
-		pthread_mutex_unlock(&data->mutex);
+		// nothing is handed on while the gate is closed
+		if(gateHop(data, data->samples + data->length - data->fftWinInc)){
+			if(data->numRes > 0){
+				dispatchRes(data);
+			}else{
+				pthread_mutex_lock(&data->mutex);
+				memcpy(data->fftIn, data->samples, data->length * sizeof *data->fftIn);
+				pthread_cond_signal(&data->cond);
+				pthread_mutex_unlock(&data->mutex);
+			}
+		}
 		
 		// shift data
 		data->pos -= data->fftWinInc; // == data->length - data->fftWinInc
@@ -118,25 +354,53 @@ int recordCallback2(const void * vin, void * vout, unsigned long frameCount,
 	const float * in = vin;
 	size_t i;
 	
+	if(!data->audioReady){
+		rt_thread(&data->rt, 0, 1);
+		data->audioReady = 1;
+	}
+	
 	assert(frameCount == data->fftWinInc);
 	assert(data->length % data->fftWinInc == 0);
 	
 	for(i = 0; i < frameCount; i++){
 		data->samples[i] = data->amplifier * in[i]; // capture the first bit
 	}
+	if(!gateHop(data, data->samples)) return paContinue;
 	
 	for(i = data->fftWinInc; i < data->length; i += data->fftWinInc){
-		memcpy(data->samples + i, data->samples, data->fftWinInc); // copy the first bit over and over
+		memcpy(data->samples + i, data->samples, data->fftWinInc * sizeof *data->samples); // copy the first bit over and over
 	}
 	
 	pthread_mutex_lock(&data->mutex);
-	memcpy(data->fftIn, data->samples, data->length);
+	memcpy(data->fftIn, data->samples, data->length * sizeof *data->fftIn);
 	pthread_cond_signal(&data->cond);
 	pthread_mutex_unlock(&data->mutex);
 	
 	return paContinue;
 }
 
+// the samplerate the default input runs at by itself, after Pa_Initialize
+static int deviceRate(void){
+	PaDeviceIndex device = Pa_GetDefaultInputDevice();
+	
+	return device == paNoDevice ? 44100 : (int)Pa_GetDeviceInfo(device)->defaultSampleRate;
+}
+
+// once no more input comes: wake the analysis threads to return and wait for them
+static void stopThreads(struct aBuf * data, pthread_t * fft){
+	size_t i;
+	
+	pthread_mutex_lock(&data->mutex);
+	data->stop = 1;
+	pthread_cond_broadcast(&data->cond);
+	pthread_mutex_unlock(&data->mutex);
+	
+	if(data->numRes == 0) pthread_join(*fft, NULL);
+	for(i = 0; i < data->numRes; i++){
+		pthread_join(data->res[i].thread, NULL);
+	}
+}
+
 int main(int argc, char ** argv){
 	// FFT stuff
 	int fftSize = 1024 * 48;
@@ -149,74 +413,254 @@ int main(int argc, char ** argv){
 	//pthread_t ffThread2; 
 	
 	struct aBuf buf;
+	struct resBuf * r;
+	struct zoomPlan * zoom = NULL;
+	PaStreamCallback * callback;
+	const char * tracePath = NULL, * replay = NULL;
+	struct traceTap * tap = NULL;
+	double speed = 1.0, gateOpen;
+	int ok = 1;
 	
-	size_t i;
+	size_t i, j;
 	
 	buf.amplifier = 1.0;
 	buf.length = fftSize;
 	buf.samplerate = 44100;
 	buf.fftWinInc = fftWinInc;
+	buf.numRes = 0;
+	buf.frame = 0;
+	buf.pending = 0;
+	buf.dropped = 0;
+	buf.adaptive = 0;
+	buf.zoom = NULL;
+	buf.tracker = NULL;
+	gate_init(&buf.gate, 0.0, 0.0, GATE_ZCR, GATE_HANG);
+	buf.silence = 0;
+	buf.onset = 0;
+	rt_init(&buf.rt);
+	buf.audioReady = 0;
+	buf.stop = 0;
 	
-	if(argc > 1 && ((fftSize = strtoul(argv[1], NULL, 10)) != 0)){
-		buf.length = fftSize;
+	// fft-thread -t <A4> <temperament> ...: tune differently, then as below
+	if(argc > 3 && strcmp(argv[1], "-t") == 0){
+		if(!setTuning(strtod(argv[2], NULL), argv[3])){
+			fprintf(stderr, "! Unknown tuning: %s %s\n", argv[2], argv[3]);
+			return EXIT_FAILURE;
+		}
+		argv[3] = argv[0];
+		argv += 3;
+		argc -= 3;
 	}
-	if(argc > 2 && ((fftWinInc = strtoul(argv[2], NULL, 10)) != 0)){
-		buf.fftWinInc = fftWinInc;
+	
+	// fft-thread -T <trace> ...: record every callback to a trace as well
+	// fft-thread -R <trace> <speed> ...: play a trace through the callback instead of recording (0 is flat out)
+	// fft-thread -r <priority> <cpus> ...: SCHED_FIFO at priority (0 for none), threads pinned to the cores in cpus ("-" for none)
+	// fft-thread -L ...: lock all memory
+	// fft-thread -g <rms> ...: skip hops quieter than rms (after the amplifier, 0.01 is -40 dBFS) or too noisy for a whistle
+	while(argc > 1 && (strcmp(argv[1], "-L") == 0 || (argc > 2 && (strcmp(argv[1], "-T") == 0 || strcmp(argv[1], "-g") == 0))
+		|| (argc > 3 && (strcmp(argv[1], "-R") == 0 || strcmp(argv[1], "-r") == 0)))){
+		
+		if(argv[1][1] == 'L'){
+			buf.rt.lock = 1;
+			argv[1] = argv[0];
+			argv += 1;
+			argc -= 1;
+		}else if(argv[1][1] == 'r'){
+			buf.rt.priority = atoi(argv[2]);
+			if(!rt_parseCpus(&buf.rt, argv[3])){
+				fprintf(stderr, "! Not a list of cores: %s\n", argv[3]);
+				return EXIT_FAILURE;
+			}
+			argv[3] = argv[0];
+			argv += 3;
+			argc -= 3;
+		}else if(argv[1][1] == 'g'){
+			gateOpen = strtod(argv[2], NULL);
+			gate_init(&buf.gate, gateOpen, gateOpen / 2.0, GATE_ZCR, GATE_HANG);
+			argv[2] = argv[0];
+			argv += 2;
+			argc -= 2;
+		}else if(argv[1][1] == 'T'){
+			tracePath = argv[2];
+			argv[2] = argv[0];
+			argv += 2;
+			argc -= 2;
+		}else{
+			replay = argv[2];
+			speed = strtod(argv[3], NULL);
+			argv[3] = argv[0];
+			argv += 3;
+			argc -= 3;
+		}
+	}
+	
+	// live input is analysed at the default input's own samplerate, a trace at 44100 Hz
+	if(replay == NULL){
+		paer = Pa_Initialize();
+		if(paer != paNoError){
+			fprintf(stderr, "! Pa_Initialize failed: %s\n", Pa_GetErrorText(paer));
+			return EXIT_FAILURE;
+		}
+		buf.samplerate = deviceRate();
+	}
+	
+	// fft-thread -m <window-inc> <fft-size>...: one thread per FFT size, merged
+	// fft-thread -a <window-inc> <fft-size>...: one FFT size per hop, by how steady the pitch is
+	if(argc > 3 && (strcmp(argv[1], "-m") == 0 || strcmp(argv[1], "-a") == 0)){
+		buf.adaptive = argv[1][1] == 'a';
+		if((fftWinInc = strtoul(argv[2], NULL, 10)) != 0) buf.fftWinInc = fftWinInc;
+		for(i = 3; i < (size_t)argc && buf.numRes < MAXRES; i++){
+			fftSize = strtoul(argv[i], NULL, 10);
+			if(fftSize < 2 || (buf.numRes > 0 && fftSize <= buf.res[buf.numRes - 1].length)){
+				fprintf(stderr, "! FFT sizes must be ascending (%s)\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			buf.res[buf.numRes++].length = fftSize;
+		}
+		buf.length = fftSize;
+		sizeChooser_init(&buf.chooser, buf.numRes);
+	}else if(argc > 5 && strcmp(argv[1], "-z") == 0){
+		// fft-thread -z <window-inc> <fft-size> <low> <high>: fft-size's resolution, but only in low..high Hz
+#ifdef MULTIFREQ
+		// there's no full spectrum for multiPitch_find to score
+		fprintf(stderr, "! -z finds one note, not several (built with MULTIFREQ)\n");
+		return EXIT_FAILURE;
+#endif
+		if((fftWinInc = strtoul(argv[2], NULL, 10)) != 0) buf.fftWinInc = fftWinInc;
+		zoom = zoomPlan_new(buf.samplerate, strtod(argv[4], NULL), strtod(argv[5], NULL), strtoul(argv[3], NULL, 10));
+		if(zoom == NULL) return EXIT_FAILURE;
+		buf.zoom = zoomWorker_new(zoom);
+		buf.length = zoom->length;
+	}else{
+		if(argc > 1 && ((fftSize = strtoul(argv[1], NULL, 10)) != 0)){
+			buf.length = fftSize;
+		}
+		if(argc > 2 && ((fftWinInc = strtoul(argv[2], NULL, 10)) != 0)){
+			buf.fftWinInc = fftWinInc;
+		}
+		// fft-thread <fft-size> <window-inc> <partials>: track partials across frames
+		if(argc > 3 && (i = strtoul(argv[3], NULL, 10)) != 0){
+			buf.tracker = tracker_new(i);
+		}
 	}
 	
 	buf.pos = buf.length - buf.fftWinInc;
 	
+	// an r2c transform only produces length / 2 + 1 bins
 	buf.samples = fmalloc(buf.length * sizeof *buf.samples);
-	buf.fftIn = fmalloc(buf.length * sizeof *buf.samples);
-	buf.fftOut = fftw_malloc(buf.length * sizeof *buf.fftOut);
+	buf.fftIn = fftw_malloc(buf.length * sizeof *buf.fftIn);
+	buf.fftOut = fftw_malloc((buf.length / 2 + 1) * sizeof *buf.fftOut);
+	if(buf.fftIn == NULL || buf.fftOut == NULL){
+		fprintf(stderr, "! fftw_malloc failed (%zu)\n", buf.length * sizeof *buf.fftOut);
+		return EXIT_FAILURE;
+	}
 	
-	buf.panama = fftw_plan_dft_r2c_1d(buf.length, buf.fftIn, buf.fftOut, FFTW_ESTIMATE);
+	if(buf.zoom == NULL) buf.panama = fftw_plan_dft_r2c_1d(buf.length, buf.fftIn, buf.fftOut, FFTW_ESTIMATE);
 	
 	for(i = 0; i < buf.length; i++){
-		buf.fftOut[i][0] = 0.0;
-		buf.fftOut[i][1] = 0.0;
 		buf.fftIn[i] = 0.0;
-		
 		buf.samples[i] = 0.0;
 	}
+	for(i = 0; i < buf.length / 2 + 1; i++){
+		buf.fftOut[i][0] = 0.0;
+		buf.fftOut[i][1] = 0.0;
+	}
 	
-	buf.mutex = PTHREAD_MUTEX_INITIALIZER;
-	buf.cond = PTHREAD_COND_INITIALIZER;
-	
-	genHarmonics();
+	pthread_mutex_init(&buf.mutex, NULL);
+	pthread_cond_init(&buf.cond, NULL);
 	
-	paer = Pa_Initialize();
-	if(paer != paNoError){
-		fprintf(stderr, "! Pa_Initialize failed: %s\n", Pa_GetErrorText(paer));
-		return EXIT_FAILURE;
+	for(i = 0; i < buf.numRes; i++){
+		r = buf.res + i;
+		r->info = &buf;
+		r->window = fmalloc(r->length * sizeof *r->window);
+		r->fftIn = fftw_malloc(r->length * sizeof *r->fftIn);
+		r->fftOut = fftw_malloc((r->length / 2 + 1) * sizeof *r->fftOut);
+		if(r->fftIn == NULL || r->fftOut == NULL){
+			fprintf(stderr, "! fftw_malloc failed (%zu)\n", r->length * sizeof *r->fftOut);
+			return EXIT_FAILURE;
+		}
+		r->panama = fftw_plan_dft_r2c_1d(r->length, r->fftIn, r->fftOut, FFTW_ESTIMATE);
+		for(j = 0; j < r->length; j++){
+			r->window[j] = 0.5 - 0.5 * cos(2 * M_PI * (double)j / (double)r->length);
+			r->fftIn[j] = 0.0;
+		}
+		for(j = 0; j < r->length / 2 + 1; j++){
+			r->fftOut[j][0] = 0.0;
+			r->fftOut[j][1] = 0.0;
+		}
+		r->freq = 0.0;
+		r->intens = 0.0;
 	}
-	paer = Pa_OpenDefaultStream(&stream, 1, 0, paFloat32, buf.samplerate, fftWinInc, recordCallback2, &buf);
-	if(paer != paNoError){
-		fprintf(stderr, "! Pa_OpenDefaultStream failed: %s\n", Pa_GetErrorText(paer));
-		return EXIT_FAILURE;
+	
+	// recordCallback2 needs every call to bring exactly a hop, a trace's calls can be any size
+	callback = buf.numRes > 0 || buf.zoom != NULL || replay != NULL ? recordCallback : recordCallback2;
+	if(tracePath != NULL && (tap = trace_create(tracePath, buf.samplerate, 1, callback, &buf)) == NULL) return EXIT_FAILURE;
+	if(replay == NULL){
+		paer = Pa_OpenDefaultStream(&stream, 1, 0, paFloat32, buf.samplerate, buf.fftWinInc,
+			tap != NULL ? trace_callback : callback, tap != NULL ? (void *)tap : (void *)&buf);
+		if(paer != paNoError){
+			fprintf(stderr, "! Pa_OpenDefaultStream failed: %s\n", Pa_GetErrorText(paer));
+			return EXIT_FAILURE;
+		}
 	}
 	
 	printf("---- ----\nInit done\n---- ----\n");
 	
-	printf("FFT-size: %i\nWindow-length: %f\nWindow-inc: %i\n", 
-		buf.length, (double)buf.length/(double)buf.samplerate, buf.fftWinInc);
+	printf("Samplerate: %i\nFFT-size: %zu\nWindow-length: %f\nWindow-inc: %i\n", 
+		buf.samplerate, buf.length, (double)buf.length/(double)buf.samplerate, buf.fftWinInc);
 	
-	pthread_create(&ffThread1, NULL, fftThread, &buf);
-	//pthread_create(&ffThread2, NULL, fftThread, &buf);
-	paer = Pa_StartStream(stream);
-	if(paer != paNoError){
-		fprintf(stderr, "! Pa_StartStream failed: %s\n", Pa_GetErrorText(paer));
-		return EXIT_FAILURE;
+	if(buf.zoom != NULL){
+		printf("Zoom: %f-%f Hz, decimation %zu, %zu-point complex FFT (%f Hz per bin)\n",
+			zoom->low, zoom->high, zoom->decimation, zoom->bins, (double)buf.samplerate / zoom->decimation / zoom->bins);
 	}
 	
-	while(Pa_IsStreamActive(stream)) Pa_Sleep(100);
+	// every buffer has been written to (so it's faulted in), lock it all before anything runs
+	rt_lock(&buf.rt, 0);
+	
+	if(buf.numRes > 0){
+		for(i = 0; i < buf.numRes; i++){
+			printf("Resolution %zu: %zu (%f Hz per bin)\n", i, buf.res[i].length, (double)buf.samplerate / buf.res[i].length);
+			pthread_create(&buf.res[i].thread, NULL, resThread, buf.res + i);
+		}
+	}else{
+		pthread_create(&ffThread1, NULL, fftThread, &buf);
+	}
+	//pthread_create(&ffThread2, NULL, fftThread, &buf);
+	if(replay != NULL){
+		ok = trace_replay(replay, buf.samplerate, 1, callback, &buf, speed) >= 0;
+	}else{
+		paer = Pa_StartStream(stream);
+		if(paer != paNoError){
+			fprintf(stderr, "! Pa_StartStream failed: %s\n", Pa_GetErrorText(paer));
+			return EXIT_FAILURE;
+		}
+		// and the threads' stacks and whatever's allocated from now on
+		rt_lock(&buf.rt, 1);
+		
+		while(Pa_IsStreamActive(stream)) Pa_Sleep(100);
+		
+		Pa_CloseStream(stream);
+		Pa_Terminate();
+		if(tap != NULL && !trace_close(tap)) fprintf(stderr, "! Can't finish the trace\n");
+	}
+	stopThreads(&buf, &ffThread1);
 	
-	Pa_CloseStream(stream);
-	Pa_Terminate();
+	for(i = 0; i < buf.numRes; i++){
+		r = buf.res + i;
+		fftw_destroy_plan(r->panama);
+		free(r->window);
+		fftw_free(r->fftIn);
+		fftw_free(r->fftOut);
+	}
 	free(buf.samples);
-	free(buf.fftIn);
+	fftw_free(buf.fftIn);
 	fftw_free(buf.fftOut);
-	fftw_destroy_plan(buf.panama);
+	if(buf.zoom == NULL) fftw_destroy_plan(buf.panama);
+	zoomWorker_free(buf.zoom);
+	zoomPlan_free(zoom);
+	tracker_free(buf.tracker);
 	
-	return 0;
+	if(buf.dropped) printf("Dropped %zu hops\n", buf.dropped);
+	
+	return ok ? 0 : EXIT_FAILURE;
 }
@@ -0,0 +1,129 @@
+/*
+ * hark-query: the notes in part of a recording, from its feature file
+ *
+ * Usage: hark-query [-f] file.feat [from] [to]
+ * from and to are seconds, m:ss or h:mm:ss (with fractions), the whole
+ * recording without them. Prints every run of frames on the same note with
+ * its time, mean frequency and loudest energy, with -f every frame instead
+ * (and its magnitudes, if the file has them). Only the frames in the range
+ * are read: the file is mapped and the range found through its index.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "featfile.h"
+#include "harmonics.h"
+#include "util.h"
+
+// "1:02:03.5", "2:03.5" or "123.5" in seconds, returns 0 if it's none of those
+static int parseTime(const char * text, double * seconds){
+	char * end;
+	double part;
+	int fields = 0;
+	
+	*seconds = 0.0;
+	while(1){
+		part = strtod(text, &end);
+		if(end == text || part < 0.0 || ++fields > 3) return 0;
+		*seconds = *seconds * 60.0 + part;
+		if(*end != ':') break;
+		text = end + 1;
+	}
+	
+	return *end == '\0';
+}
+
+static void printTime(double seconds){
+	int h = (int)(seconds / 3600.0), m = (int)(seconds / 60.0) % 60;
+	
+	printf("%i:%02i:%06.3f", h, m, seconds - 3600.0 * h - 60.0 * m);
+}
+
+static void printFrame(const struct featReader * r, const struct featFrame * f, const unsigned char * spectrum){
+	int octave = 0;
+	const char * note = harmonicToNote(f->harmonic, &octave);
+	size_t i;
+	
+	printTime((double)f->pos / r->header->samplerate);
+	if(f->flags & FEAT_SILENT){
+		printf("   silence\n");
+		return;
+	}
+	printf("   %12.6f   %s%s%i   %10.6f", f->freq, note, strlen(note) == 1 ? " " : "", octave, f->energy);
+	for(i = 0; spectrum != NULL && i < r->header->bins; i++){
+		printf(" %3u", spectrum[i]);
+	}
+	printf("\n");
+}
+
+// one line for the frames first..last (on the same note)
+static void printRun(const struct featReader * r, size_t first, size_t last){
+	const struct featFrame * f = featFile_frame(r, first, NULL), * l = featFile_frame(r, last, NULL), * g;
+	double freq = 0.0, energy = 0.0;
+	int octave = 0;
+	const char * note = harmonicToNote(f->harmonic, &octave);
+	size_t i;
+	
+	for(i = first; i <= last; i++){
+		g = featFile_frame(r, i, NULL);
+		freq += g->freq;
+		if(g->energy > energy) energy = g->energy;
+	}
+	// a frame ends at its pos, the run starts where its first frame does
+	printTime((double)(f->pos - f->length) / r->header->samplerate);
+	printf(" - ");
+	printTime((double)l->pos / r->header->samplerate);
+	printf("   %s%s%i   %12.6f   %10.6f   %zu frames\n", note, strlen(note) == 1 ? " " : "", octave,
+		freq / (last - first + 1), energy, last - first + 1);
+}
+
+int main(int argc, char ** argv){
+	struct featReader * r;
+	const struct featFrame * f;
+	const unsigned char * spectrum;
+	double from = 0.0, to = -1.0;
+	int everyFrame = 0;
+	size_t i, first, end, runStart = 0;
+	int inRun = 0;
+	
+	if(argc > 1 && strcmp(argv[1], "-f") == 0){
+		everyFrame = 1;
+		argv++;
+		argc--;
+	}
+	if(argc < 2 || (argc > 2 && !parseTime(argv[2], &from)) || (argc > 3 && !parseTime(argv[3], &to))){
+		fprintf(stderr, "! Usage: hark-query [-f] file.feat [from] [to]\n");
+		return EXIT_FAILURE;
+	}
+	
+	r = featFile_open(argv[1]);
+	if(r == NULL) return EXIT_FAILURE;
+	
+	printf("Samplerate: %u\nWindow-inc: %u\nFrames: %zu (%zu chunks)\n",
+		r->header->samplerate, r->header->hop, r->numFrames, r->numChunks);
+	
+	first = featFile_find(r, (uint64_t)(from * r->header->samplerate));
+	end = to < 0.0 ? r->numFrames : featFile_find(r, (uint64_t)(to * r->header->samplerate) + 1);
+	
+	for(i = first; i < end; i++){
+		f = featFile_frame(r, i, &spectrum);
+		if(everyFrame){
+			printFrame(r, f, spectrum);
+			continue;
+		}
+		if(inRun && ((f->flags & FEAT_SILENT) || f->harmonic != featFile_frame(r, runStart, NULL)->harmonic)){
+			printRun(r, runStart, i - 1);
+			inRun = 0;
+		}
+		if(!inRun && !(f->flags & FEAT_SILENT)){
+			runStart = i;
+			inRun = 1;
+		}
+	}
+	if(inRun) printRun(r, runStart, end - 1);
+	
+	featFile_free(r);
+	
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * hark-top: watch the stage counters of a running harkd (or anything else
+ * writing a stats file)
+ *
+ * Usage: hark-top [stats] [interval] [count] [-t]
+ * Every interval seconds (1 by default) prints, per stage, the calls per
+ * second, the mean time per call and the share of one core it took over the
+ * interval, the worst call since the start, the queue depth last seen and the
+ * drops per second. count stops after that many (0 runs until interrupted).
+ * -t adds a row per thread under every stage.
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "util.h"
+
+static void printRow(const char * name, const struct stageCounter * now, const struct stageCounter * then, double seconds){
+	uint64_t calls = now->calls - then->calls, ns = now->totalNs - then->totalNs;
+	
+	printf("%-10s %10.1f %10.2f %7.1f%% %10.2f %10llu %8.1f\n", name,
+		calls / seconds, calls ? ns / 1e3 / calls : 0.0, 100.0 * ns / 1e9 / seconds,
+		now->maxNs / 1e3, (unsigned long long)now->depth, (now->drops - then->drops) / seconds);
+}
+
+int main(int argc, char ** argv){
+	const char * path = "/tmp/harkd.stats";
+	double interval = 1.0;
+	size_t count = 0, numBlocks, i, s, k, n = 0;
+	int perThread = 0;
+	struct statsPage * page;
+	struct statsBlock * then, * now, totalThen, totalNow;
+	struct timespec sleep;
+	char name[32];
+	
+	for(i = 1; i < (size_t)argc; i++){
+		if(strcmp(argv[i], "-t") == 0){
+			perThread = 1;
+		}else if(n == 0){
+			path = argv[i];
+			n++;
+		}else if(n == 1){
+			interval = strtod(argv[i], NULL);
+			n++;
+		}else{
+			count = strtoul(argv[i], NULL, 10);
+		}
+	}
+	if(interval <= 0.0){
+		fprintf(stderr, "! Usage: %s [stats] [interval] [count] [-t]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	
+	page = stats_open(path);
+	if(page == NULL) return EXIT_FAILURE;
+	
+	numBlocks = page->numBlocks;
+	then = fmalloc(numBlocks * sizeof *then);
+	now = fmalloc(numBlocks * sizeof *now);
+	memcpy(then, page->blocks, numBlocks * sizeof *then);
+	sleep.tv_sec = (time_t)interval;
+	sleep.tv_nsec = (long)((interval - (double)sleep.tv_sec) * 1e9);
+	
+	printf("---- ----\nStats of %s (pid %lli, %zu threads)\n---- ----\n", path, (long long)page->pid, numBlocks);
+	
+	for(k = 0; count == 0 || k < count; k++){
+		nanosleep(&sleep, NULL);
+		memcpy(now, page->blocks, numBlocks * sizeof *now);
+		
+		// the totals are of the same look as the rows
+		stats_sum(then, numBlocks, &totalThen);
+		stats_sum(now, numBlocks, &totalNow);
+		
+		printf("\n%-10s %10s %10s %8s %10s %10s %8s\n", "stage", "calls/s", "mean us", "cpu", "max us", "depth", "drops/s");
+		for(s = 0; s < page->numStages; s++){
+			printRow(page->names[s], totalNow.stage + s, totalThen.stage + s, interval);
+			for(i = 0; perThread && i < numBlocks; i++){
+				snprintf(name, sizeof name, "  #%zu", i);
+				printRow(name, now[i].stage + s, then[i].stage + s, interval);
+			}
+		}
+		fflush(stdout);
+		
+		memcpy(then, now, numBlocks * sizeof *then);
+	}
+	
+	free(then);
+	free(now);
+	stats_free(page);
+	return EXIT_SUCCESS;
+}
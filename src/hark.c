@@ -0,0 +1,265 @@
+#define _POSIX_C_SOURCE 200112L // nanosleep
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "hark.h"
+#include "analyzer.h"
+#include "blockqueue.h"
+#include "zoom.h"
+#include "util.h"
+
+#define HARK_BLOCK 256 // samples per queue block, so small callbacks don't waste much of one
+#define HARK_IDLE_US 1000 // how long the analysis thread sleeps when it has caught up
+#define HARK_GATE_ZCR 0.25 // zero crossings per sample the gate still takes for a whistle
+#define HARK_GATE_HANG 2
+
+struct hark{
+	struct harkConfig config;
+	struct blockQueue * queue; // the producer's samples, the analysis is its only reader
+	struct anPlan * plan;
+	struct anWorker * worker;
+	struct zoomPlan * zoomPlan; // set instead of plan and worker when zoomed
+	struct zoomWorker * zoom;
+	struct analyzer * an;
+	
+	harkCallback * callback;
+	void * user;
+	pthread_t thread; // analysing, with a callback
+	int running;
+	
+	// without a callback: results waiting for hark_poll
+	struct harkResult * results;
+	size_t numResults; // room
+	size_t first;
+	size_t count;
+	size_t perBlock; // the most results one block (or the final flush) can make
+	int flushed;
+};
+
+static void hark_idle(void){
+	struct timespec ts = {0, HARK_IDLE_US * 1000L};
+	
+	nanosleep(&ts, NULL);
+}
+
+void hark_defaults(struct harkConfig * config){
+	config->samplerate = 44100;
+	config->inputRate = 0;
+	config->fftSize = 4096;
+	config->hop = 1024;
+	config->low = 0.0;
+	config->high = 0.0;
+	config->gate = 0.0;
+	config->partials = 0;
+	config->lookahead = -1;
+	config->buffer = 1.0;
+}
+
+// the analyzer's result, to the callback or kept for hark_poll (which made room for it)
+static void hark_onResult(void * user, const struct anResult * res){
+	struct hark * h = user;
+	struct harkResult out;
+	
+	out.pos = res->pos;
+	out.length = res->length;
+	out.freq = res->freq;
+	out.intens = res->intens;
+	out.harmonic = res->harmonic;
+	out.harmonicFreq = res->harmonicFreq;
+	out.energy = res->energy;
+	out.silent = res->silent;
+	
+	if(h->callback != NULL){
+		h->callback(h->user, &out);
+	}else if(h->count < h->numResults){
+		h->results[(h->first + h->count++) % h->numResults] = out;
+	}
+}
+
+static void * hark_thread(void * vdata){
+	struct hark * h = vdata;
+	const float * block;
+	size_t n;
+	
+	while(1){
+		block = blockQueue_peek(h->queue, 0, &n);
+		if(block == NULL){
+			if(blockQueue_finished(h->queue, 0)) break;
+			hark_idle();
+			continue;
+		}
+		analyzer_push(h->an, block, n);
+		blockQueue_pop(h->queue, 0);
+	}
+	analyzer_flush(h->an);
+	
+	return NULL;
+}
+
+/**
+ * An analyzer with config (hark_defaults, then changed), everything it will
+ * need is allocated here. With a callback it analyses on a thread of its own
+ * and calls back from there, without one the results are polled for.
+ * FFTW's planner isn't thread safe, so only one thread at a time may create
+ * or free analyzers. Returns NULL if config makes no sense.
+ */
+struct hark * hark_new(const struct harkConfig * config, harkCallback * callback, void * user){
+	struct hark * ret;
+	int inputRate = config->inputRate != 0 ? config->inputRate : config->samplerate;
+	size_t numBlocks, perBlock;
+	
+	if(config->samplerate < 1 || inputRate < 1 || config->fftSize < 2 || config->hop < 1 || config->buffer <= 0.0){
+		fprintf(stderr, "! Bad analyzer config (%zu-point FFT every %zu samples at %i Hz)\n",
+			config->fftSize, config->hop, config->samplerate);
+		return NULL;
+	}
+	
+	ret = fmalloc(sizeof *ret);
+	memset(ret, 0, sizeof *ret);
+	ret->config = *config;
+	ret->config.inputRate = inputRate;
+	ret->callback = callback;
+	ret->user = user;
+	
+	if(config->high > 0.0){
+		ret->zoomPlan = zoomPlan_new(config->samplerate, config->low, config->high, config->fftSize);
+		if(ret->zoomPlan == NULL){
+			hark_free(ret);
+			return NULL;
+		}
+		ret->zoom = zoomWorker_new(ret->zoomPlan);
+		ret->an = analyzer_newZoom(ret->zoom, AN_FLOAT32, config->hop, config->samplerate, hark_onResult, ret);
+	}else{
+		ret->plan = anPlan_new(config->fftSize);
+		ret->worker = anWorker_new(ret->plan);
+		ret->an = analyzer_newOn(ret->worker, AN_FLOAT32, config->hop, config->samplerate, hark_onResult, ret);
+	}
+	if(config->gate > 0.0) analyzer_setGate(ret->an, config->gate, config->gate / 2.0, HARK_GATE_ZCR, HARK_GATE_HANG);
+	analyzer_setTracker(ret->an, config->partials);
+	analyzer_setSmoothing(ret->an, config->lookahead);
+	if(!analyzer_setInputRate(ret->an, inputRate)){
+		hark_free(ret);
+		return NULL;
+	}
+	
+	numBlocks = (size_t)ceil(config->buffer * inputRate / HARK_BLOCK);
+	ret->queue = blockQueue_new(HARK_BLOCK, numBlocks < 2 ? 2 : numBlocks, 1);
+	if(ret->queue == NULL){
+		hark_free(ret);
+		return NULL;
+	}
+	
+	if(callback != NULL){
+		if(pthread_create(&ret->thread, NULL, hark_thread, ret) != 0){
+			fprintf(stderr, "! Can't start the analysis thread\n");
+			hark_free(ret);
+			return NULL;
+		}
+		ret->running = 1;
+	}else{
+		// a frame or the gate closing per hop, and a close lets out what the smoother held back
+		perBlock = ret->an->resampler != NULL ? resampler_maxOut(ret->an->resampler, HARK_BLOCK) : HARK_BLOCK;
+		ret->perBlock = perBlock / config->hop + 2 + (config->lookahead >= 0 ? (size_t)config->lookahead + 1 : 0);
+		ret->numResults = 4 * ret->perBlock;
+		ret->results = fmalloc(ret->numResults * sizeof *ret->results);
+	}
+	
+	return ret;
+}
+
+/**
+ * Producer only (one thread at a time, an audio callback is fine): queue n
+ * samples at inputRate for the analysis, without waiting, locking or
+ * allocating. Returns how many fit, the rest is dropped and counted.
+ */
+size_t hark_push(struct hark * h, const float * samples, size_t n){
+	return blockQueue_push(h->queue, samples, n);
+}
+
+// the same for int16 samples, converted to full scale 1.0 a block at a time on the producer's stack
+size_t hark_pushInt16(struct hark * h, const int16_t * samples, size_t n){
+	float block[HARK_BLOCK];
+	size_t done = 0, chunk, took, i;
+	
+	while(done < n){
+		chunk = n - done < HARK_BLOCK ? n - done : HARK_BLOCK;
+		for(i = 0; i < chunk; i++) block[i] = samples[done + i] * (1.0f / 32768.0f);
+		took = blockQueue_push(h->queue, block, chunk);
+		done += took;
+		if(took < chunk){
+			// the queue counted what it didn't take of this block, the rest isn't pushed at all
+			h->queue->dropped += n - done - (chunk - took);
+			break;
+		}
+	}
+	
+	return done;
+}
+
+/**
+ * Without a callback: analyse what has been pushed, on the calling thread,
+ * and hand out up to max results into out, oldest first. Returns how many;
+ * fewer than max once it has caught up with the producer. Only one thread
+ * may poll.
+ */
+size_t hark_poll(struct hark * h, struct harkResult * out, size_t max){
+	const float * block;
+	size_t n, i;
+	
+	if(h->callback != NULL) return 0;
+	
+	// only as far as the results it makes are wanted and fit
+	while(h->count < max && h->numResults - h->count >= h->perBlock){
+		block = blockQueue_peek(h->queue, 0, &n);
+		if(block == NULL){
+			if(!h->flushed && blockQueue_finished(h->queue, 0)){
+				analyzer_flush(h->an);
+				h->flushed = 1;
+			}
+			break;
+		}
+		analyzer_push(h->an, block, n);
+		blockQueue_pop(h->queue, 0);
+	}
+	
+	for(i = 0; i < max && h->count > 0; i++){
+		out[i] = h->results[h->first];
+		h->first = (h->first + 1) % h->numResults;
+		h->count--;
+	}
+	
+	return i;
+}
+
+// samples pushed that didn't fit in the queue
+size_t hark_dropped(struct hark * h){
+	return h->queue->dropped;
+}
+
+/**
+ * After the last push: with a callback, wait until everything queued has
+ * been analysed and called back; without one, polling hands out the rest.
+ */
+void hark_finish(struct hark * h){
+	blockQueue_close(h->queue);
+	if(!h->running) return;
+	pthread_join(h->thread, NULL);
+	h->running = 0;
+}
+
+void hark_free(struct hark * h){
+	if(h == NULL) return;
+	if(h->queue != NULL) hark_finish(h);
+	analyzer_free(h->an);
+	anWorker_free(h->worker);
+	anPlan_free(h->plan);
+	zoomWorker_free(h->zoom);
+	zoomPlan_free(h->zoomPlan);
+	blockQueue_free(h->queue);
+	free(h->results);
+	free(h);
+}
@@ -0,0 +1,63 @@
+#ifndef HARK_HARK_H
+#define HARK_HARK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * libhark: the analysis of the programs, to embed in something else.
+ *
+ * One producer (an audio callback, which must never wait, or any other
+ * thread, one at a time) pushes samples; that only copies them into a
+ * lock-free queue, it neither locks nor allocates, and what doesn't fit is
+ * dropped and counted. They're analysed either on a thread of the
+ * analyzer's own, which calls back with every result, or on the thread that
+ * polls for results. Everything is allocated by hark_new.
+ */
+
+struct hark; // opaque
+
+struct harkConfig{
+	int samplerate; // everything is analysed and reported at
+	int inputRate; // of the samples pushed, resampled to samplerate on the analysis side, 0 for the same
+	size_t fftSize;
+	size_t hop;
+	double low; // zoom into low..high Hz at the resolution of fftSize, high 0 for the whole spectrum
+	double high;
+	double gate; // hop RMS that opens the silence gate, 0 for none
+	size_t partials; // follow that many partials instead of the loudest bin, 0 doesn't
+	int lookahead; // hops to smooth the notes over, negative doesn't
+	double buffer; // seconds of input the queue holds for the analysis to catch up
+};
+
+struct harkResult{
+	uint64_t pos; // sample (at samplerate, since the start) just after the frame
+	size_t length; // FFT size of the frame
+	double freq;
+	double intens;
+	int harmonic;
+	double harmonicFreq;
+	double energy; // RMS of the frame: Hann windowed, but not when zoomed (about 1.63 times that for a steady tone)
+	int silent; // the gate just closed, nothing else is filled in
+};
+
+typedef void harkCallback(void * user, const struct harkResult * res);
+
+void hark_defaults(struct harkConfig * config);
+
+struct hark * hark_new(const struct harkConfig * config, harkCallback * callback, void * user);
+
+size_t hark_push(struct hark * h, const float * samples, size_t n);
+
+size_t hark_pushInt16(struct hark * h, const int16_t * samples, size_t n);
+
+size_t hark_poll(struct hark * h, struct harkResult * out, size_t max);
+
+size_t hark_dropped(struct hark * h);
+
+void hark_finish(struct hark * h);
+
+void hark_free(struct hark * h);
+
+#endif
@@ -0,0 +1,380 @@
+/*
+ * harkd: analyse many streams at once, served over a UNIX domain socket
+ *
+ * Usage: harkd [socket] [workers] [fftSize] [hop] [sizes] [lookahead] [stats] [format]
+ * Clients connect and send mono, native-endian PCM at 44100 Hz, float32 or
+ * with format int16 (half the bytes to send and to keep per stream). Every
+ * hop a line is sent back:
+ *   <sample position> <frequency> <harmonic> <note><octave> <intensity>
+ * unless the stream is silent, then there's one line when it falls silent:
+ *   <sample position> silence
+ * The listening thread accepts connections and hands each to the worker with
+ * the fewest clients. Every worker multiplexes its clients with its own epoll
+ * instance. All workers share one FFTW plan and each has one set of scratch
+ * buffers, so a client only costs its sample history (and the results it
+ * hasn't read yet, up to OUTMAX bytes).
+ * sizes is a comma separated list of smaller FFT sizes every stream switches
+ * between by how steady its pitch is, fftSize is the largest (0 for none).
+ * With a lookahead notes are smoothed, and every line comes that many hops
+ * later.
+ * Every worker counts the time its stages take in the stats file
+ * (/tmp/harkd.stats by default, 0 for none), watch it with hark-top.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+
+#include "analyzer.h"
+#include "harmonics.h"
+#include "stats.h"
+#include "util.h"
+
+#define SAMPLERATE 44100
+#define MAXEVENTS 64
+#define READBUF 16384 // samples read per recv
+#define OUTMAX 65536 // bytes of results queued per client before dropping
+#define OUTMIN 512 // bytes of results the queue starts with, a few lines
+#define GATE_OPEN 0.01 // hop RMS (-40 dBFS) at which a stream is considered active
+
+struct hWorker;
+
+struct client{
+	int fd;
+	struct analyzer * an;
+	struct hWorker * worker;
+	
+	unsigned char partial[sizeof(float)]; // a sample split over two reads (float is the larger)
+	size_t numPartial;
+	
+	char * out; // results not yet sent, grown up to OUTMAX as they back up
+	size_t outLen;
+	size_t outSize;
+	int wantOut; // EPOLLOUT is armed
+	int eof; // the client finished sending, rather than failing
+	size_t dropped;
+};
+
+struct hWorker{
+	pthread_t thread;
+	int epfd;
+	struct anWorker * an;
+	enum anFormat format; // of every client
+	unsigned char * pcm; // READBUF samples
+	size_t numClients; // guarded by clientsMutex
+	struct statsBlock * stats; // NULL when not counting
+};
+
+static pthread_mutex_t clientsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void onResult(void * user, const struct anResult * res){
+	struct client * c = user;
+	char line[128];
+	int octave = 0, n;
+	const char * note;
+	
+	if(res->silent){
+		n = snprintf(line, sizeof line, "%zu silence\n", res->pos);
+	}else{
+		note = harmonicToNote(res->harmonic, &octave);
+		n = snprintf(line, sizeof line, "%zu %.3f %i %s%i %.1f\n",
+			res->pos, res->freq, res->harmonic, note, octave, res->intens);
+	}
+	if(n < 0 || (size_t)n >= sizeof line) return;
+	
+	// a client that doesn't read its results loses them, it doesn't stall the others
+	if(c->outLen + n > OUTMAX){
+		c->dropped++;
+		if(c->worker->stats != NULL) c->worker->stats->stage[STAGE_OUTPUT].drops++;
+		return;
+	}
+	if(c->outLen + n > c->outSize){
+		c->outSize = c->outSize == 0 ? OUTMIN : c->outSize * 2;
+		if(c->outSize > OUTMAX) c->outSize = OUTMAX;
+		c->out = realloc(c->out, c->outSize);
+		if(c->out == NULL){
+			fprintf(stderr, "! realloc failed (%zu)\n", c->outSize);
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(c->out + c->outLen, line, n);
+	c->outLen += n;
+}
+
+static void client_close(struct client * c){
+	epoll_ctl(c->worker->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	
+	pthread_mutex_lock(&clientsMutex);
+	c->worker->numClients--;
+	pthread_mutex_unlock(&clientsMutex);
+	
+	if(c->dropped) fprintf(stderr, "! client %i: dropped %zu results\n", c->fd, c->dropped);
+	analyzer_free(c->an);
+	free(c->out);
+	free(c);
+}
+
+// returns 0 when the client has gone away
+static int client_flush(struct client * c){
+	struct epoll_event ev;
+	struct statsBlock * stats = c->worker->stats;
+	uint64_t t0 = stats != NULL ? stats_now() : 0;
+	ssize_t n;
+	size_t sent = 0;
+	
+	while(sent < c->outLen){
+		n = send(c->fd, c->out + sent, c->outLen - sent, MSG_NOSIGNAL);
+		if(n < 0){
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return 0;
+		}
+		sent += n;
+	}
+	
+	if(sent > 0){
+		memmove(c->out, c->out + sent, c->outLen - sent);
+		c->outLen -= sent;
+	}
+	if(stats != NULL){
+		stats_add(stats, STAGE_OUTPUT, t0);
+		stats->stage[STAGE_OUTPUT].depth = c->outLen;
+	}
+	
+	// only wait for writability while there is something to write
+	if((c->outLen > 0) != c->wantOut){
+		c->wantOut = c->outLen > 0;
+		ev.events = EPOLLIN | EPOLLRDHUP | (c->wantOut ? EPOLLOUT : 0);
+		ev.data.ptr = c;
+		epoll_ctl(c->worker->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	}
+	
+	return 1;
+}
+
+// returns 0 when the client has gone away
+static int client_read(struct client * c, unsigned char * bytes){
+	struct statsBlock * stats = c->worker->stats;
+	size_t size = c->worker->format == AN_INT16 ? sizeof(int16_t) : sizeof(float);
+	uint64_t t0;
+	ssize_t n;
+	size_t have, frames, reads;
+	
+	// level triggered: a busy client gets a few reads, then the others get a turn
+	for(reads = 0; reads < 4; reads++){
+		memcpy(bytes, c->partial, c->numPartial);
+		t0 = stats != NULL ? stats_now() : 0;
+		n = recv(c->fd, bytes + c->numPartial, READBUF * size - c->numPartial, 0);
+		if(stats != NULL){
+			stats_add(stats, STAGE_CAPTURE, t0);
+			// bytes waiting, a full read means the client is ahead of us
+			if(n > 0) stats->stage[STAGE_CAPTURE].depth = n;
+		}
+		if(n == 0){
+			c->eof = 1;
+			return 0;
+		}
+		if(n < 0){
+			if(errno == EINTR) continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		
+		have = c->numPartial + n;
+		frames = have / size;
+		c->numPartial = have - frames * size;
+		memcpy(c->partial, bytes + frames * size, c->numPartial);
+		
+		if(c->worker->format == AN_INT16){
+			analyzer_pushInt16(c->an, (const int16_t *)bytes, frames);
+		}else{
+			analyzer_push(c->an, (const float *)bytes, frames);
+		}
+		if(!client_flush(c)) return 0;
+	}
+	
+	return 1;
+}
+
+void * workerThread(void * vdata){
+	struct hWorker * w = vdata;
+	struct epoll_event events[MAXEVENTS];
+	struct client * c;
+	int i, n, alive;
+	
+	while(1){
+		n = epoll_wait(w->epfd, events, MAXEVENTS, -1);
+		if(n < 0){
+			if(errno == EINTR) continue;
+			fprintf(stderr, "! epoll_wait: %s\n", strerror(errno));
+			break;
+		}
+		
+		for(i = 0; i < n; i++){
+			c = events[i].data.ptr;
+			alive = !(events[i].events & EPOLLERR);
+			
+			if(alive && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))){
+				alive = client_read(c, w->pcm);
+			}
+			if(alive && (events[i].events & EPOLLOUT)){
+				alive = client_flush(c);
+			}
+			if(!alive){
+				// a client that finished gets what the smoother held back, as much as still fits
+				if(c->eof){
+					analyzer_flush(c->an);
+					client_flush(c);
+				}
+				client_close(c);
+			}
+		}
+	}
+	
+	return NULL;
+}
+
+static struct hWorker * leastBusy(struct hWorker * workers, size_t numWorkers){
+	struct hWorker * ret = workers;
+	size_t i;
+	
+	for(i = 1; i < numWorkers; i++){
+		if(workers[i].numClients < ret->numClients) ret = workers + i;
+	}
+	ret->numClients++;
+	
+	return ret;
+}
+
+int main(int argc, char ** argv){
+	const char * path = "/tmp/harkd.sock", * statsPath = "/tmp/harkd.stats";
+	struct statsPage * stats = NULL;
+	size_t numWorkers = 4, fftSize = 1024 * 4, hop = 1024, i;
+	struct sockaddr_un addr;
+	struct hWorker * workers;
+	struct anPlan * plan;
+	struct anPlan * plans[AN_MAXSIZES];
+	size_t sizes[AN_MAXSIZES], numSizes = 0;
+	struct epoll_event ev;
+	struct client * c;
+	int lfd, fd, lookahead = -1;
+	enum anFormat format = AN_FLOAT32;
+	
+	if(argc > 1) path = argv[1];
+	if(argc > 2) numWorkers = strtoul(argv[2], NULL, 10);
+	if(argc > 3) fftSize = strtoul(argv[3], NULL, 10);
+	if(argc > 4) hop = strtoul(argv[4], NULL, 10);
+	if(argc > 5) numSizes = analyzer_parseSizes(argv[5], sizes, AN_MAXSIZES - 1);
+	if(argc > 6) lookahead = atoi(argv[6]);
+	if(argc > 7) statsPath = strcmp(argv[7], "0") == 0 ? NULL : argv[7];
+	if(argc > 8 && strcmp(argv[8], "int16") == 0) format = AN_INT16;
+	if(numWorkers < 1 || fftSize < 2 || hop < 1 || strlen(path) >= sizeof addr.sun_path || (argc > 5 && numSizes == 0 && strcmp(argv[5], "0") != 0)
+		|| (argc > 8 && format != AN_INT16 && strcmp(argv[8], "float32") != 0)){
+		fprintf(stderr, "! Usage: %s [socket] [workers] [fftSize] [hop] [sizes] [lookahead] [stats] [float32|int16]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	for(i = 0; i < numSizes; i++){
+		if(sizes[i] >= fftSize || (i > 0 && sizes[i] <= sizes[i - 1])){
+			fprintf(stderr, "! FFT sizes must be ascending and smaller than %zu\n", fftSize);
+			return EXIT_FAILURE;
+		}
+	}
+	
+	signal(SIGPIPE, SIG_IGN);
+	
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(lfd < 0){
+		fprintf(stderr, "! socket: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if(bind(lfd, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(lfd, 128) < 0){
+		fprintf(stderr, "! bind/listen %s: %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	
+	plan = anPlan_new(fftSize);
+	for(i = 0; i < numSizes; i++){
+		plans[i] = anPlan_new(sizes[i]);
+	}
+	if(numSizes > 0) plans[numSizes++] = plan;
+	if(statsPath != NULL && (stats = stats_new(statsPath, numWorkers, NULL, 0)) == NULL) return EXIT_FAILURE;
+	workers = fmalloc(numWorkers * sizeof *workers);
+	for(i = 0; i < numWorkers; i++){
+		workers[i].epfd = epoll_create(MAXEVENTS);
+		if(workers[i].epfd < 0){
+			fprintf(stderr, "! epoll_create: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		workers[i].an = anWorker_new(plan);
+		workers[i].format = format;
+		workers[i].pcm = fmalloc(READBUF * sizeof(float));
+		workers[i].numClients = 0;
+		workers[i].stats = stats != NULL ? stats->blocks + i : NULL;
+		pthread_create(&workers[i].thread, NULL, workerThread, workers + i);
+	}
+	
+	printf("---- ----\nListening on %s\n---- ----\n", path);
+	printf("Workers: %zu\nFFT-size: %zu\nWindow-length: %f\nWindow-inc: %zu\nFormat: %s\n",
+		numWorkers, fftSize, (double)fftSize / SAMPLERATE, hop, format == AN_INT16 ? "int16" : "float32");
+	for(i = 0; i + 1 < numSizes; i++){
+		printf("Adaptive-size: %zu\n", sizes[i]);
+	}
+	if(stats != NULL) printf("Stats: %s\n", statsPath);
+	
+	while(1){
+		fd = accept(lfd, NULL, NULL);
+		if(fd < 0){
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			fprintf(stderr, "! accept: %s\n", strerror(errno));
+			break;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		
+		c = fmalloc(sizeof *c);
+		c->fd = fd;
+		c->numPartial = 0;
+		c->out = NULL;
+		c->outLen = 0;
+		c->outSize = 0;
+		c->wantOut = 0;
+		c->eof = 0;
+		c->dropped = 0;
+		
+		pthread_mutex_lock(&clientsMutex);
+		c->worker = leastBusy(workers, numWorkers);
+		pthread_mutex_unlock(&clientsMutex);
+		
+		// analyzers on a shared worker don't plan, so this is safe next to running workers
+		c->an = analyzer_newOn(c->worker->an, format, hop, SAMPLERATE, onResult, c);
+		analyzer_setGate(c->an, GATE_OPEN, GATE_OPEN / 2.0, 0.25, 2);
+		analyzer_setSizes(c->an, plans, numSizes);
+		analyzer_setSmoothing(c->an, lookahead);
+		analyzer_setStats(c->an, c->worker->stats);
+		
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = c;
+		if(epoll_ctl(c->worker->epfd, EPOLL_CTL_ADD, fd, &ev) < 0){
+			fprintf(stderr, "! epoll_ctl: %s\n", strerror(errno));
+			client_close(c);
+		}
+	}
+	
+	close(lfd);
+	unlink(path);
+	stats_free(stats);
+	return EXIT_FAILURE;
+}
@@ -1,5 +1,10 @@
+#include <stdint.h>
+
 #include "harmonics.h"
 
+#define HARM_BLOCK 64 // frequencies at a time when their cents aren't wanted
+#define HARM_BIAS 16384.0 // rounding by truncation needs a positive number
+
 static const char * notes[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
 
 static const char * lines[] = {
@@ -28,7 +33,63 @@ static const char * lines[] = {
 	"  | | | | | #", // A#5
 };
 
-static double harmonics[UMIN_HARMONIC + MAX_HARMONIC];
+/**
+ * Equal temperament with A4 at 440 Hz, harmonics MIN_HARMONIC..MAX_HARMONIC.
+ * Generated by `make harmonica && ./harmonics`, other tunings are ratios on
+ * top of this.
+ */
+static const double harmonics[UMIN_HARMONIC + MAX_HARMONIC + 1] = {
+	16.351597831287414, 17.323914436054505, 18.354047994837977, 19.445436482630058,
+	20.601722307054366, 21.826764464562746, 23.12465141947715, 24.499714748859326,
+	25.956543598746574, 27.5, 29.13523509488062, 30.867706328507751,
+	32.703195662574828, 34.64782887210901, 36.70809598967594, 38.890872965260115,
+	41.203444614108747, 43.653528929125486, 46.2493028389543, 48.999429497718666,
+	51.913087197493141, 55, 58.270470189761241, 61.735412657015502,
+	65.406391325149656, 69.295657744218019, 73.416191979351879, 77.781745930520231,
+	82.406889228217494, 87.307057858250971, 92.4986056779086, 97.998858995437331,
+	103.82617439498628, 110, 116.54094037952248, 123.47082531403103,
+	130.81278265029931, 138.59131548843604, 146.83238395870379, 155.56349186104046,
+	164.81377845643496, 174.61411571650194, 184.9972113558172, 195.99771799087463,
+	207.65234878997256, 220, 233.08188075904496, 246.94165062806206,
+	261.62556530059862, 277.18263097687208, 293.66476791740757, 311.12698372208092,
+	329.62755691286992, 349.22823143300388, 369.9944227116344, 391.99543598174927,
+	415.30469757994513, 440, 466.16376151808993, 493.88330125612413,
+	523.25113060119725, 554.36526195374415, 587.32953583481515, 622.25396744416184,
+	659.25511382573984, 698.45646286600777, 739.9888454232688, 783.99087196349853,
+	830.60939515989025, 880, 932.32752303617985, 987.76660251224826,
+	1046.5022612023945, 1108.7305239074883, 1174.6590716696303, 1244.5079348883237,
+	1318.5102276514797, 1396.9129257320155, 1479.9776908465376, 1567.9817439269971,
+	1661.2187903197805, 1760, 1864.6550460723597, 1975.5332050244961,
+	2093.004522404789, 2217.4610478149766, 2349.3181433392601, 2489.0158697766474,
+	2637.0204553029598, 2793.8258514640311, 2959.9553816930752, 3135.9634878539946,
+	3322.437580639561, 3520, 3729.3100921447194, 3951.0664100489921,
+	4186.009044809578, 4434.9220956299532, 4698.6362866785203, 4978.0317395532948,
+	5274.0409106059196, 5587.6517029280622, 5919.9107633861504, 6271.9269757079892,
+	6644.875161279122, 7040, 7458.620184289437, 7902.1328200979879,
+	8372.0180896191559, 8869.8441912599064, 9397.2725733570442, 9956.0634791065895,
+	10548.081821211836, 11175.303405856126, 11839.821526772301, 12543.853951415975,
+	13289.750322558246, 14080, 14917.240368578874, 15804.265640195976,
+	16744.036179238312, 17739.688382519813, 18794.545146714088, 19912.126958213179,
+	21096.163642423671, 22350.606811712252, 23679.643053544602, 25087.707902831949,
+	26579.500645116492, 28160, 29834.480737157748, 31608.531280391951
+};
+
+// cents from equal temperament of every pitch class, C first, the tuning is on C (`./harmonics -c` checks them)
+static const double temperaments[][12] = {
+	{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+	{0.0, 13.7, 3.9, -5.9, 7.8, -2.0, 11.7, 2.0, 15.6, 5.9, -3.9, 9.8}, // pythagorean
+	{0.0, 11.7, 3.9, 15.6, -13.7, -2.0, -9.8, 2.0, 13.7, -15.6, -3.9, -11.7}, // just (5-limit)
+	{0.0, -24.0, -6.8, 10.3, -13.7, 3.4, -20.5, -3.4, -27.4, -10.3, 6.8, -17.1}, // quarter-comma meantone, Eb to G#
+	{0.0, -9.8, -7.8, -5.9, -9.8, -2.0, -11.7, -3.9, -7.8, -11.7, -3.9, -7.8}, // Werckmeister III
+};
+
+static const char * temperamentNames[] = {"equal", "pythagorean", "just", "meantone", "werckmeister"};
+
+// the current tuning: A4 and cents from equal temperament (A4 at 0) of every pitch class
+static double reference = 440.0;
+static double offsets[12] = {0.0};
+static double referenceLog2 = 8.7813597135246599; // log2(440)
+static double ratios[12] = {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
 
 const char * uharmonicToNote(size_t harmonic, int * octave){
 	if(harmonic > MAX_HARMONIC + UMIN_HARMONIC) return "";
@@ -52,60 +113,213 @@ const char * harmonicToLine(int harmonic){
 	return lines[1 + harmonic];
 }
 
+static int pitchClass(int harmonic){
+	return (harmonic % 12 + 12) % 12;
+}
+
+/**
+ * Tune to A4 = ref Hz in one of the temperaments by name, NULL is equal.
+ * Returns 0 (and changes nothing) if there's no such temperament.
+ */
+int setTuning(double ref, const char * temperament){
+	size_t t = 0, i;
+	
+	if(temperament != NULL){
+		for(t = 0; t < sizeof temperamentNames / sizeof *temperamentNames; t++){
+			if(strcmp(temperament, temperamentNames[t]) == 0) break;
+		}
+		if(t == sizeof temperamentNames / sizeof *temperamentNames) return 0;
+	}
+	if(ref <= 0.0) return 0;
+	
+	reference = ref;
+	for(i = 0; i < 12; i++){
+		offsets[i] = temperaments[t][i] - temperaments[t][9];
+		ratios[i] = ref / 440.0 * pow(2.0, offsets[i] / 1200.0);
+	}
+	referenceLog2 = log2(ref);
+	
+	return 1;
+}
+
 double harmonicToFreq(int harmonic){
 	if(harmonic < MIN_HARMONIC || harmonic > MAX_HARMONIC){
 		return 0.0;
 	}
 	
-	harmonic += UMIN_HARMONIC;
-	
-	return harmonics[harmonic];
+	return harmonics[harmonic + UMIN_HARMONIC] * ratios[pitchClass(harmonic)];
 }
 
 /**
- * x = 12*log2(f/440)
+ * x = 12*log2(f/A4) + 9 semitones above C4 in equal temperament, the note is
+ * whichever of its neighbours is fewest cents away once the temperament's
+ * offsets are taken into account. Sets *cents to how far off freq is.
  */
+static int nearestHarmonic(double freq, double * cents){
+	double x = 12.0 * log2(freq / reference) + 9.0, c, best;
+	int k = (int)floor(x + 0.5), ret = k, j;
+	
+	best = 100.0 * (x - k) - offsets[pitchClass(k)];
+	for(j = k - 1; j <= k + 1; j += 2){
+		c = 100.0 * (x - j) - offsets[pitchClass(j)];
+		if(fabs(c) < fabs(best)){
+			best = c;
+			ret = j;
+		}
+	}
+	*cents = best;
+	
+	return ret;
+}
+
+// diff is set to the frequency of the harmonic found
 int freqToHarmonic(double freq, double * diff){
-	double harm = (double)12*log2(freq/(double)440) + (double)9;
-	int x = round(harm);
-	double freq0 = harmonicToFreq(x-1),
-		freq1 = harmonicToFreq(x),
-		freq2 = harmonicToFreq(x+1),
-		diff0 = fabs(freq0 - freq),
-		diff1 = fabs(freq1 - freq),
-		diff2 = fabs(freq2 - freq),
-		nodiff = 0.0;
-		
-	if(diff == NULL) diff = &nodiff;
-	//*diff = harm;
-	//printf("f = %f, x = %3i, d@[x-1] = %f, d@[x] = %f, d@[x+1] = %f\n", freq, x, diff0, diff1, diff2);
-	
-	*diff = freq0;
-	if(diff0 < diff1 && diff0 < diff2) return x - 1;
-	*diff = freq1;
-	if(diff1 < diff0 && diff1 < diff2) return x;
-	*diff = freq2;
-	if(diff2 < diff0 && diff2 < diff1) return x + 1;
-	
-	*diff = freq1;
-	return x;
+	double cents;
+	int ret = nearestHarmonic(freq, &cents);
+	
+	if(diff != NULL) *diff = harmonicToFreq(ret);
+	
+	return ret;
+}
+
+// the temperament's offset of harmonic k (a whole number, as a double) by selects, not a lookup, so it vectorizes
+static double offsetOf(double k){
+	double q = (double)(int)((k + 14400.0) / 12.0), pc = k + 14400.0 - 12.0 * q, ret = 0.0;
+	int p;
+	
+	for(p = 0; p < 12; p++) ret = pc == p ? offsets[p] : ret;
+	
+	return ret;
 }
 
 /**
- * f = 440*2^(x/12)
- * where x in [-48, 83]
+ * freqToHarmonic for n frequencies at once, with how many cents each is off
+ * its note (cents may be NULL), for several peaks per frame across many
+ * streams. One pass without branches or calls, which GCC vectorizes at -O3:
+ * log2 from the exponent bits and a series for the mantissa (within 1e-5
+ * cents of libm's), rounding by truncating a biased value, the offsets of
+ * the three candidates by selects and the nearest of them by selects too.
  */
-void genHarmonics(){
-	int x;
+void freqsToHarmonics(const double * restrict freqs, size_t n, int * restrict out, double * restrict cents){
+	double scratch[HARM_BLOCK], * c;
+	uint64_t bits;
+	double m, e, t, t2, x, k, h, here, below, above, best;
+	size_t i, j, chunk;
 	
-	for(x = 0; x < UMIN_HARMONIC + MAX_HARMONIC + 1; x++){
-		harmonics[x] = 440*pow(2.0, (double)(x - 9 - UMIN_HARMONIC)/12);
+	for(j = 0; j < n; j += chunk){
+		chunk = n - j < HARM_BLOCK ? n - j : HARM_BLOCK;
+		c = cents != NULL ? cents + j : scratch;
+		
+		for(i = 0; i < chunk; i++){
+			// freq = m * 2^e with m in [1, 2), e as a double by way of 2^52 + e + 1023
+			memcpy(&bits, freqs + j + i, sizeof bits);
+			bits = (bits >> 52 & 0x7FF) | 0x4330000000000000;
+			memcpy(&e, &bits, sizeof e);
+			e -= 4503599627370496.0 + 1023.0;
+			memcpy(&bits, freqs + j + i, sizeof bits);
+			bits = (bits & 0x000FFFFFFFFFFFFF) | 0x3FF0000000000000;
+			memcpy(&m, &bits, sizeof m);
+			// log2(m) = 2 / ln(2) * atanh(t), t = (m - 1) / (m + 1) is at most 1/3
+			t = (m - 1.0) / (m + 1.0);
+			t2 = t * t;
+			x = t * (2.8853900817779268 + t2 * (0.96179669392597560 + t2 * (0.57707801635558536 + t2 * (0.41219858311113240
+				+ t2 * (0.32059889797532520 + t2 * (0.26230818925253880 + t2 * (0.22195308321368669 + t2 * 0.19235933878519512)))))));
+			// semitones above C4, |x| < 13000 for any double so the bias keeps it positive
+			x = 12.0 * (e + x - referenceLog2) + 9.0;
+			k = (double)(int)(x + 0.5 + HARM_BIAS) - HARM_BIAS;
+			
+			here = 100.0 * (x - k) - offsetOf(k);
+			below = 100.0 * (x - k + 1.0) - offsetOf(k - 1.0);
+			above = 100.0 * (x - k - 1.0) - offsetOf(k + 1.0);
+			best = fabs(below) < fabs(here) ? below : here;
+			h = fabs(below) < fabs(here) ? k - 1.0 : k;
+			h = fabs(above) < fabs(best) ? k + 1.0 : h;
+			best = fabs(above) < fabs(best) ? above : best;
+			out[j + i] = (int)h;
+			c[i] = best;
+		}
 	}
 }
 
 #ifdef HARKMONIC_MAIN
+/**
+ * A row of temperaments from a chain of 11 fifths (in cents) that starts
+ * start fifths below C: every pitch class is its place in the chain, up or
+ * down octaves to the one above C.
+ */
+static void chainRow(int start, const double * fifths, double * row){
+	double pos[12], c;
+	int k, p;
+	
+	pos[0] = 0.0;
+	for(k = 1; k < 12; k++) pos[k] = pos[k - 1] + fifths[k - 1];
+	for(k = 0; k < 12; k++){
+		c = pos[k] - pos[-start];
+		c -= 1200.0 * floor(c / 1200.0);
+		p = ((start + k) * 7 % 12 + 12) % 12;
+		row[p] = c - 100.0 * p;
+	}
+}
+
+// derive every temperament from its fifths or ratios and compare with the table, returns how many differ
+static int checkTemperaments(void){
+	static const double just[12][2] = {
+		{1, 1}, {16, 15}, {9, 8}, {6, 5}, {5, 4}, {4, 3}, {45, 32}, {3, 2}, {8, 5}, {5, 3}, {16, 9}, {15, 8}
+	};
+	double pure = 1200.0 * log2(3.0 / 2.0);
+	double pythagoreanComma = 12.0 * pure - 7.0 * 1200.0, syntonicComma = 1200.0 * log2(81.0 / 80.0);
+	double fifths[11], row[12];
+	size_t t, i;
+	int bad = 0;
+	
+	for(t = 0; t < sizeof temperaments / sizeof *temperaments; t++){
+		for(i = 0; i < 11; i++) fifths[i] = pure;
+		switch(t){
+		case 0: // equal
+			for(i = 0; i < 11; i++) fifths[i] = 700.0;
+			chainRow(0, fifths, row);
+			break;
+		case 1: // pythagorean, Eb to G#
+			chainRow(-3, fifths, row);
+			break;
+		case 2:
+			for(i = 0; i < 12; i++) row[i] = 1200.0 * log2(just[i][0] / just[i][1]) - 100.0 * i;
+			break;
+		case 3: // meantone, Eb to G#
+			for(i = 0; i < 11; i++) fifths[i] = pure - syntonicComma / 4.0;
+			chainRow(-3, fifths, row);
+			break;
+		case 4: // werckmeister III: C-G, G-D, D-A and B-F# take a quarter of the comma each
+			fifths[0] = fifths[1] = fifths[2] = fifths[5] = pure - pythagoreanComma / 4.0;
+			chainRow(0, fifths, row);
+			break;
+		}
+		for(i = 0; i < 12; i++){
+			if(fabs(row[i] - temperaments[t][i]) > 0.051){
+				printf("! %s %s: %.1f, should be %.1f\n", temperamentNames[t], notes[i], temperaments[t][i], row[i]);
+				bad++;
+			}
+		}
+	}
+	
+	return bad;
+}
+
+// prints the harmonics table: f = 440*2^(x/12) where x in [-57, 74], with -c checks the temperaments instead
 int main(int argc, char ** argv){
-	genHarmonics();
+	int x;
+	
+	if(argc > 1 && strcmp(argv[1], "-c") == 0){
+		x = checkTemperaments();
+		printf("%i temperament entries off\n", x);
+		return x != 0;
+	}
+	
+	for(x = 0; x < UMIN_HARMONIC + MAX_HARMONIC + 1; x++){
+		printf("%s%.17g%s", x % 4 == 0 ? "\t" : "", 440*pow(2.0, (double)(x - 9 - UMIN_HARMONIC)/12),
+			x == UMIN_HARMONIC + MAX_HARMONIC ? "\n" : x % 4 == 3 ? ",\n" : ", ");
+	}
+	
 	return 0;
 }
 #endif
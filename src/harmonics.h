@@ -9,10 +9,12 @@
 #define MIN_HARMONIC -48
 #define MAX_HARMONIC  83
 
-void genHarmonics();
+int setTuning(double ref, const char * temperament);
 
 int freqToHarmonic(double freq, double * diff);
 
+void freqsToHarmonics(const double * restrict freqs, size_t n, int * restrict out, double * restrict cents);
+
 double harmonicToFreq(int harmonic);
 
 const char * harmonicToNote(int harmonic, int * octave);
@@ -0,0 +1,184 @@
+#include <math.h>
+
+#include "multipitch.h"
+#include "harmonics.h"
+#include "util.h"
+
+// candidates are the notes low..high in the current tuning
+struct multiPitch * multiPitch_new(int fftSize, int samplerate, int low, int high){
+	struct multiPitch * ret = fmalloc(sizeof *ret);
+	size_t c, h, i, j, centre, nyquist = fftSize / 2, widest = 1, n;
+	double f0, f, binWidth = (double)samplerate / fftSize;
+	
+	ret->fftSize = fftSize;
+	ret->samplerate = samplerate;
+	ret->low = low;
+	ret->numCandidates = high - low + 1;
+	n = ret->numCandidates * MP_HARMONICS;
+	ret->lo = fmalloc(n * sizeof *ret->lo);
+	ret->hi = fmalloc(n * sizeof *ret->hi);
+	ret->first = fmalloc(n * sizeof *ret->first);
+	ret->last = fmalloc(n * sizeof *ret->last);
+	ret->weight = fmalloc(n * sizeof *ret->weight);
+	ret->peaks = fmalloc(n * sizeof *ret->peaks);
+	ret->high = fmalloc(ret->numCandidates * sizeof *ret->high);
+	ret->salience = fmalloc(ret->numCandidates * sizeof *ret->salience);
+	
+	for(c = 0; c < ret->numCandidates; c++){
+		f0 = harmonicToFreq(low + c);
+		for(h = 0; h < MP_HARMONICS; h++){
+			i = h * ret->numCandidates + c;
+			f = f0 * (h + 1);
+			// a quarter tone either side (so the candidates tile), at least a bin
+			centre = (size_t)(f / binWidth + 0.5);
+			ret->lo[i] = (size_t)floor(f * 0.9715 / binWidth);
+			ret->hi[i] = (size_t)ceil(f * 1.0293 / binWidth);
+			if(ret->lo[i] + 1 > centre) ret->lo[i] = centre > 1 ? centre - 1 : 1;
+			if(ret->hi[i] < centre + 1) ret->hi[i] = centre + 1;
+			if(ret->hi[i] >= nyquist) ret->hi[i] = nyquist - 1;
+			// Klapuri's weighting, higher partials of low notes count less
+			ret->weight[i] = (f0 + 52.0) / (f + 320.0);
+			// this and every higher partial are above Nyquist
+			if(ret->lo[i] > ret->hi[i] || (h > 0 && ret->weight[i - ret->numCandidates] == 0.0)) ret->weight[i] = 0.0;
+			if(ret->weight[i] != 0.0 && ret->hi[i] - ret->lo[i] + 1 > widest) widest = ret->hi[i] - ret->lo[i] + 1;
+		}
+	}
+	
+	ret->stride = nyquist + 1;
+	for(ret->numLevels = 1; ((size_t)1 << ret->numLevels) <= widest; ret->numLevels++);
+	ret->table = fmalloc((ret->numLevels * ret->stride + 1) * sizeof *ret->table);
+	ret->table[ret->numLevels * ret->stride] = 0.0;
+	ret->mag = ret->table;
+	
+	// the largest run of 2^j bins in lo..hi, two of them cover it
+	for(i = 0; i < n; i++){
+		if(ret->weight[i] == 0.0){
+			ret->first[i] = ret->last[i] = ret->numLevels * ret->stride;
+			continue;
+		}
+		for(j = 0; ((size_t)2 << j) <= ret->hi[i] - ret->lo[i] + 1; j++);
+		ret->first[i] = j * ret->stride + ret->lo[i];
+		ret->last[i] = j * ret->stride + ret->hi[i] + 1 - ((size_t)1 << j);
+	}
+	
+	return ret;
+}
+
+void multiPitch_free(struct multiPitch * mp){
+	if(mp == NULL) return;
+	free(mp->table);
+	free(mp->lo);
+	free(mp->hi);
+	free(mp->first);
+	free(mp->last);
+	free(mp->weight);
+	free(mp->peaks);
+	free(mp->high);
+	free(mp->salience);
+	free(mp);
+}
+
+static double multiPitch_peak(const double * mag, size_t lo, size_t hi, size_t * at){
+	double high = 0.0;
+	size_t k;
+	
+	*at = lo;
+	for(k = lo; k <= hi; k++){
+		if(mag[k] > high){
+			high = mag[k];
+			*at = k;
+		}
+	}
+	
+	return high;
+}
+
+// one level of the sparse table from the one below it
+static void multiPitch_level(double * restrict out, const double * restrict in, size_t half, size_t n){
+	size_t k;
+	
+	for(k = 0; k + half < n; k++) out[k] = in[k] > in[k + half] ? in[k] : in[k + half];
+	for(; k < n; k++) out[k] = in[k];
+}
+
+// score every candidate on what's left of the spectrum
+static void multiPitch_score(struct multiPitch * mp){
+	const double * table = mp->table;
+	double * peaks = mp->peaks, * high = mp->high, * salience = mp->salience;
+	const double * weight;
+	size_t j, c, h, i, n = mp->numCandidates;
+	double p;
+	
+	for(j = 1; j < mp->numLevels; j++){
+		multiPitch_level(mp->table + j * mp->stride, mp->table + (j - 1) * mp->stride, (size_t)1 << (j - 1), mp->stride);
+	}
+	
+	// the gather, partials above Nyquist read the 0 after the table
+	for(i = 0; i < n * MP_HARMONICS; i++){
+		peaks[i] = table[mp->first[i]] > table[mp->last[i]] ? table[mp->first[i]] : table[mp->last[i]];
+	}
+	
+	for(c = 0; c < n; c++){
+		salience[c] = 0.0;
+		high[c] = 0.0;
+	}
+	for(h = 0; h < MP_HARMONICS; h++){
+		weight = mp->weight + h * n;
+		for(c = 0; c < n; c++){
+			p = peaks[h * n + c];
+			salience[c] += weight[c] * p;
+			high[c] = p > high[c] ? p : high[c];
+		}
+	}
+	// no fundamental, that's a subharmonic of something
+	for(c = 0; c < n; c++){
+		salience[c] = peaks[c] < MP_FUNDAMENTAL * high[c] ? 0.0 : salience[c];
+	}
+}
+
+/**
+ * Up to max notes sounding in the spectrum, most salient first. Returns how
+ * many were found.
+ */
+size_t multiPitch_find(struct multiPitch * mp, fftw_complex * fftOut, struct pitch * pitches, size_t max){
+	double partials[MP_HARMONICS], smooth, first = 0.0, s;
+	size_t n, c, h, i, k, at, best, fundamental, nc = mp->numCandidates;
+	
+	for(k = 0; k <= (size_t)mp->fftSize / 2; k++){
+		mp->mag[k] = sqrt(fftOut[k][0]*fftOut[k][0] + fftOut[k][1]*fftOut[k][1]);
+	}
+	
+	for(n = 0; n < max; n++){
+		multiPitch_score(mp);
+		best = 0;
+		for(c = 1; c < nc; c++){
+			if(mp->salience[c] > mp->salience[best]) best = c;
+		}
+		
+		s = mp->salience[best];
+		if(s <= 0.0 || (n > 0 && s < MP_STOP * first)) break;
+		if(n == 0) first = s;
+		
+		multiPitch_peak(mp->mag, mp->lo[best], mp->hi[best], &fundamental);
+		pitches[n].freq = peakInterp(fftOut, mp->fftSize, fundamental) * mp->samplerate / mp->fftSize;
+		pitches[n].harmonic = mp->low + best;
+		pitches[n].salience = s;
+		
+		// take out its partials, smoothed over their neighbours so a partial it shares with another note isn't all taken
+		for(h = 0; h < MP_HARMONICS && mp->weight[h * nc + best] != 0.0; h++){
+			i = h * nc + best;
+			partials[h] = multiPitch_peak(mp->mag, mp->lo[i], mp->hi[i], &at);
+		}
+		for(k = 0; k < h; k++){
+			i = k * nc + best;
+			smooth = (partials[k] + (k > 0 ? partials[k - 1] : partials[k]) + (k + 1 < h ? partials[k + 1] : partials[k])) / 3.0;
+			if(smooth > partials[k] || k == 0) smooth = partials[k];
+			if(partials[k] <= 0.0) continue;
+			for(at = mp->lo[i]; at <= mp->hi[i]; at++){
+				mp->mag[at] *= 1.0 - smooth / partials[k];
+			}
+		}
+	}
+	
+	return n;
+}
@@ -0,0 +1,60 @@
+#ifndef HARK_MULTIPITCH_H
+#define HARK_MULTIPITCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fftw3.h"
+
+#define MP_HARMONICS 8 // partials in a note's template
+#define MP_STOP 0.2 // stop when the best note left is this much less salient than the first
+#define MP_FUNDAMENTAL 0.1 // a note's fundamental must be at least this times its loudest partial
+
+struct pitch{
+	double freq;
+	int harmonic;
+	double salience;
+};
+
+/**
+ * Several simultaneous notes from one spectrum by iterative harmonic
+ * template subtraction: score every note by the weighted magnitudes around
+ * its first MP_HARMONICS partials, take the best one, subtract its
+ * (spectrally smoothed) partials from the spectrum and repeat.
+ * A partial's magnitude is the largest in its bin range, which a sparse
+ * table of the spectrum (the max of every run of 2^j bins, a straight pass
+ * per level) answers with two loads whatever the range's length. So scoring
+ * is a gather of those pairs into a partial by candidate matrix, laid out a
+ * partial at a time, and a straight-line reduction over the candidates.
+ * Per thread.
+ */
+struct multiPitch{
+	int fftSize;
+	int samplerate;
+	int low; // harmonic of the first candidate
+	size_t numCandidates;
+	
+	size_t stride; // fftSize / 2 + 1, bins per level of the table
+	size_t numLevels;
+	double * table; // numLevels * stride and a 0 for partials above Nyquist, level 0 is what's not explained yet
+	double * mag; // level 0
+	
+	// MP_HARMONICS * numCandidates, partial h of candidate c at h * numCandidates + c
+	size_t * lo; // bin range, lo > hi above Nyquist
+	size_t * hi;
+	size_t * first; // where in table the max of the range's first and last 2^j bins are
+	size_t * last;
+	double * weight; // 0 above Nyquist
+	double * peaks; // this round's partial magnitudes
+	
+	double * high; // numCandidates, loudest partial
+	double * salience;
+};
+
+struct multiPitch * multiPitch_new(int fftSize, int samplerate, int low, int high);
+
+void multiPitch_free(struct multiPitch * mp);
+
+size_t multiPitch_find(struct multiPitch * mp, fftw_complex * fftOut, struct pitch * pitches, size_t max);
+
+#endif
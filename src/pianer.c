@@ -1,136 +1,203 @@
 /*
  * Pianer: synthesize piano sounds
  * Inspiration: http://taradov.com/piano.php
+ *
+ * Usage: pianer [-o out.wav] [-j threads] [-t seconds] [score]
+ * Without -o the score is played on the default output device, with -o it is
+ * rendered to a WAV file as fast as the CPUs allow.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <math.h>
 
 #include <assert.h>
 
 #include "portaudio.h"
+#include <pthread.h>
 
-#ifndef M_PI
-#define M_PI 3.1415926538
-#endif
+#include "score.h"
+#include "wav.h"
 
 const int SAMPLERATE = 44100;
-const int PLAYTIME = 9; // in seconds
-const double AMPLITUDEEPSILON = 1e-6;
+const int PLAYTIME = 9; // in seconds, for scores that never die out
+const size_t MAXVOICES = 512;
+const size_t RENDERBLOCK = 44100; // samples per block in render mode
 
-struct reverbParams{
-	size_t delay;
-	double drop;
-	double rate;
-};
-
-struct noteParams{
-	double a; // initial amplitude
-	double g; // decay rate
-	double f; // frequency
-	
-	size_t pos;
-	struct reverbParams * reverb;
-	
-	double t;
-	double _t;
-	double _e;
-	double _a;
+struct aData{
+	struct sched * sched;
+	size_t end;
 };
 
-struct aData{
-	size_t numNotes;
-	struct noteParams * notes; // these MUST be ordered by noteParams.pos
+struct renderJob{
+	const struct score * score;
+	size_t end;
+	size_t numBlocks;
+	size_t nextBlock; // next block a worker may take
+	size_t written; // blocks written to the file so far
 	
-	size_t position;
+	size_t numSlots;
+	float * slots; // numSlots * RENDERBLOCK samples
+	size_t * slotBlock; // which block is in a slot, SIZE_MAX when none
+	
+	size_t maxVoices;
+	size_t dropped;
+	
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
 };
 
-int playCallback( const void *vin, void *vout, unsigned long frames, 
-		const PaStreamCallbackTimeInfo* timeInfo, 
+int playCallback( const void *vin, void *vout, unsigned long frames,
+		const PaStreamCallbackTimeInfo* timeInfo,
 		PaStreamCallbackFlags status, void *vdata ){
 	
 	struct aData * data = vdata;
-	struct noteParams * note;
-	float * out = vout;
-	double t, s, r, a;
-	size_t i, j;
-	
-	for(i = 0; i < frames; i++, data->position++){
-		out[i] = 0.0;
-		t = (double)data->position / (double)SAMPLERATE;
+	
+	sched_render(data->sched, vout, frames);
+	
+	return data->sched->position >= data->end ? paComplete : paContinue;
+}
+
+/**
+ * Voices are closed-form in time, so every block can be rendered on its own:
+ * seek to the start of the block and render it. Blocks are handed out in
+ * order and may only run numSlots ahead of the writer.
+ */
+void * renderThread(void * vdata){
+	struct renderJob * job = vdata;
+	struct sched * sched = sched_new(job->score, MAXVOICES);
+	size_t block, slot, frames;
+	
+	pthread_mutex_lock(&job->mutex);
+	while(job->nextBlock < job->numBlocks){
+		block = job->nextBlock;
+		if(block >= job->written + job->numSlots){
+			pthread_cond_wait(&job->cond, &job->mutex);
+			continue;
+		}
+		job->nextBlock++;
+		pthread_mutex_unlock(&job->mutex);
+		
+		slot = block % job->numSlots;
+		frames = job->end - block * RENDERBLOCK < RENDERBLOCK ? job->end - block * RENDERBLOCK : RENDERBLOCK;
+		sched_seek(sched, block * RENDERBLOCK);
+		sched_render(sched, job->slots + slot * RENDERBLOCK, frames);
+		
+		pthread_mutex_lock(&job->mutex);
+		job->slotBlock[slot] = block;
+		pthread_cond_broadcast(&job->cond);
+	}
+	
+	if(sched->maxVoices > job->maxVoices) job->maxVoices = sched->maxVoices;
+	job->dropped += sched->dropped;
+	pthread_mutex_unlock(&job->mutex);
+	
+	sched_free(sched);
+	return NULL;
+}
+
+int render(const struct score * score, size_t end, const char * fileName, size_t numThreads){
+	struct renderJob job;
+	struct wavFile * wav;
+	pthread_t * threads;
+	size_t i, slot, frames;
+	int ok = 1, err;
+	
+	wav = wav_create(fileName, SAMPLERATE, 1);
+	if(wav == NULL) return 0;
+	
+	job.score = score;
+	job.end = end;
+	job.numBlocks = (end + RENDERBLOCK - 1) / RENDERBLOCK;
+	job.nextBlock = 0;
+	job.written = 0;
+	job.numSlots = 2 * numThreads;
+	job.slots = smalloc(job.numSlots * RENDERBLOCK * sizeof *job.slots);
+	job.slotBlock = smalloc(job.numSlots * sizeof *job.slotBlock);
+	job.maxVoices = 0;
+	job.dropped = 0;
+	pthread_mutex_init(&job.mutex, NULL);
+	pthread_cond_init(&job.cond, NULL);
+	
+	for(i = 0; i < job.numSlots; i++){
+		job.slotBlock[i] = SIZE_MAX;
+	}
+	
+	threads = smalloc(numThreads * sizeof *threads);
+	for(i = 0; i < numThreads; i++){
+		if((err = pthread_create(threads + i, NULL, renderThread, &job)) != 0){
+			// the blocks go to whichever threads there are, fewer just take longer
+			fprintf(stderr, "! pthread_create: %s, rendering on %zu threads\n", strerror(err), i);
+			numThreads = i;
+		}
+	}
+	if(numThreads == 0){
+		job.written = job.numBlocks;
+		ok = 0;
+	}
+	
+	// stitch the blocks together in order
+	pthread_mutex_lock(&job.mutex);
+	while(job.written < job.numBlocks){
+		slot = job.written % job.numSlots;
+		if(job.slotBlock[slot] != job.written){
+			pthread_cond_wait(&job.cond, &job.mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&job.mutex);
 		
-		// sum(i = 0 -> N){ a[i] * e^(-g[i] * t) * sin(2 * pi * f[i] * t) }
-		// phase is ignored
-		for(j = 0; j < data->numNotes; j++){
-			note = data->notes + j;
-			s = (double)note->pos / (double)SAMPLERATE;
-			r = note->pos + note->reverb->delay - data->position;
-			
-			// since notes MUST be ordered by pos we can break as soon as we find one that is ahead
-			if(note->pos > data->position) break;
-			
-			// decay per note must not depend on its position
-			a = note->a * exp(-note->g * (t - s)); 
-			
-			if(r > 0){
-				a *= note->reverb->drop * note->reverb->rate * (double)r;
-			}
-			
-			// this note has 'died out', don't waste cycles on the sin(). 
-			if(a < AMPLITUDEEPSILON) continue; 
-			
-			// It'd be nice if we could filter the note out entirely
-			// Perhaps this could be pre-computed, using .g and .a
-			// a * e^(-g * (t - s)) < EPSILON
-			// a * e^(-g * (t - s)) = EPSILON
-			note->_e = a;
-			// e^(-g * (t - s)) = EPSILON / a
-			// -g * (t - s) = ln(EPSILON / a)
-			// t - s = ln(EPSILON / a) / -g
-			// t = ln(EPSILON / a) / -g + s
-			note->_t = log(AMPLITUDEEPSILON / note->a) / -note->g + s;
-			note->t = t;
-			note->_a = a;
-			// t > ln(EPSILON / a) / -g + s
-			
-			out[i] += a * sin(2 * M_PI * note->f * t);
+		frames = end - job.written * RENDERBLOCK < RENDERBLOCK ? end - job.written * RENDERBLOCK : RENDERBLOCK;
+		if(wav_writeFloat(wav, job.slots + slot * RENDERBLOCK, frames) != frames){
+			fprintf(stderr, "! Writing %s failed\n", fileName);
+			ok = 0;
 		}
+		
+		pthread_mutex_lock(&job.mutex);
+		job.slotBlock[slot] = SIZE_MAX;
+		job.written++;
+		pthread_cond_broadcast(&job.cond);
+	}
+	pthread_mutex_unlock(&job.mutex);
+	
+	for(i = 0; i < numThreads; i++){
+		pthread_join(threads[i], NULL);
 	}
 	
-	return data->position >= SAMPLERATE * PLAYTIME ? paComplete : paContinue;
+	printf("@ %zu samples, %zu notes, at most %zu voices, %zu dropped\n",
+			end, score->length, job.maxVoices, job.dropped);
+	
+	ok = wav_close(wav) && ok;
+	
+	pthread_mutex_destroy(&job.mutex);
+	pthread_cond_destroy(&job.cond);
+	free(threads);
+	free(job.slots);
+	free(job.slotBlock);
+	
+	return ok;
 }
 
-int main(int argc, char ** argv){
+int play(const struct score * score, size_t end){
 	PaError paer = Pa_Initialize();
 	PaStream * stream;
-	struct reverbParams reverbs = {SAMPLERATE / 10, 1.0, 0.1};
-	struct noteParams notes[] = {
-		{0.8, 4.0, 440.0, 0, &reverbs},
-		{0.1, 1.2, 441.0, 0, &reverbs},
-		{0.1, 1.1, 441.2, 0, &reverbs},
-		
-		{0.8, 4.0, 220.0, SAMPLERATE, &reverbs},
-		{0.1, 1.2, 221.0, SAMPLERATE, &reverbs},
-		{0.1, 1.1, 221.2, SAMPLERATE, &reverbs},
-		
-		{0.8, 4.0, 880.0, 2*SAMPLERATE, &reverbs},
-		{0.1, 1.2, 881.0, 2*SAMPLERATE, &reverbs},
-		{0.1, 1.1, 881.2, 2*SAMPLERATE, &reverbs}
-	};
-	struct aData data = {sizeof notes / sizeof *notes, notes, 0};
-	size_t i;
+	struct aData data = {NULL, end};
 	
 	if(paer != paNoError){
 		fprintf(stderr, "! Pa_Initialize: %s\n", Pa_GetErrorText(paer));
-		exit(-1);
+		return 0;
 	}
 	
-	paer = Pa_OpenDefaultStream(&stream, 0, 1, paFloat32, SAMPLERATE, 
+	data.sched = sched_new(score, MAXVOICES);
+	
+	paer = Pa_OpenDefaultStream(&stream, 0, 1, paFloat32, SAMPLERATE,
 			paFramesPerBufferUnspecified, playCallback, &data);
 	if(paer != paNoError){
 		fprintf(stderr, "! Pa_OpenDefaultStream: %s\n", Pa_GetErrorText(paer));
-		exit(-1);
+		sched_free(data.sched);
+		Pa_Terminate();
+		return 0;
 	}
 	
 	printf("- Init done\n");
@@ -141,17 +208,66 @@ int main(int argc, char ** argv){
 		Pa_Sleep(100);
 	}
 	
-	for(i = 0; i < sizeof notes / sizeof *notes; i++){
-		printf("@ %i: %f / %f : %f / %f : %f\n", i, notes[i]._e, 
-				AMPLITUDEEPSILON, notes[i]._t, notes[i].t, notes[i]._a);
+	printf("@ %zu samples, %zu notes, at most %zu voices, %zu dropped\n",
+			data.sched->position, score->length, data.sched->maxVoices, data.sched->dropped);
+	
+	paer = Pa_CloseStream(stream);
+	if(paer != paNoError) fprintf(stderr, "! Pa_CloseStream: %s\n", Pa_GetErrorText(paer));
+	
+	sched_free(data.sched);
+	Pa_Terminate(); // I don't care if this fails, we're bailing anyway
+	return paer == paNoError;
+}
+
+int main(int argc, char ** argv){
+	struct noteParams notes[] = {
+		{0.8, 4.0, 440.0, 0},
+		{0.1, 1.2, 441.0, 0},
+		{0.1, 1.1, 441.2, 0},
+		
+		{0.8, 4.0, 220.0, SAMPLERATE},
+		{0.1, 1.2, 221.0, SAMPLERATE},
+		{0.1, 1.1, 221.2, SAMPLERATE},
+		
+		{0.8, 4.0, 880.0, 2*SAMPLERATE},
+		{0.1, 1.2, 881.0, 2*SAMPLERATE},
+		{0.1, 1.1, 881.2, 2*SAMPLERATE}
+	};
+	struct score * score;
+	const char * scoreName = NULL;
+	const char * outName = NULL;
+	size_t numThreads = 4, end = 0;
+	int i, ok;
+	
+	for(i = 1; i < argc; i++){
+		if(strcmp(argv[i], "-o") == 0 && i + 1 < argc){
+			outName = argv[++i];
+		}else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc){
+			numThreads = strtoul(argv[++i], NULL, 10);
+			if(numThreads < 1) numThreads = 1;
+		}else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc){
+			end = strtod(argv[++i], NULL) * SAMPLERATE;
+		}else{
+			scoreName = argv[i];
+		}
 	}
 	
-	Pa_CloseStream(stream);
-	if(paer != paNoError){
-		fprintf(stderr, "! Pa_CloseStream: %s\n", Pa_GetErrorText(paer));
-		exit(-1);
+	if(scoreName != NULL){
+		score = score_load(scoreName, SAMPLERATE);
+		if(score == NULL) exit(-1);
+	}else{
+		score = score_new(notes, sizeof notes / sizeof *notes, SAMPLERATE);
 	}
 	
-	Pa_Terminate(); // I don't care if this fails, we're bailing anyway
-	return 0;
+	// play until everything has died out unless told otherwise
+	if(end == 0) end = score->end != SIZE_MAX ? score->end : (size_t)SAMPLERATE * PLAYTIME;
+	
+	if(outName != NULL){
+		ok = render(score, end, outName, numThreads);
+	}else{
+		ok = play(score, end);
+	}
+	
+	score_free(score);
+	return ok ? 0 : -1;
 }
@@ -0,0 +1,514 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "harmonics.h"
+#include "util.h"
+
+#ifndef M_PI
+#define M_PI 3.1415926538
+#endif
+
+#define PIPE_CAPTURE 0 // the counter of pipeline_push itself, stage i's is i + 1
+
+const char * pipeTypeNames[] = {"samples", "frames", "spectra", "peaks", "notes", "nothing"};
+
+struct pipeSource{
+	size_t length;
+	size_t hop;
+	int samplerate;
+	double amplifier;
+	float * ring;
+	size_t head;
+	size_t since; // samples since the last frame
+	size_t total;
+};
+
+static void pipe_idle(void){
+	struct timespec ts = {0, PIPE_IDLE_US * 1000L};
+	
+	nanosleep(&ts, NULL);
+}
+
+static void pipe_allocItem(struct pipeItem * item, enum pipeType type, size_t length){
+	memset(item, 0, sizeof *item);
+	if(type == PIPE_FRAME) item->samples = fftw_malloc(length * sizeof *item->samples);
+	if(type == PIPE_SPECTRUM) item->spectrum = fftw_malloc((length / 2 + 1) * sizeof *item->spectrum);
+	if((type == PIPE_FRAME && item->samples == NULL) || (type == PIPE_SPECTRUM && item->spectrum == NULL)){
+		fprintf(stderr, "! fftw_malloc failed (%zu)\n", length * sizeof *item->spectrum);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void pipe_freeItem(struct pipeItem * item){
+	fftw_free(item->samples);
+	fftw_free(item->spectrum);
+}
+
+// everything but the buffers, a stage only fills in what it makes
+static void pipe_carry(const struct pipeItem * in, struct pipeItem * out){
+	out->pos = in->pos;
+	out->length = in->length;
+	out->samplerate = in->samplerate;
+	out->freq = in->freq;
+	out->intens = in->intens;
+	out->harmonic = in->harmonic;
+}
+
+// the slot to make the next item in, NULL if it's full and we mustn't wait
+static struct pipeItem * pipeQueue_reserve(struct pipeQueue * q, int wait){
+	while(q->head - ATOMIC_LOAD(&q->tail) == PIPE_QUEUE){
+		if(!wait) return NULL;
+		pipe_idle();
+	}
+	
+	return q->items + q->head % PIPE_QUEUE;
+}
+
+// the oldest item, NULL once the queue is closed and empty
+static struct pipeItem * pipeQueue_take(struct pipeQueue * q){
+	while(q->tail == ATOMIC_LOAD(&q->head)){
+		// closed is stored after the last head, so once it's seen head is final
+		if(ATOMIC_LOAD(&q->closed) && q->tail == ATOMIC_LOAD(&q->head)) return NULL;
+		pipe_idle();
+	}
+	
+	return q->items + q->tail % PIPE_QUEUE;
+}
+
+struct pipeline * pipeline_new(void){
+	struct pipeline * ret = fmalloc(sizeof *ret);
+	
+	memset(ret, 0, sizeof *ret);
+	
+	return ret;
+}
+
+/**
+ * Append stage, run on thread (0 is the one calling pipeline_push, later
+ * stages can only be on the same or a later thread). Returns 0 if it
+ * doesn't take what the stage before it makes, the stage is released then.
+ */
+int pipeline_add(struct pipeline * p, struct pipeStage stage, int thread){
+	struct pipeStage * prev = p->numStages > 0 ? p->stages + p->numStages - 1 : NULL;
+	size_t length = prev != NULL ? prev->length : 0;
+	
+	if(p->running || p->numStages == PIPE_MAXSTAGES){
+		fprintf(stderr, "! Can't add %s to the pipeline\n", stage.name);
+	}else if(prev == NULL && (stage.in != PIPE_SAMPLES || thread != 0)){
+		fprintf(stderr, "! A pipeline starts with a source on thread 0, not %s\n", stage.name);
+	}else if(prev != NULL && stage.in != prev->out){
+		fprintf(stderr, "! %s takes %s, %s makes %s\n", stage.name, pipeTypeNames[stage.in], prev->name, pipeTypeNames[prev->out]);
+	}else if(prev != NULL && thread < prev->thread){
+		fprintf(stderr, "! %s can't run on thread %i, after %s on %i\n", stage.name, thread, prev->name, prev->thread);
+	}else if(stage.init != NULL && (length = stage.init(&stage, length)) == 0){
+		fprintf(stderr, "! %s can't take %s of %zu\n", stage.name, pipeTypeNames[stage.in], prev != NULL ? prev->length : 0);
+	}else{
+		stage.thread = thread;
+		stage.length = length;
+		p->stages[p->numStages++] = stage;
+		return 1;
+	}
+	
+	if(stage.release != NULL) stage.release(&stage);
+	return 0;
+}
+
+// every stage from t->first on, with in as the input of the first
+static void pipeline_run(struct pipeline * p, struct pipeThread * t, const struct pipeItem * in){
+	struct pipeStage * s;
+	struct pipeItem * out;
+	uint64_t mark;
+	size_t i;
+	int ok;
+	
+	for(i = t->first; i <= t->last; i++){
+		s = p->stages + i;
+		out = p->items + i;
+		if(i == t->last && t->out != NULL){
+			// the pushing thread has no input queue, it's the only one that mustn't wait
+			out = pipeQueue_reserve(t->out, t->in != NULL);
+			if(out == NULL){
+				t->stats->stage[i + 1].drops++;
+				return;
+			}
+		}
+		
+		pipe_carry(in, out);
+		mark = stats_now();
+		ok = s->process(s, in, out);
+		stats_add(t->stats, i + 1, mark);
+		if(!ok) return;
+		in = out;
+	}
+	
+	if(t->out != NULL){
+		ATOMIC_STORE(&t->out->head, t->out->head + 1);
+		t->stats->stage[t->last + 1].depth = t->out->head - ATOMIC_LOAD(&t->out->tail);
+	}
+}
+
+static void * pipeline_thread(void * vdata){
+	struct pipeThread * t = vdata;
+	struct pipeItem * item;
+	
+	while((item = pipeQueue_take(t->in)) != NULL){
+		pipeline_run(t->pipe, t, item);
+		ATOMIC_STORE(&t->in->tail, t->in->tail + 1);
+	}
+	if(t->out != NULL) ATOMIC_STORE(&t->out->closed, 1);
+	
+	return NULL;
+}
+
+/**
+ * Allocate the queues and buffers and start a thread for every thread
+ * number but 0. The counters go to statsPath (for hark-top) or stay in
+ * memory with NULL. Returns 0 if the pipeline doesn't end in a sink, the
+ * stats can't be made or a thread can't be started.
+ */
+int pipeline_start(struct pipeline * p, const char * statsPath){
+	struct pipeThread * t;
+	struct pipeStage * s;
+	const char * names[STATS_MAXSTAGES];
+	size_t i, j;
+	int err;
+	
+	if(p->numStages == 0 || p->stages[p->numStages - 1].out != PIPE_NONE){
+		fprintf(stderr, "! A pipeline ends in a sink\n");
+		return 0;
+	}
+	
+	// split into threads where the thread number changes
+	p->numThreads = 0;
+	for(i = 0; i < p->numStages; i++){
+		if(i == 0 || p->stages[i].thread != p->stages[i - 1].thread){
+			t = p->threads + p->numThreads++;
+			t->pipe = p;
+			t->first = i;
+			t->in = NULL;
+			t->out = NULL;
+		}
+		t->last = i;
+	}
+	
+	// a block of counters per thread
+	names[PIPE_CAPTURE] = "capture";
+	for(i = 0; i < p->numStages; i++) names[i + 1] = p->stages[i].name;
+	p->stats = stats_new(statsPath, p->numThreads, names, p->numStages + 1);
+	if(p->stats == NULL) return 0;
+	for(i = 0; i < p->numThreads; i++) p->threads[i].stats = p->stats->blocks + i;
+	
+	p->queues = fmalloc((p->numThreads > 1 ? p->numThreads - 1 : 1) * sizeof *p->queues);
+	for(i = 0; i < p->numThreads; i++){
+		t = p->threads + i;
+		for(j = t->first; j < t->last; j++){
+			pipe_allocItem(p->items + j, p->stages[j].out, p->stages[j].length);
+		}
+		if(i + 1 < p->numThreads){
+			s = p->stages + t->last;
+			t->out = p->queues + i;
+			p->threads[i + 1].in = t->out;
+			t->out->head = 0;
+			t->out->tail = 0;
+			t->out->closed = 0;
+			for(j = 0; j < PIPE_QUEUE; j++){
+				pipe_allocItem(t->out->items + j, s->out, s->length);
+			}
+		}else{
+			pipe_allocItem(p->items + t->last, PIPE_NONE, 0);
+		}
+	}
+	
+	for(i = 1; i < p->numThreads; i++){
+		if((err = pthread_create(&p->threads[i].thread, NULL, pipeline_thread, p->threads + i)) != 0){
+			fprintf(stderr, "! pthread_create: %s\n", strerror(err));
+			// closing the first queue lets the ones that did start finish one after the other
+			ATOMIC_STORE(&p->queues[0].closed, 1);
+			for(j = 1; j < i; j++){
+				pthread_join(p->threads[j].thread, NULL);
+			}
+			return 0;
+		}
+	}
+	p->running = 1;
+	
+	return 1;
+}
+
+/**
+ * Feed n samples to the source, every hop a frame goes down the pipeline.
+ * Never waits, a frame that doesn't fit in the first queue is dropped.
+ */
+void pipeline_push(struct pipeline * p, const float * in, size_t n){
+	struct pipeSource * src = p->stages[0].state;
+	struct pipeThread * t = p->threads;
+	struct pipeItem item;
+	uint64_t mark = stats_now();
+	size_t chunk, i;
+	
+	memset(&item, 0, sizeof item);
+	while(n > 0){
+		chunk = src->hop - src->since < n ? src->hop - src->since : n;
+		for(i = 0; i < chunk; i++){
+			src->ring[src->head] = in[i];
+			src->head = (src->head + 1) % src->length;
+		}
+		src->since += chunk;
+		src->total += chunk;
+		in += chunk;
+		n -= chunk;
+		
+		if(src->since == src->hop){
+			src->since = 0;
+			if(src->total >= src->length){
+				stats_add(t->stats, PIPE_CAPTURE, mark);
+				pipeline_run(p, t, &item);
+				mark = stats_now();
+			}
+		}
+	}
+	stats_add(t->stats, PIPE_CAPTURE, mark);
+}
+
+// once nothing is pushed anymore: let every thread finish what's queued
+void pipeline_stop(struct pipeline * p){
+	size_t i;
+	
+	if(!p->running) return;
+	if(p->numThreads > 1) ATOMIC_STORE(&p->queues[0].closed, 1);
+	for(i = 1; i < p->numThreads; i++){
+		pthread_join(p->threads[i].thread, NULL);
+	}
+	p->running = 0;
+}
+
+void pipeline_free(struct pipeline * p){
+	size_t i, j;
+	
+	if(p == NULL) return;
+	pipeline_stop(p);
+	for(i = 0; i < p->numStages; i++){
+		if(p->stages[i].release != NULL) p->stages[i].release(p->stages + i);
+		pipe_freeItem(p->items + i);
+	}
+	for(i = 0; i + 1 < p->numThreads; i++){
+		for(j = 0; j < PIPE_QUEUE; j++){
+			pipe_freeItem(p->queues[i].items + j);
+		}
+	}
+	free(p->queues);
+	stats_free(p->stats);
+	free(p);
+}
+
+static void pipe_releaseState(struct pipeStage * s){
+	free(s->state);
+}
+
+// the last length samples, oldest first
+static int pipe_sourceProcess(struct pipeStage * s, const struct pipeItem * in, struct pipeItem * out){
+	struct pipeSource * src = s->state;
+	size_t i, older = src->length - src->head;
+	
+	for(i = 0; i < older; i++){
+		out->samples[i] = src->amplifier * src->ring[src->head + i];
+	}
+	for(i = 0; i < src->head; i++){
+		out->samples[older + i] = src->amplifier * src->ring[i];
+	}
+	out->pos = src->total;
+	out->length = src->length;
+	out->samplerate = src->samplerate;
+	
+	return 1;
+}
+
+static size_t pipe_sourceInit(struct pipeStage * s, size_t length){
+	return ((struct pipeSource *)s->state)->length;
+}
+
+static void pipe_sourceRelease(struct pipeStage * s){
+	struct pipeSource * src = s->state;
+	
+	free(src->ring);
+	free(src);
+}
+
+// a frame of length every hop samples pushed
+struct pipeStage pipe_source(size_t length, size_t hop, int samplerate, double amplifier){
+	struct pipeStage ret = {"source", PIPE_SAMPLES, PIPE_FRAME};
+	struct pipeSource * src = fmalloc(sizeof *src);
+	
+	src->length = length;
+	src->hop = hop > 0 ? hop : length;
+	src->samplerate = samplerate;
+	src->amplifier = amplifier;
+	src->ring = fmalloc(length * sizeof *src->ring);
+	memset(src->ring, 0, length * sizeof *src->ring);
+	src->head = 0;
+	src->since = 0;
+	src->total = 0;
+	
+	ret.init = pipe_sourceInit;
+	ret.process = pipe_sourceProcess;
+	ret.release = pipe_sourceRelease;
+	ret.state = src;
+	
+	return ret;
+}
+
+static int pipe_decimateProcess(struct pipeStage * s, const struct pipeItem * in, struct pipeItem * out){
+	size_t i, j, factor = s->param;
+	double sum;
+	
+	out->length = in->length / factor;
+	out->samplerate = in->samplerate / factor;
+	for(i = 0; i < out->length; i++){
+		sum = 0.0;
+		for(j = 0; j < factor; j++){
+			sum += in->samples[i * factor + j];
+		}
+		out->samples[i] = sum / factor;
+	}
+	
+	return 1;
+}
+
+static size_t pipe_decimateInit(struct pipeStage * s, size_t length){
+	return length / s->param >= 2 ? length / s->param : 0;
+}
+
+// every factor samples averaged into one, a crude lowpass that's enough for whistles below the new Nyquist
+struct pipeStage pipe_decimate(size_t factor){
+	struct pipeStage ret = {"decimate", PIPE_FRAME, PIPE_FRAME};
+	
+	ret.init = pipe_decimateInit;
+	ret.process = pipe_decimateProcess;
+	ret.param = factor > 0 ? factor : 1;
+	
+	return ret;
+}
+
+static int pipe_windowProcess(struct pipeStage * s, const struct pipeItem * in, struct pipeItem * out){
+	const double * window = s->state;
+	size_t i;
+	
+	for(i = 0; i < in->length; i++){
+		out->samples[i] = window[i] * in->samples[i];
+	}
+	
+	return 1;
+}
+
+static size_t pipe_windowInit(struct pipeStage * s, size_t length){
+	double * window = fmalloc(length * sizeof *window);
+	size_t i;
+	
+	for(i = 0; i < length; i++){
+		window[i] = 0.5 - 0.5 * cos(2 * M_PI * (double)i / (double)length);
+	}
+	s->state = window;
+	
+	return length;
+}
+
+// Hann
+struct pipeStage pipe_window(void){
+	struct pipeStage ret = {"window", PIPE_FRAME, PIPE_FRAME};
+	
+	ret.init = pipe_windowInit;
+	ret.process = pipe_windowProcess;
+	ret.release = pipe_releaseState;
+	
+	return ret;
+}
+
+static int pipe_transformProcess(struct pipeStage * s, const struct pipeItem * in, struct pipeItem * out){
+	// the items' buffers are fftw_malloc'ed, aligned like the ones the plan was made with
+	fftw_execute_dft_r2c(s->state, in->samples, out->spectrum);
+	
+	return 1;
+}
+
+// FFTW's planner isn't thread safe, this runs in pipeline_add
+static size_t pipe_transformInit(struct pipeStage * s, size_t length){
+	double * in = fftw_malloc(length * sizeof *in);
+	fftw_complex * out = fftw_malloc((length / 2 + 1) * sizeof *out);
+	
+	if(in == NULL || out == NULL){
+		fprintf(stderr, "! fftw_malloc failed (%zu)\n", length * sizeof *out);
+		exit(EXIT_FAILURE);
+	}
+	s->state = fftw_plan_dft_r2c_1d(length, in, out, FFTW_ESTIMATE);
+	fftw_free(in);
+	fftw_free(out);
+	
+	return length;
+}
+
+static void pipe_transformRelease(struct pipeStage * s){
+	if(s->state != NULL) fftw_destroy_plan(s->state);
+}
+
+struct pipeStage pipe_transform(void){
+	struct pipeStage ret = {"transform", PIPE_FRAME, PIPE_SPECTRUM};
+	
+	ret.init = pipe_transformInit;
+	ret.process = pipe_transformProcess;
+	ret.release = pipe_transformRelease;
+	
+	return ret;
+}
+
+static int pipe_peakProcess(struct pipeStage * s, const struct pipeItem * in, struct pipeItem * out){
+	size_t i = highFreq(in->spectrum, (int)in->length, &out->intens);
+	
+	out->freq = peakInterp(in->spectrum, (int)in->length, i) * in->samplerate / in->length;
+	
+	return 1;
+}
+
+// the loudest bin, interpolated
+struct pipeStage pipe_peak(void){
+	struct pipeStage ret = {"peak", PIPE_SPECTRUM, PIPE_PEAK};
+	
+	ret.process = pipe_peakProcess;
+	
+	return ret;
+}
+
+static int pipe_noteProcess(struct pipeStage * s, const struct pipeItem * in, struct pipeItem * out){
+	out->harmonic = freqToHarmonic(in->freq < 16.0 ? 16.0 : in->freq, NULL);
+	
+	return 1;
+}
+
+struct pipeStage pipe_note(void){
+	struct pipeStage ret = {"note", PIPE_PEAK, PIPE_NOTE};
+	
+	ret.process = pipe_noteProcess;
+	
+	return ret;
+}
+
+static int pipe_sinkProcess(struct pipeStage * s, const struct pipeItem * in, struct pipeItem * out){
+	s->sink(s->user, in);
+	
+	return 1;
+}
+
+// hands every item of type in to sink, the end of a pipeline
+struct pipeStage pipe_sink(enum pipeType in, pipeSink * sink, void * user){
+	struct pipeStage ret = {"sink", PIPE_FRAME, PIPE_NONE};
+	
+	ret.in = in;
+	ret.process = pipe_sinkProcess;
+	ret.sink = sink;
+	ret.user = user;
+	
+	return ret;
+}
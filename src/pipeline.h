@@ -0,0 +1,133 @@
+#ifndef HARK_PIPELINE_H
+#define HARK_PIPELINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include "fftw3.h"
+#include "stats.h"
+
+#define PIPE_MAXSTAGES (STATS_MAXSTAGES - 1) // a counter each, and one for the capture
+#define PIPE_QUEUE 16 // items between two threads
+#define PIPE_IDLE_US 200 // how long a thread waits before looking at a queue again
+
+// what flows from one stage to the next, a stage only takes what the one before it makes
+enum pipeType{
+	PIPE_SAMPLES, // pushed in, only the source takes them
+	PIPE_FRAME, // length samples, oldest first
+	PIPE_SPECTRUM, // length / 2 + 1 bins of a length point FFT
+	PIPE_PEAK, // freq and intens
+	PIPE_NOTE, // harmonic as well
+	PIPE_NONE // a sink's output
+};
+
+extern const char * pipeTypeNames[];
+
+struct pipeItem{
+	size_t pos; // sample (since the start of the stream) just after the frame
+	size_t length;
+	int samplerate; // of the frame, after any decimation
+	double * samples;
+	fftw_complex * spectrum;
+	double freq;
+	double intens;
+	int harmonic;
+};
+
+struct pipeStage;
+
+// turn in into out, returns 0 if there's nothing to pass on this time
+typedef int pipeProcess(struct pipeStage * s, const struct pipeItem * in, struct pipeItem * out);
+
+// get ready for inputs of length, returns the length of the outputs or 0 if it can't take them
+typedef size_t pipeInit(struct pipeStage * s, size_t length);
+
+typedef void pipeSink(void * user, const struct pipeItem * item);
+
+struct pipeStage{
+	const char * name;
+	enum pipeType in;
+	enum pipeType out;
+	int thread; // set by pipeline_add
+	size_t length; // of its outputs, set by pipeline_add
+	
+	pipeInit * init;
+	pipeProcess * process;
+	void (* release)(struct pipeStage * s);
+	void * state;
+	size_t param; // for the constructor to hand to init
+	double value;
+	pipeSink * sink;
+	void * user;
+};
+
+struct pipeQueue{
+	struct pipeItem items[PIPE_QUEUE];
+	size_t head; // items published, only the stage feeding it stores it
+	size_t tail; // items taken, only the stage reading it stores it
+	int closed;
+};
+
+// the stages first..last, run one after the other on one thread
+struct pipeThread{
+	struct pipeline * pipe;
+	size_t first;
+	size_t last;
+	struct pipeQueue * in; // NULL for the thread pushing samples
+	struct pipeQueue * out; // NULL when it ends in a sink
+	struct statsBlock * stats;
+	pthread_t thread;
+};
+
+/**
+ * A chain of stages from a source (fed by pipeline_push, from a capture
+ * callback say) to a sink, each on a thread of its own choosing. Stages on
+ * the same thread as the one before them are called directly, between
+ * threads items go through a bounded lock-free queue. Threads wait when the
+ * queue after them is full, so a slow stage holds back the ones before it
+ * up to the pushing thread, which never waits but drops the frame instead.
+ * Every stage's calls and time are counted in the stats of its thread,
+ * under its name, after the capture (filling the source's ring).
+ * Moving stages to other threads is a matter of the thread numbers given to
+ * pipeline_add, nothing else changes.
+ */
+struct pipeline{
+	size_t numStages;
+	struct pipeStage stages[PIPE_MAXSTAGES];
+	struct pipeItem items[PIPE_MAXSTAGES]; // every stage's output when the next one is on the same thread
+	size_t numThreads;
+	struct pipeThread threads[PIPE_MAXSTAGES];
+	struct pipeQueue * queues; // numThreads - 1
+	struct statsPage * stats;
+	int running;
+};
+
+struct pipeline * pipeline_new(void);
+
+int pipeline_add(struct pipeline * p, struct pipeStage stage, int thread);
+
+int pipeline_start(struct pipeline * p, const char * statsPath);
+
+void pipeline_push(struct pipeline * p, const float * in, size_t n);
+
+void pipeline_stop(struct pipeline * p);
+
+void pipeline_free(struct pipeline * p);
+
+struct pipeStage pipe_source(size_t length, size_t hop, int samplerate, double amplifier);
+
+struct pipeStage pipe_decimate(size_t factor);
+
+struct pipeStage pipe_window(void);
+
+struct pipeStage pipe_transform(void);
+
+struct pipeStage pipe_peak(void);
+
+struct pipeStage pipe_note(void);
+
+struct pipeStage pipe_sink(enum pipeType in, pipeSink * sink, void * user);
+
+#endif
@@ -0,0 +1,132 @@
+#include <string.h>
+#include <math.h>
+
+#include "resample.h"
+#include "util.h"
+
+#ifndef M_PI
+#define M_PI 3.1415926538
+#endif
+
+#define RS_CUT 0.45 // of the lower Nyquist, the rest is left for the filter to roll off
+
+static size_t gcd(size_t a, size_t b){
+	size_t t;
+	
+	while(b != 0){
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	
+	return a;
+}
+
+// returns NULL if either rate is nonsense
+struct resampler * resampler_new(int inRate, int outRate){
+	struct resampler * ret;
+	size_t g, n, k, p, length;
+	double cut, x, sum, * h;
+	
+	if(inRate < 1 || outRate < 1){
+		fprintf(stderr, "! Can't resample from %i Hz to %i Hz\n", inRate, outRate);
+		return NULL;
+	}
+	
+	ret = fmalloc(sizeof *ret);
+	g = gcd(inRate, outRate);
+	ret->inRate = inRate;
+	ret->outRate = outRate;
+	ret->up = outRate / g;
+	ret->down = inRate / g;
+	// going down the cut off is lower, so the filter is longer by as much
+	ret->taps = (size_t)ceil(RS_TAPS * (ret->down > ret->up ? (double)ret->down / ret->up : 1.0));
+	ret->taps = (ret->taps + RS_LANES - 1) / RS_LANES * RS_LANES;
+	
+	// the prototype at the upsampled rate
+	length = ret->up * ret->taps;
+	h = fmalloc(length * sizeof *h);
+	cut = RS_CUT / (ret->up > ret->down ? ret->up : ret->down);
+	for(n = 0; n < length; n++){
+		x = (double)n - (length - 1) / 2.0;
+		h[n] = x == 0.0 ? 2.0 * cut : sin(2.0 * M_PI * cut * x) / (M_PI * x);
+		h[n] *= 0.42 - 0.5 * cos(2.0 * M_PI * n / (length - 1)) + 0.08 * cos(4.0 * M_PI * n / (length - 1));
+	}
+	
+	// phase p is every up-th tap from p, reversed so it lines up with the input, each with a gain of 1
+	ret->bank = fmalloc(length * sizeof *ret->bank);
+	for(p = 0; p < ret->up; p++){
+		sum = 0.0;
+		for(k = 0; k < ret->taps; k++){
+			sum += h[(ret->taps - 1 - k) * ret->up + p];
+		}
+		for(k = 0; k < ret->taps; k++){
+			ret->bank[p * ret->taps + k] = h[(ret->taps - 1 - k) * ret->up + p] / sum;
+		}
+	}
+	free(h);
+	
+	// starts from silence
+	ret->buf = fmalloc((ret->taps - 1 + RS_CHUNK) * sizeof *ret->buf);
+	ret->have = ret->taps - 1;
+	memset(ret->buf, 0, ret->have * sizeof *ret->buf);
+	ret->pos = 0;
+	
+	return ret;
+}
+
+void resampler_free(struct resampler * r){
+	if(r == NULL) return;
+	free(r->bank);
+	free(r->buf);
+	free(r);
+}
+
+// the most outputs n inputs can make, what out has to have room for
+size_t resampler_maxOut(const struct resampler * r, size_t n){
+	return n * r->up / r->down + 1;
+}
+
+// in RS_LANES partial sums, so GCC keeps a vector of them without reassociating a single sum
+static float resampler_dot(const float * restrict h, const float * restrict x, size_t taps){
+	float acc[RS_LANES] = {0.0f};
+	size_t k, l;
+	
+	for(k = 0; k < taps; k += RS_LANES){
+		for(l = 0; l < RS_LANES; l++) acc[l] += h[k + l] * x[k + l];
+	}
+	for(l = 1; l < RS_LANES; l++) acc[0] += acc[l];
+	
+	return acc[0];
+}
+
+/**
+ * Take n input samples, write every output sample they complete to out
+ * (which has room for resampler_maxOut of them), returns how many.
+ */
+size_t resampler_process(struct resampler * r, const float * in, size_t n, float * out){
+	size_t produced = 0, chunk, i;
+	
+	while(n > 0){
+		chunk = n < RS_CHUNK ? n : RS_CHUNK;
+		memcpy(r->buf + r->have, in, chunk * sizeof *in);
+		r->have += chunk;
+		in += chunk;
+		n -= chunk;
+		
+		// every output that has all its taps
+		while((i = r->pos / r->up) + r->taps <= r->have){
+			out[produced++] = resampler_dot(r->bank + (r->pos % r->up) * r->taps, r->buf + i, r->taps);
+			r->pos += r->down;
+		}
+		
+		// keep what the next output still needs, going down it may need none of it
+		i = r->pos / r->up;
+		if(i > r->have) i = r->have;
+		memmove(r->buf, r->buf + i, (r->have - i) * sizeof *r->buf);
+		r->have -= i;
+		r->pos -= i * r->up;
+	}
+	
+	return produced;
+}
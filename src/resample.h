@@ -0,0 +1,43 @@
+#ifndef HARK_RESAMPLE_H
+#define HARK_RESAMPLE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RS_TAPS 32 // filter taps per output sample when upsampling, more when going down
+#define RS_LANES 8 // the taps of a phase are padded to a multiple of this, a dot product runs in as many lanes
+#define RS_CHUNK 1024 // input samples taken in at a time
+
+/**
+ * Streaming polyphase resampler from one samplerate to another, by the
+ * ratio up / down in lowest terms: conceptually the input is stuffed with
+ * up - 1 zeros, low-pass filtered and every down-th sample kept, but only
+ * the kept samples are computed and only from the taps that don't meet a
+ * zero. Those taps are the up phases of one Blackman windowed sinc (cut off
+ * below the lower of the two Nyquists), each stored in order against the
+ * input so an output is one contiguous dot product.
+ * Processing doesn't allocate, the input is taken RS_CHUNK at a time behind
+ * the history the filter still needs.
+ */
+struct resampler{
+	int inRate;
+	int outRate;
+	size_t up;
+	size_t down;
+	size_t taps; // per phase, a multiple of RS_LANES
+	float * bank; // up * taps
+	
+	float * buf; // taps - 1 samples of history, then up to RS_CHUNK new ones
+	size_t have; // samples in buf
+	size_t pos; // of the next output in buf, in 1 / up samples
+};
+
+struct resampler * resampler_new(int inRate, int outRate);
+
+void resampler_free(struct resampler * r);
+
+size_t resampler_maxOut(const struct resampler * r, size_t n);
+
+size_t resampler_process(struct resampler * r, const float * in, size_t n, float * out);
+
+#endif
@@ -0,0 +1,118 @@
+#ifdef __linux__
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <sched.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "rt.h"
+#include "util.h"
+
+#define RT_PAGE 4096 // the smallest page there is, touching one byte every RT_PAGE is enough
+#define RT_WARN_PIN 1
+#define RT_WARN_FIFO 2
+#define RT_WARN_LOCK 4
+
+void rt_init(struct rtOptions * o){
+	memset(o, 0, sizeof *o);
+}
+
+// only the first failure of each kind is reported, it's the same story for every thread
+static void rt_warn(struct rtOptions * o, int kind, const char * what, int err){
+	int warned = ATOMIC_LOAD(&o->warned);
+	
+	if(warned & kind) return;
+	ATOMIC_STORE(&o->warned, warned | kind);
+	fprintf(stderr, "! %s: %s, running without\n", what, strerror(err));
+}
+
+// "2,3" (or "-" for none) into the cores threads are pinned to, returns 0 if it's not a list of them
+int rt_parseCpus(struct rtOptions * o, const char * list){
+	char * end;
+	long cpu;
+	
+	o->numCpus = 0;
+	if(strcmp(list, "-") == 0) return 1;
+	while(o->numCpus < RT_MAXCPUS){
+		cpu = strtol(list, &end, 10);
+		if(end == list || cpu < 0) return 0;
+		o->cpus[o->numCpus++] = cpu;
+		if(*end != ',') break;
+		list = end + 1;
+	}
+	
+	return *end == '\0';
+}
+
+/**
+ * Make the calling thread the n-th realtime one: pin it to the n-th core of
+ * the list (round robin) and give it SCHED_FIFO at the priority plus boost
+ * (the audio thread has to preempt the ones it feeds). Also touches RT_STACK
+ * of its stack. Returns 0 if anything wasn't permitted, the thread carries
+ * on as it was.
+ */
+int rt_thread(struct rtOptions * o, size_t n, int boost){
+	volatile char stack[RT_STACK];
+	struct sched_param param;
+	size_t i;
+	int err, ok = 1;
+	
+	for(i = 0; i < sizeof stack; i += RT_PAGE){
+		stack[i] = 0;
+	}
+	
+	if(o->numCpus > 0){
+#ifdef __linux__
+		cpu_set_t set;
+		
+		CPU_ZERO(&set);
+		CPU_SET(o->cpus[n % o->numCpus], &set);
+		if((err = pthread_setaffinity_np(pthread_self(), sizeof set, &set)) != 0){
+			rt_warn(o, RT_WARN_PIN, "Can't pin threads to cores", err);
+			ok = 0;
+		}
+#else
+		rt_warn(o, RT_WARN_PIN, "Can't pin threads to cores", ENOSYS);
+		ok = 0;
+#endif
+	}
+	
+	if(o->priority > 0){
+		memset(&param, 0, sizeof param);
+		param.sched_priority = o->priority + boost;
+		if(param.sched_priority > sched_get_priority_max(SCHED_FIFO)) param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+		if((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0){
+			rt_warn(o, RT_WARN_FIFO, "Can't use SCHED_FIFO", err);
+			ok = 0;
+		}
+	}
+	
+	return ok;
+}
+
+/**
+ * Lock every page the process has mapped (faulting them in), and with
+ * future everything it maps from now on. Locking the future makes every new
+ * thread's whole stack count against RLIMIT_MEMLOCK, so it's best done once
+ * the threads are running. Returns 0 if it wasn't permitted.
+ */
+int rt_lock(struct rtOptions * o, int future){
+	if(!o->lock) return 1;
+#ifdef _WIN32
+	rt_warn(o, RT_WARN_LOCK, "Can't lock memory", ENOSYS);
+	return 0;
+#else
+	if(mlockall(MCL_CURRENT | (future ? MCL_FUTURE : 0)) != 0){
+		rt_warn(o, RT_WARN_LOCK, "Can't lock memory", errno);
+		return 0;
+	}
+	
+	return 1;
+#endif
+}
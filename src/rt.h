@@ -0,0 +1,33 @@
+#ifndef HARK_RT_H
+#define HARK_RT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RT_MAXCPUS 64
+#define RT_STACK (64 * 1024) // of every thread touched up front, so its first frames don't fault it in
+
+/**
+ * What a live program asks of the OS to keep its latency down: SCHED_FIFO
+ * for its threads, each thread on a core of its own choosing, and its memory
+ * locked so nothing faults once it runs. Anything the OS doesn't permit (no
+ * CAP_SYS_NICE, a low RLIMIT_MEMLOCK, another platform) is reported once and
+ * otherwise ignored: the program runs as it would without.
+ */
+struct rtOptions{
+	int priority; // SCHED_FIFO priority, 0 leaves the scheduling alone
+	int cpus[RT_MAXCPUS]; // handed out to threads in turn
+	size_t numCpus; // 0 doesn't pin
+	int lock; // mlockall
+	int warned; // the kinds of failure reported so far
+};
+
+void rt_init(struct rtOptions * o);
+
+int rt_parseCpus(struct rtOptions * o, const char * list);
+
+int rt_thread(struct rtOptions * o, size_t n, int boost);
+
+int rt_lock(struct rtOptions * o, int future);
+
+#endif
@@ -0,0 +1,183 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "score.h"
+
+static int notePosCmp(const void * va, const void * vb){
+	const struct noteParams * a = va, * b = vb;
+	
+	return (a->pos > b->pos) - (a->pos < b->pos);
+}
+
+// copies the notes, they don't have to be in order
+struct score * score_new(const struct noteParams * notes, size_t length, int samplerate){
+	struct score * ret = smalloc(sizeof *ret);
+	size_t i, death;
+	
+	ret->samplerate = samplerate;
+	ret->length = length;
+	ret->notes = smalloc((length ? length : 1) * sizeof *ret->notes);
+	ret->maxLife = 0;
+	ret->end = 0;
+	
+	memcpy(ret->notes, notes, length * sizeof *notes);
+	qsort(ret->notes, length, sizeof *ret->notes, notePosCmp);
+	
+	for(i = 0; i < length; i++){
+		death = voices_deathOf(ret->notes + i, samplerate);
+		if(death - ret->notes[i].pos > ret->maxLife) ret->maxLife = death - ret->notes[i].pos;
+		if(death > ret->end) ret->end = death;
+	}
+	
+	return ret;
+}
+
+struct score * score_load(const char * fileName, int samplerate){
+	FILE * fp = fopen(fileName, "r");
+	struct score * ret;
+	struct noteParams * notes;
+	size_t length = 0, cap = 64, lineNo = 0;
+	char line[256];
+	double start, dur;
+	
+	if(fp == NULL){
+		fprintf(stderr, "! Can't open score: %s\n", fileName);
+		return NULL;
+	}
+	
+	notes = smalloc(cap * sizeof *notes);
+	
+	while(fgets(line, sizeof line, fp) != NULL){
+		lineNo++;
+		if(line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') continue;
+		
+		if(length == cap){
+			cap *= 2;
+			notes = realloc(notes, cap * sizeof *notes);
+			if(notes == NULL){
+				fprintf(stderr, "! realloc failed (%zu)\n", cap * sizeof *notes);
+				exit(EXIT_FAILURE);
+			}
+		}
+		
+		dur = 0.0;
+		if(sscanf(line, "%lf %lf %lf %lf %lf", &start, &notes[length].f, &notes[length].a, &notes[length].g, &dur) < 4 || start < 0.0 || dur < 0.0){
+			fprintf(stderr, "! %s:%zu: expected <start> <frequency> <amplitude> <decay> [duration]\n", fileName, lineNo);
+			free(notes);
+			fclose(fp);
+			return NULL;
+		}
+		if(notes[length].f < 0.0 || notes[length].g <= 0.0){
+			fprintf(stderr, "! %s:%zu: %s\n", fileName, lineNo, notes[length].g <= 0.0 ? "decay must be positive" : "frequency can't be negative");
+			free(notes);
+			fclose(fp);
+			return NULL;
+		}
+		notes[length].pos = start * samplerate + 0.5;
+		notes[length].len = dur * samplerate + 0.5;
+		length++;
+	}
+	
+	fclose(fp);
+	
+	ret = score_new(notes, length, samplerate);
+	free(notes);
+	
+	return ret;
+}
+
+void score_free(struct score * s){
+	if(s == NULL) return;
+	free(s->notes);
+	free(s);
+}
+
+struct sched * sched_new(const struct score * score, size_t maxVoices){
+	struct sched * ret = smalloc(sizeof *ret);
+	
+	ret->score = score;
+	ret->voices = voices_new(maxVoices, score->samplerate);
+	ret->next = 0;
+	ret->position = 0;
+	ret->maxVoices = 0;
+	ret->dropped = 0;
+	
+	return ret;
+}
+
+void sched_free(struct sched * s){
+	if(s == NULL) return;
+	voices_free(s->voices);
+	free(s);
+}
+
+// first note with pos >= position
+static size_t score_find(const struct score * s, size_t position){
+	size_t lo = 0, hi = s->length, mid;
+	
+	while(lo < hi){
+		mid = lo + (hi - lo) / 2;
+		if(s->notes[mid].pos < position){
+			lo = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+	
+	return lo;
+}
+
+static void sched_activate(struct sched * s, const struct noteParams * note){
+	if(!voices_add(s->voices, note)) s->dropped++;
+}
+
+/**
+ * Jump to position: only the notes that can still be sounding there are
+ * looked at, which is at most maxLife samples worth of score.
+ */
+void sched_seek(struct sched * s, size_t position){
+	const struct score * score = s->score;
+	size_t i;
+	
+	voices_clear(s->voices);
+	s->position = position;
+	s->next = score_find(score, position);
+	
+	i = position > score->maxLife ? score_find(score, position - score->maxLife) : 0;
+	for(; i < s->next; i++){
+		if(voices_deathOf(score->notes + i, score->samplerate) > position){
+			sched_activate(s, score->notes + i);
+		}
+	}
+}
+
+/**
+ * Renders the next frames samples into out (overwriting it). All notes
+ * starting within the block are activated up front, the block is then
+ * rendered in pieces split at their start offsets so they start on the
+ * exact sample (voices_render splits at where they end).
+ */
+void sched_render(struct sched * s, float * out, size_t frames){
+	const struct score * score = s->score;
+	size_t i, j, end = s->position + frames, first = s->next;
+	
+	for(i = 0; i < frames; i++){
+		out[i] = 0.0;
+	}
+	
+	while(s->next < score->length && score->notes[s->next].pos < end){
+		sched_activate(s, score->notes + s->next);
+		s->next++;
+	}
+	
+	for(i = 0; i < frames; i = j){
+		while(first < s->next && score->notes[first].pos <= s->position + i) first++;
+		
+		j = first < s->next ? score->notes[first].pos - s->position : frames;
+		voices_render(s->voices, out + i, j - i, s->position + i);
+		
+		if(s->voices->count > s->maxVoices) s->maxVoices = s->voices->count;
+	}
+	
+	s->position = end;
+}
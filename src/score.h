@@ -0,0 +1,44 @@
+#ifndef HARK_SCORE_H
+#define HARK_SCORE_H
+
+#include "synth.h"
+
+/**
+ * A score is the time-ordered event queue for the scheduler: notes sorted by
+ * pos. Score files have one note per line:
+ *   <start in seconds> <frequency in Hz> <amplitude> <decay rate> [duration in seconds]
+ * Empty lines and lines starting with '#' are skipped.
+ */
+struct score{
+	int samplerate;
+	size_t length;
+	struct noteParams * notes;
+	size_t maxLife; // longest time any note sounds, in samples
+	size_t end; // sample at which the last note has died out
+};
+
+struct sched{
+	const struct score * score;
+	struct voices * voices;
+	size_t next; // first note that hasn't been activated yet
+	size_t position;
+	
+	size_t maxVoices;
+	size_t dropped;
+};
+
+struct score * score_new(const struct noteParams * notes, size_t length, int samplerate);
+
+struct score * score_load(const char * fileName, int samplerate);
+
+void score_free(struct score * s);
+
+struct sched * sched_new(const struct score * score, size_t maxVoices);
+
+void sched_free(struct sched * s);
+
+void sched_seek(struct sched * s, size_t position);
+
+void sched_render(struct sched * s, float * out, size_t frames);
+
+#endif
@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "stats.h"
+#include "util.h"
+
+const char * stageNames[NUM_STAGES] = {"capture", "ring", "fft", "peak", "note", "output"};
+
+/**
+ * numBlocks zeroed counter blocks, shared through the file at path (created
+ * or truncated) or private when path is NULL. The counters are called names
+ * (numStages of them), or with NULL they're the analyzer's stageNames.
+ * Returns NULL if the file can't be made.
+ */
+struct statsPage * stats_new(const char * path, size_t numBlocks, const char * const * names, size_t numStages){
+	size_t size = sizeof(struct statsPage) + numBlocks * sizeof(struct statsBlock);
+	struct statsPage * ret;
+	struct timespec ts;
+	size_t i;
+	int fd;
+	
+	if(names == NULL){
+		names = stageNames;
+		numStages = NUM_STAGES;
+	}
+	if(numStages > STATS_MAXSTAGES){
+		fprintf(stderr, "! %zu counters, at most %i\n", numStages, STATS_MAXSTAGES);
+		return NULL;
+	}
+	
+	if(path == NULL){
+		ret = fmalloc(size);
+		memset(ret, 0, size);
+	}else{
+#ifdef _WIN32
+		fprintf(stderr, "! stats file %s: needs mmap\n", path);
+		return NULL;
+#else
+		fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0 || ftruncate(fd, size) < 0){
+			fprintf(stderr, "! stats file %s: %s\n", path, strerror(errno));
+			if(fd >= 0) close(fd);
+			return NULL;
+		}
+		ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if(ret == MAP_FAILED){
+			fprintf(stderr, "! mmap %s: %s\n", path, strerror(errno));
+			return NULL;
+		}
+#endif
+	}
+	
+	ret->version = STATS_VERSION;
+	ret->numBlocks = numBlocks;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ret->started = (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+	ret->pid = getpid();
+	ret->size = size;
+	ret->mapped = path != NULL;
+	ret->numStages = numStages;
+	memset(ret->names, 0, sizeof ret->names);
+	for(i = 0; i < numStages; i++){
+		strncpy(ret->names[i], names[i], STATS_NAME - 1);
+	}
+	// last, so a reader never sees the magic on a page that isn't filled in
+	memcpy(ret->magic, STATS_MAGIC, sizeof ret->magic);
+	
+	return ret;
+}
+
+// map somebody else's page read only, NULL if it isn't one
+struct statsPage * stats_open(const char * path){
+#ifdef _WIN32
+	fprintf(stderr, "! stats file %s: needs mmap\n", path);
+	return NULL;
+#else
+	struct statsPage * ret;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	
+	if(fd < 0 || fstat(fd, &st) < 0){
+		fprintf(stderr, "! stats file %s: %s\n", path, strerror(errno));
+		if(fd >= 0) close(fd);
+		return NULL;
+	}
+	if((size_t)st.st_size < sizeof *ret){
+		fprintf(stderr, "! %s isn't a stats file\n", path);
+		close(fd);
+		return NULL;
+	}
+	ret = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(ret == MAP_FAILED){
+		fprintf(stderr, "! mmap %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	// a page is exactly its header and blocks, anything else would be read past its end
+	if(memcmp(ret->magic, STATS_MAGIC, sizeof ret->magic) != 0 || ret->version != STATS_VERSION || ret->numStages > STATS_MAXSTAGES
+		|| ret->size != (uint64_t)st.st_size || ret->size != sizeof *ret + (uint64_t)ret->numBlocks * sizeof(struct statsBlock)){
+		fprintf(stderr, "! %s isn't a version %i stats file\n", path, STATS_VERSION);
+		munmap(ret, st.st_size);
+		return NULL;
+	}
+	
+	return ret;
+#endif
+}
+
+void stats_free(struct statsPage * p){
+	if(p == NULL) return;
+	if(p->mapped){
+#ifndef _WIN32
+		munmap(p, p->size);
+#endif
+	}else{
+		free(p);
+	}
+}
+
+// n threads' counters added up, the max is the largest of any
+void stats_sum(const struct statsBlock * blocks, size_t n, struct statsBlock * total){
+	const struct stageCounter * c;
+	struct stageCounter * t;
+	size_t i, s;
+	
+	memset(total, 0, sizeof *total);
+	for(i = 0; i < n; i++){
+		for(s = 0; s < STATS_MAXSTAGES; s++){
+			c = blocks[i].stage + s;
+			t = total->stage + s;
+			t->calls += c->calls;
+			t->totalNs += c->totalNs;
+			if(c->maxNs > t->maxNs) t->maxNs = c->maxNs;
+			t->depth += c->depth;
+			t->drops += c->drops;
+		}
+	}
+}
+
+uint64_t stats_now(void){
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Count a call of stage s (an enum stage, or whatever the page's names
+ * say) that started at start (a stats_now()), returns now so the next stage
+ * can start where this one ended.
+ */
+uint64_t stats_add(struct statsBlock * b, size_t s, uint64_t start){
+	uint64_t now = stats_now(), dt = now - start;
+	struct stageCounter * c = b->stage + s;
+	
+	c->calls++;
+	c->totalNs += dt;
+	if(dt > c->maxNs) c->maxNs = dt;
+	
+	return now;
+}
@@ -0,0 +1,73 @@
+#ifndef HARK_STATS_H
+#define HARK_STATS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define STATS_MAGIC "harkstat"
+#define STATS_VERSION 2
+#define STATS_MAXSTAGES 16 // counters per thread
+#define STATS_NAME 16 // bytes of a counter's name
+
+// where a sample spends its time on the way from the capture to a result, the analyzer's counters
+enum stage{
+	STAGE_CAPTURE, // getting samples from the source (recv, a capture callback)
+	STAGE_RING, // copying them into the ring and gating
+	STAGE_FFT, // window and transform
+	STAGE_PEAK, // peak picking or partial tracking
+	STAGE_NOTE, // mapping to notes and smoothing
+	STAGE_OUTPUT, // formatting and sending results
+	NUM_STAGES
+};
+
+extern const char * stageNames[NUM_STAGES];
+
+struct stageCounter{
+	uint64_t calls;
+	uint64_t totalNs;
+	uint64_t maxNs;
+	uint64_t depth; // of the queue in front of the stage when last seen
+	uint64_t drops;
+};
+
+// one per thread and only written by it, 640 bytes so threads don't share cache lines
+struct statsBlock{
+	struct stageCounter stage[STATS_MAXSTAGES];
+};
+
+/**
+ * Counters of every thread of a program, in a file other processes can map
+ * (or in plain memory without one). Writers just add to their own block, a
+ * reader like hark-top takes the difference between two looks. 64 bit
+ * counters can't tear on the machines we run on, so there's no locking.
+ * The first numStages counters of every block are in use, names says what
+ * they count.
+ */
+struct statsPage{
+	char magic[8];
+	uint32_t version;
+	uint32_t numBlocks;
+	uint64_t started; // CLOCK_REALTIME ns
+	int64_t pid;
+	uint64_t size; // of the whole page
+	uint64_t mapped; // it's in a file, not plain memory
+	uint64_t numStages;
+	uint64_t pad;
+	char names[STATS_MAXSTAGES][STATS_NAME];
+	struct statsBlock blocks[];
+};
+
+struct statsPage * stats_new(const char * path, size_t numBlocks, const char * const * names, size_t numStages);
+
+struct statsPage * stats_open(const char * path);
+
+void stats_free(struct statsPage * p);
+
+void stats_sum(const struct statsBlock * blocks, size_t n, struct statsBlock * total);
+
+uint64_t stats_now(void);
+
+uint64_t stats_add(struct statsBlock * b, size_t s, uint64_t start);
+
+#endif
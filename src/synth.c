@@ -0,0 +1,200 @@
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "synth.h"
+
+#ifndef M_PI
+#define M_PI 3.1415926538
+#endif
+
+// synth doesn't link util.o (and so FFTW), hence its own checked malloc
+void * smalloc(size_t n){
+	void * p = malloc(n);
+	if(p == NULL){
+		fprintf(stderr, "! malloc failed (%zu)\n", n);
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+struct voices * voices_new(size_t length, int samplerate){
+	struct voices * ret = smalloc(sizeof *ret);
+	size_t i;
+	
+	length = (length + SYNTH_LANES - 1) / SYNTH_LANES * SYNTH_LANES;
+	
+	ret->samplerate = samplerate;
+	ret->length = length;
+	ret->count = 0;
+	ret->a = smalloc(length * sizeof *ret->a);
+	ret->g = smalloc(length * sizeof *ret->g);
+	ret->f = smalloc(length * sizeof *ret->f);
+	ret->pos = smalloc(length * sizeof *ret->pos);
+	ret->death = smalloc(length * sizeof *ret->death);
+	ret->re = smalloc(length * sizeof *ret->re);
+	ret->im = smalloc(length * sizeof *ret->im);
+	ret->cr = smalloc(length * sizeof *ret->cr);
+	ret->ci = smalloc(length * sizeof *ret->ci);
+	
+	for(i = 0; i < length; i++){
+		ret->re[i] = ret->im[i] = ret->cr[i] = ret->ci[i] = 0.0;
+	}
+	
+	return ret;
+}
+
+void voices_free(struct voices * v){
+	if(v == NULL) return;
+	free(v->a);
+	free(v->g);
+	free(v->f);
+	free(v->pos);
+	free(v->death);
+	free(v->re);
+	free(v->im);
+	free(v->cr);
+	free(v->ci);
+	free(v);
+}
+
+void voices_clear(struct voices * v){
+	size_t i;
+	
+	for(i = 0; i < v->length; i++){
+		v->re[i] = v->im[i] = v->cr[i] = v->ci[i] = 0.0;
+	}
+	v->count = 0;
+}
+
+/**
+ * a * e^(-g * t) < EPSILON
+ * t > ln(a / EPSILON) / g
+ */
+size_t voices_deathOf(const struct noteParams * note, int samplerate){
+	size_t death = SIZE_MAX;
+	
+	if(note->a <= AMPLITUDEEPSILON) return note->pos;
+	if(note->g > 0.0) death = note->pos + (size_t)ceil(log(note->a / AMPLITUDEEPSILON) / note->g * (double)samplerate);
+	if(note->len > 0 && note->pos + note->len < death) death = note->pos + note->len;
+	
+	return death;
+}
+
+// returns 0 when there's no room left, the note is dropped then
+int voices_add(struct voices * v, const struct noteParams * note){
+	size_t n = v->count;
+	double d, w;
+	
+	if(n == v->length) return 0;
+	
+	d = exp(-note->g / (double)v->samplerate);
+	w = 2 * M_PI * note->f / (double)v->samplerate;
+	
+	v->a[n] = note->a;
+	v->g[n] = note->g;
+	v->f[n] = note->f;
+	v->pos[n] = note->pos;
+	v->death[n] = voices_deathOf(note, v->samplerate);
+	v->cr[n] = d * cos(w);
+	v->ci[n] = d * sin(w);
+	v->count++;
+	
+	return 1;
+}
+
+static void voices_move(struct voices * v, size_t to, size_t from){
+	v->a[to] = v->a[from];
+	v->g[to] = v->g[from];
+	v->f[to] = v->f[from];
+	v->pos[to] = v->pos[from];
+	v->death[to] = v->death[from];
+	v->cr[to] = v->cr[from];
+	v->ci[to] = v->ci[from];
+}
+
+// drop every voice that has died out by position, returns how many are left
+size_t voices_retire(struct voices * v, size_t position){
+	size_t i = 0;
+	
+	while(i < v->count){
+		if(v->death[i] <= position){
+			v->count--;
+			voices_move(v, i, v->count);
+			// the freed lane must stay silent
+			v->re[v->count] = v->im[v->count] = 0.0;
+			v->cr[v->count] = v->ci[v->count] = 0.0;
+		}else{
+			i++;
+		}
+	}
+	
+	return v->count;
+}
+
+// (re)start the phasors from the closed form, so rounding doesn't pile up
+static void voices_sync(struct voices * v, size_t position){
+	size_t i;
+	double t, amp, phase;
+	
+	for(i = 0; i < v->count; i++){
+		if(position < v->pos[i]){
+			v->re[i] = v->im[i] = 0.0;
+			continue;
+		}
+		t = (double)(position - v->pos[i]) / (double)v->samplerate;
+		amp = v->a[i] * exp(-v->g[i] * t);
+		phase = 2 * M_PI * fmod(v->f[i] * t, 1.0);
+		v->re[i] = amp * cos(phase);
+		v->im[i] = amp * sin(phase);
+	}
+}
+
+// mixes the voices into out for a piece no voice dies in
+static void voices_mix(struct voices * v, float * out, size_t frames, size_t position){
+	double re[SYNTH_LANES], im[SYNTH_LANES], cr[SYNTH_LANES], ci[SYNTH_LANES];
+	double acc, t;
+	size_t i, j, l;
+	
+	voices_sync(v, position);
+	
+	for(j = 0; j < v->count; j += SYNTH_LANES){
+		memcpy(re, v->re + j, sizeof re);
+		memcpy(im, v->im + j, sizeof im);
+		memcpy(cr, v->cr + j, sizeof cr);
+		memcpy(ci, v->ci + j, sizeof ci);
+		
+		for(i = 0; i < frames; i++){
+			acc = 0.0;
+			for(l = 0; l < SYNTH_LANES; l++){
+				acc += im[l];
+			}
+			for(l = 0; l < SYNTH_LANES; l++){
+				t = re[l] * cr[l] - im[l] * ci[l];
+				im[l] = re[l] * ci[l] + im[l] * cr[l];
+				re[l] = t;
+			}
+			out[i] += acc;
+		}
+	}
+}
+
+/**
+ * Mixes all voices into out (which is added to, not overwritten).
+ * No transcendental calls per sample: every voice is just a complex multiply.
+ * The frames are mixed in pieces that end where a voice dies, so a note cut
+ * off after its len stops on the exact sample.
+ */
+void voices_render(struct voices * v, float * out, size_t frames, size_t position){
+	size_t done, n, next, i;
+	
+	for(done = 0; done < frames; done += n){
+		voices_retire(v, position + done);
+		next = position + frames;
+		for(i = 0; i < v->count; i++){
+			if(v->death[i] < next) next = v->death[i];
+		}
+		n = next - (position + done);
+		voices_mix(v, out + done, n, position + done);
+	}
+}
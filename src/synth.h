@@ -0,0 +1,61 @@
+#ifndef HARK_SYNTH_H
+#define HARK_SYNTH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// voices are mixed this many at a time, keep it a multiple of the SIMD width
+#define SYNTH_LANES 8
+
+#define AMPLITUDEEPSILON 1e-6
+
+struct noteParams{
+	double a; // initial amplitude
+	double g; // decay rate
+	double f; // frequency
+	
+	size_t pos;
+	size_t len; // cut the note off after this many samples, 0 lets it ring out
+};
+
+/**
+ * Every voice is a single damped partial: a * e^(-g * t) * sin(2 * pi * f * t)
+ * which is the imaginary part of a phasor that gets multiplied by
+ * e^(-g / sr) * e^(i * 2 * pi * f / sr) every sample.
+ * Voices are stored as structure-of-arrays so they can be mixed SYNTH_LANES
+ * at a time.
+ */
+struct voices{
+	int samplerate;
+	size_t length; // capacity, a multiple of SYNTH_LANES
+	size_t count;
+	
+	double * a;
+	double * g;
+	double * f;
+	size_t * pos;
+	size_t * death; // first sample where the voice is below AMPLITUDEEPSILON
+	
+	double * re; // phasor
+	double * im;
+	double * cr; // per-sample rotation and decay
+	double * ci;
+};
+
+void * smalloc(size_t n);
+
+struct voices * voices_new(size_t length, int samplerate);
+
+void voices_free(struct voices * v);
+
+void voices_clear(struct voices * v);
+
+size_t voices_deathOf(const struct noteParams * note, int samplerate);
+
+int voices_add(struct voices * v, const struct noteParams * note);
+
+size_t voices_retire(struct voices * v, size_t position);
+
+void voices_render(struct voices * v, float * out, size_t frames, size_t position);
+
+#endif
@@ -0,0 +1,210 @@
+#include <string.h>
+
+#include "trace.h"
+#include "stats.h"
+#include "util.h"
+
+#define TRACE_IDLE 10 // ms the writer sleeps when it has caught up
+
+// copy n bytes into the ring at pos (which may wrap), returns the position after them
+static size_t trace_put(struct traceTap * t, size_t pos, const void * src, size_t n){
+	size_t at = pos % TRACE_RING, first = n < TRACE_RING - at ? n : TRACE_RING - at;
+	
+	memcpy(t->ring + at, src, first);
+	memcpy(t->ring, (const unsigned char *)src + first, n - first);
+	
+	return pos + n;
+}
+
+static void * trace_writer(void * vdata){
+	struct traceTap * t = vdata;
+	size_t head, at, n;
+	int closed, failed = 0;
+	
+	while(1){
+		// closed is stored after the last head, so once it's seen head is final
+		closed = ATOMIC_LOAD(&t->closed);
+		head = ATOMIC_LOAD(&t->head);
+		if(head == t->tail){
+			if(closed) break;
+			Pa_Sleep(TRACE_IDLE);
+			continue;
+		}
+		
+		at = t->tail % TRACE_RING;
+		n = head - t->tail < TRACE_RING - at ? head - t->tail : TRACE_RING - at;
+		// after a failed write keep emptying the ring, the callback mustn't notice
+		if(!failed && fwrite(t->ring + at, 1, n, t->fp) != n){
+			fprintf(stderr, "! Can't write trace, it stops here\n");
+			failed = 1;
+		}
+		ATOMIC_STORE(&t->tail, t->tail + n);
+	}
+	
+	return NULL;
+}
+
+/**
+ * Record every call of callback (which gets user) into the trace file at
+ * path: open the stream with trace_callback and the returned tap instead.
+ * Returns NULL if the file can't be made or its writer can't be started.
+ */
+struct traceTap * trace_create(const char * path, int samplerate, int channels, PaStreamCallback * callback, void * user){
+	struct traceTap * ret = fmalloc(sizeof *ret);
+	
+	ret->fp = fopen(path, "wb");
+	if(ret->fp == NULL){
+		fprintf(stderr, "! Can't open %s for writing\n", path);
+		free(ret);
+		return NULL;
+	}
+	
+	ret->callback = callback;
+	ret->user = user;
+	memset(&ret->header, 0, sizeof ret->header);
+	memcpy(ret->header.magic, TRACE_MAGIC, sizeof ret->header.magic);
+	ret->header.samplerate = samplerate;
+	ret->header.channels = channels;
+	ret->start = 0;
+	ret->ring = fmalloc(TRACE_RING);
+	ret->head = 0;
+	ret->tail = 0;
+	ret->closed = 0;
+	
+	// the counts are filled in on close
+	if(fwrite(&ret->header, sizeof ret->header, 1, ret->fp) != 1){
+		fprintf(stderr, "! Can't write trace header to %s\n", path);
+		fclose(ret->fp);
+		free(ret->ring);
+		free(ret);
+		return NULL;
+	}
+	if(pthread_create(&ret->writer, NULL, trace_writer, ret) != 0){
+		fprintf(stderr, "! Can't start the trace writer for %s\n", path);
+		fclose(ret->fp);
+		remove(path);
+		free(ret->ring);
+		free(ret);
+		return NULL;
+	}
+	
+	return ret;
+}
+
+// the tap's PortAudio callback, a copy and a clock read on top of the program's
+int trace_callback(const void * vin, void * vout, unsigned long frameCount,
+	const PaStreamCallbackTimeInfo * timeInfo, PaStreamCallbackFlags statusFlags, void * vdata){
+	
+	struct traceTap * t = vdata;
+	struct traceRecord rec;
+	uint64_t now = stats_now();
+	size_t samples = frameCount * t->header.channels, need = sizeof rec + samples * sizeof(float), pos, i;
+	float zero = 0.0f;
+	
+	if(t->start == 0) t->start = now;
+	
+	if(need > TRACE_RING - (t->head - ATOMIC_LOAD(&t->tail))){
+		t->header.dropped++;
+	}else{
+		rec.ns = now - t->start;
+		rec.adcTime = timeInfo != NULL ? timeInfo->inputBufferAdcTime : 0.0;
+		rec.currentTime = timeInfo != NULL ? timeInfo->currentTime : 0.0;
+		rec.dacTime = timeInfo != NULL ? timeInfo->outputBufferDacTime : 0.0;
+		rec.frames = frameCount;
+		rec.flags = statusFlags;
+		pos = trace_put(t, t->head, &rec, sizeof rec);
+		if(vin != NULL){
+			pos = trace_put(t, pos, vin, samples * sizeof(float));
+		}else{
+			for(i = 0; i < samples; i++){
+				pos = trace_put(t, pos, &zero, sizeof zero);
+			}
+		}
+		ATOMIC_STORE(&t->head, pos);
+		t->header.records++;
+	}
+	
+	return t->callback(vin, vout, frameCount, timeInfo, statusFlags, t->user);
+}
+
+// once the stream is closed: write out what's left and the counts, returns 0 if that failed
+int trace_close(struct traceTap * t){
+	int ok;
+	
+	ATOMIC_STORE(&t->closed, 1);
+	pthread_join(t->writer, NULL);
+	
+	if(t->header.dropped) fprintf(stderr, "! Trace dropped %llu callbacks, the disk didn't keep up\n", (unsigned long long)t->header.dropped);
+	ok = fseek(t->fp, 0, SEEK_SET) == 0 && fwrite(&t->header, sizeof t->header, 1, t->fp) == 1;
+	ok = fclose(t->fp) == 0 && ok;
+	free(t->ring);
+	free(t);
+	
+	return ok;
+}
+
+/**
+ * Call callback with every recorded call of the trace at path, as it was
+ * recorded: same frame counts, time info and flags. speed 1 keeps the
+ * original timing, 2 twice as fast, 0 goes flat out. Stops early when the
+ * callback doesn't return paContinue. The trace must be of samplerate and
+ * channels. Returns the number of calls made, -1 if the trace can't be read.
+ * A trace cut short (the recorder crashed) is played up to where it ends.
+ */
+long trace_replay(const char * path, int samplerate, int channels, PaStreamCallback * callback, void * user, double speed){
+	struct traceHeader header;
+	struct traceRecord rec;
+	PaStreamCallbackTimeInfo timeInfo;
+	FILE * fp = fopen(path, "rb");
+	float * samples = NULL;
+	size_t capacity = 0, n;
+	uint64_t start, due, now;
+	long ret = 0;
+	
+	if(fp == NULL){
+		fprintf(stderr, "! Can't open %s\n", path);
+		return -1;
+	}
+	if(fread(&header, sizeof header, 1, fp) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof header.magic) != 0){
+		fprintf(stderr, "! %s isn't a trace\n", path);
+		fclose(fp);
+		return -1;
+	}
+	if(header.samplerate != (uint32_t)samplerate || header.channels != (uint32_t)channels){
+		fprintf(stderr, "! %s is %u Hz, %u channels, not %i Hz, %i channels\n", path, header.samplerate, header.channels, samplerate, channels);
+		fclose(fp);
+		return -1;
+	}
+	if(header.dropped) fprintf(stderr, "! %s misses %llu callbacks, they were dropped while recording\n", path, (unsigned long long)header.dropped);
+	
+	start = stats_now();
+	while(fread(&rec, sizeof rec, 1, fp) == 1){
+		n = (size_t)rec.frames * channels;
+		if(n > capacity){
+			free(samples);
+			capacity = n;
+			samples = fmalloc(capacity * sizeof *samples);
+		}
+		if(fread(samples, sizeof *samples, n, fp) != n){
+			fprintf(stderr, "! %s ends in the middle of a callback\n", path);
+			break;
+		}
+		
+		if(speed > 0.0){
+			due = start + (uint64_t)(rec.ns / speed);
+			now = stats_now();
+			if(due > now) Pa_Sleep((due - now) / 1000000);
+		}
+		
+		timeInfo.inputBufferAdcTime = rec.adcTime;
+		timeInfo.currentTime = rec.currentTime;
+		timeInfo.outputBufferDacTime = rec.dacTime;
+		ret++;
+		if(callback(samples, NULL, rec.frames, &timeInfo, rec.flags, user) != paContinue) break;
+	}
+	
+	free(samples);
+	fclose(fp);
+	
+	return ret;
+}
@@ -0,0 +1,67 @@
+#ifndef HARK_TRACE_H
+#define HARK_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <portaudio.h>
+#include <pthread.h>
+
+#define TRACE_MAGIC "harktrc1"
+#define TRACE_RING (1 << 22) // bytes of records waiting for the disk, ~20 s of mono float
+
+/*
+ * A trace file is a header followed by one record per callback, native
+ * endian like the samples:
+ *   header: magic[8] samplerate:u32 channels:u32 records:u64 dropped:u64
+ *   record: ns:u64 adcTime:f64 currentTime:f64 dacTime:f64 frames:u32 flags:u32
+ *           then frames * channels float32 samples
+ * ns is when the callback was called, since the first one.
+ */
+struct traceHeader{
+	char magic[8];
+	uint32_t samplerate;
+	uint32_t channels;
+	uint64_t records;
+	uint64_t dropped; // callbacks that didn't fit in the ring
+};
+
+struct traceRecord{
+	uint64_t ns;
+	double adcTime;
+	double currentTime;
+	double dacTime;
+	uint32_t frames;
+	uint32_t flags;
+};
+
+/**
+ * Sits between PortAudio and a program's callback: every call is copied
+ * into a lock-free ring (or counted as dropped, the callback never waits)
+ * and passed on, a thread of its own writes the ring out.
+ */
+struct traceTap{
+	PaStreamCallback * callback;
+	void * user;
+	
+	FILE * fp;
+	struct traceHeader header;
+	uint64_t start; // stats_now() of the first call, 0 before it
+	unsigned char * ring;
+	size_t head; // bytes put in, only the callback stores it
+	size_t tail; // bytes written, only the writer stores it
+	int closed;
+	pthread_t writer;
+};
+
+struct traceTap * trace_create(const char * path, int samplerate, int channels, PaStreamCallback * callback, void * user);
+
+int trace_callback(const void * vin, void * vout, unsigned long frameCount,
+	const PaStreamCallbackTimeInfo * timeInfo, PaStreamCallbackFlags statusFlags, void * vdata);
+
+int trace_close(struct traceTap * t);
+
+long trace_replay(const char * path, int samplerate, int channels, PaStreamCallback * callback, void * user, double speed);
+
+#endif
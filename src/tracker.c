@@ -0,0 +1,199 @@
+#include <math.h>
+
+#include "tracker.h"
+#include "util.h"
+
+#define AMP(o, i) ((o)[i][0]*(o)[i][0] + (o)[i][1]*(o)[i][1])
+
+struct tracker * tracker_new(size_t length){
+	struct tracker * ret = fmalloc(sizeof *ret);
+	
+	ret->length = length;
+	ret->partials = fmalloc(length * sizeof *ret->partials);
+	ret->peaks = fmalloc(length * sizeof *ret->peaks);
+	ret->threshold = 1e-3;
+	ret->fullFrames = 0;
+	ret->frames = 0;
+	tracker_clear(ret);
+	
+	return ret;
+}
+
+void tracker_free(struct tracker * t){
+	if(t == NULL) return;
+	free(t->partials);
+	free(t->peaks);
+	free(t);
+}
+
+void tracker_clear(struct tracker * t){
+	t->numPartials = 0;
+	t->numPeaks = 0;
+	t->nextId = 1;
+	t->current = 0;
+	t->sinceFull = TRACK_FULL;
+}
+
+// keep the length loudest peaks, loudest first
+static void tracker_addPeak(struct tracker * t, size_t i, double amp){
+	size_t k;
+	
+	for(k = 0; k < t->numPeaks; k++){
+		if((size_t)t->peaks[k].bin == i) return; // two partials found the same one
+	}
+	if(t->numPeaks == t->length){
+		if(amp <= t->peaks[t->numPeaks - 1].amp) return;
+		t->numPeaks--;
+	}
+	for(k = t->numPeaks; k > 0 && t->peaks[k - 1].amp < amp; k--){
+		t->peaks[k] = t->peaks[k - 1];
+	}
+	t->peaks[k].bin = (double)i;
+	t->peaks[k].amp = amp;
+	t->numPeaks++;
+}
+
+static void tracker_searchFull(struct tracker * t, fftw_complex * fftOut, int fftSize){
+	size_t i, n = fftSize / 2;
+	double left = AMP(fftOut, 0), amp = AMP(fftOut, 1), right;
+	
+	t->numPeaks = 0;
+	for(i = 1; i < n; i++){
+		right = AMP(fftOut, i + 1);
+		if(amp > left && amp >= right) tracker_addPeak(t, i, amp);
+		left = amp;
+		amp = right;
+	}
+	t->sinceFull = 0;
+	t->fullFrames++;
+}
+
+/**
+ * The loudest local maximum within TRACK_WIDTH bins of every partial.
+ * Returns 0 if the one that is the pitch can't be found or got a lot quieter:
+ * it's ending or moving, and something else may be starting, so a full
+ * search is due. Others that can't be found just miss a frame.
+ */
+static int tracker_searchLocal(struct tracker * t, fftw_complex * fftOut, int fftSize, int samplerate){
+	size_t i, k, lo, hi, best, n = fftSize / 2, c;
+	double amp, high;
+	
+	t->numPeaks = 0;
+	for(k = 0; k < t->numPartials; k++){
+		// from the frequency, the FFT size may have changed since
+		c = (size_t)(t->partials[k].freq * fftSize / samplerate + 0.5);
+		lo = c > TRACK_WIDTH + 1 ? c - TRACK_WIDTH : 1;
+		hi = c + TRACK_WIDTH < n ? c + TRACK_WIDTH : n - 1;
+		best = 0;
+		high = 0.0;
+		for(i = lo; i <= hi; i++){
+			amp = AMP(fftOut, i);
+			if(amp > high && amp > AMP(fftOut, i - 1) && amp >= AMP(fftOut, i + 1)){
+				high = amp;
+				best = i;
+			}
+		}
+		if(t->partials[k].id == t->current && (best == 0 || high < 0.5 * t->partials[k].amp)) return 0;
+		if(best != 0) tracker_addPeak(t, best, high);
+	}
+	t->sinceFull++;
+	
+	return 1;
+}
+
+/**
+ * Find this frame's peaks and continue, end and start partials with them.
+ * Returns the partial that is the pitch right now: the one reported last
+ * time as long as it's still going and at least half as loud as the loudest
+ * partial, otherwise that loudest one. NULL when there's nothing.
+ */
+const struct partial * tracker_frame(struct tracker * t, fftw_complex * fftOut, int fftSize, int samplerate){
+	struct partial * p, * q, * best, * cur;
+	struct partial tmp;
+	size_t i, k, n;
+	double dist, near;
+	
+	t->frames++;
+	if(t->numPartials == 0 || t->sinceFull >= TRACK_FULL || !tracker_searchLocal(t, fftOut, fftSize, samplerate)){
+		tracker_searchFull(t, fftOut, fftSize);
+	}
+	
+	// ignore what's far below the loudest, then refine what's left
+	for(n = 0; n < t->numPeaks && t->peaks[n].amp >= t->threshold * t->peaks[0].amp; n++){
+		p = t->peaks + n;
+		p->bin = peakInterp(fftOut, fftSize, (size_t)p->bin);
+		p->freq = p->bin * samplerate / fftSize;
+		p->missed = 0; // not claimed yet
+	}
+	t->numPeaks = n;
+	
+	// loudest partials get first pick
+	for(i = 1; i < t->numPartials; i++){
+		tmp = t->partials[i];
+		for(k = i; k > 0 && t->partials[k - 1].amp < tmp.amp; k--){
+			t->partials[k] = t->partials[k - 1];
+		}
+		t->partials[k] = tmp;
+	}
+	
+	for(i = 0; i < t->numPartials; i++){
+		p = t->partials + i;
+		best = NULL;
+		near = TRACK_JUMP * p->freq;
+		for(k = 0; k < t->numPeaks; k++){
+			q = t->peaks + k;
+			dist = fabs(q->freq - p->freq);
+			if(!q->missed && dist <= near){
+				near = dist;
+				best = q;
+			}
+		}
+		if(best != NULL){
+			best->missed = 1;
+			p->bin = best->bin;
+			p->freq = best->freq;
+			p->amp = best->amp;
+			p->age++;
+			p->missed = 0;
+		}else{
+			p->missed++;
+		}
+	}
+	
+	// deaths
+	for(i = 0, k = 0; i < t->numPartials; i++){
+		if(t->partials[i].missed <= TRACK_MISSES) t->partials[k++] = t->partials[i];
+	}
+	t->numPartials = k;
+	
+	// births, when full they replace the quietest partial if it's missing or quieter
+	for(k = 0; k < t->numPeaks; k++){
+		q = t->peaks + k;
+		if(q->missed) continue;
+		if(t->numPartials < t->length){
+			p = t->partials + t->numPartials++;
+		}else{
+			for(p = t->partials, i = 1; i < t->numPartials; i++){
+				if(t->partials[i].amp < p->amp) p = t->partials + i;
+			}
+			if(!p->missed && p->amp >= q->amp) break;
+		}
+		*p = *q;
+		p->id = t->nextId++;
+		p->age = 1;
+		p->missed = 0;
+	}
+	
+	best = NULL;
+	cur = NULL;
+	for(i = 0; i < t->numPartials; i++){
+		p = t->partials + i;
+		if(p->missed) continue;
+		if(p->id == t->current) cur = p;
+		if(best == NULL || p->amp > best->amp) best = p;
+	}
+	if(cur != NULL && best != NULL && cur->amp >= 0.5 * best->amp) best = cur;
+	t->current = best != NULL ? best->id : 0;
+	
+	return best;
+}
@@ -0,0 +1,54 @@
+#ifndef HARK_TRACKER_H
+#define HARK_TRACKER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fftw3.h"
+
+#define TRACK_JUMP 0.03 // a partial may move half a semitone per frame
+#define TRACK_MISSES 2 // frames a partial may go unseen before it dies
+#define TRACK_WIDTH 4 // bins either side of a partial searched in a local frame
+#define TRACK_FULL 8 // search the whole spectrum at least every this many frames
+
+struct partial{
+	size_t id;
+	double bin; // interpolated
+	double freq;
+	double amp; // squared magnitude
+	size_t age; // frames it's been seen
+	int missed; // frames in a row it wasn't
+};
+
+/**
+ * McAulay-Quatieri style partial tracking: the peaks of every frame are
+ * matched to the partials of the last one (closest first, loudest partial
+ * first), unmatched partials die after a few frames and unmatched peaks are
+ * born as new ones. Once there are partials only a few bins around each are
+ * searched, the whole spectrum is only searched every TRACK_FULL frames (or
+ * when there's nothing to follow) so new partials can be born.
+ * This is per stream state.
+ */
+struct tracker{
+	size_t length; // most partials followed at once
+	size_t numPartials;
+	struct partial * partials;
+	struct partial * peaks; // this frame's, scratch
+	size_t numPeaks;
+	size_t nextId;
+	size_t current; // id of the partial reported last, 0 for none
+	size_t sinceFull;
+	double threshold; // peaks quieter than this times the loudest are ignored
+	size_t fullFrames; // frames that searched the whole spectrum
+	size_t frames;
+};
+
+struct tracker * tracker_new(size_t length);
+
+void tracker_free(struct tracker * t);
+
+void tracker_clear(struct tracker * t);
+
+const struct partial * tracker_frame(struct tracker * t, fftw_complex * fftOut, int fftSize, int samplerate);
+
+#endif
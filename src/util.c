@@ -1,3 +1,5 @@
+#include <math.h>
+
 #include "util.h"
 
 void * fmalloc(size_t n){
@@ -10,7 +12,7 @@ void * fmalloc(size_t n){
 }
 
 size_t highFreq(fftw_complex * fftOut, int fftSize, double * intens){
-	size_t i, idx;
+	size_t i, idx = 0;
 	double high = 0, amp = 0;
 	
 	for(i = 1; i < fftSize/2 + 1; i++){
@@ -26,6 +28,132 @@ size_t highFreq(fftw_complex * fftOut, int fftSize, double * intens){
 	return idx;
 }
 
+/**
+ * Fit a parabola through the log magnitudes around bin i, returns the
+ * fractional bin of its top.
+ */
+double peakInterp(fftw_complex * fftOut, int fftSize, size_t i){
+	double a, b, c, d;
+	
+	if(i < 1 || i >= (size_t)fftSize / 2) return (double)i;
+	
+	a = log(fftOut[i - 1][0]*fftOut[i - 1][0] + fftOut[i - 1][1]*fftOut[i - 1][1] + 1e-300);
+	b = log(fftOut[i][0]*fftOut[i][0] + fftOut[i][1]*fftOut[i][1] + 1e-300);
+	c = log(fftOut[i + 1][0]*fftOut[i + 1][0] + fftOut[i + 1][1]*fftOut[i + 1][1] + 1e-300);
+	d = a - 2*b + c;
+	
+	if(d >= 0.0) return (double)i; // not a top
+	
+	return (double)i + 0.5 * (a - c) / d;
+}
+
+/**
+ * Given the peak each resolution found (lengths ascending), pick the shortest
+ * window whose bins are at most a semitone wide at the frequency it found, and
+ * at the one the longest window found (so a short window latching onto an
+ * overtone of a low note isn't believed). Short windows react faster, long
+ * ones are needed to tell low notes apart.
+ * Returns the index of the resolution to believe.
+ */
+size_t mergeResolutions(const double * freqs, const size_t * lengths, size_t n, int samplerate){
+	double bin, low = freqs[n - 1];
+	size_t k;
+	
+	for(k = 0; k + 1 < n; k++){
+		// a semitone is f * (2^(1/12) - 1) ~ 0.0595f wide
+		bin = (double)samplerate / (double)lengths[k];
+		if(bin <= 0.0595 * freqs[k] && bin <= 0.0595 * low) return k;
+	}
+	
+	return n - 1;
+}
+
+void sizeChooser_init(struct sizeChooser * c, size_t numSizes){
+	c->numSizes = numSizes;
+	c->current = 0;
+	c->lastFreq = 0.0;
+	c->lastLength = 0;
+	c->steady = 0;
+}
+
+// something new starts: react fast again
+void sizeChooser_onset(struct sizeChooser * c){
+	c->current = 0;
+	c->lastLength = 0;
+	c->steady = 0;
+}
+
+/**
+ * Feed the peak a frame of length samples found, returns the index of the
+ * size to use for the next frame. As long as the pitch stays within a bin
+ * (of the coarser of the last two frames) or half a semitone of the last one
+ * the window grows one size every STEADY_FRAMES frames; when it moves we're
+ * in a transient and drop back to the smallest size.
+ */
+size_t sizeChooser_update(struct sizeChooser * c, double freq, size_t length, int samplerate){
+	size_t coarse = c->lastLength > 0 && c->lastLength < length ? c->lastLength : length;
+	double tol = (double)samplerate / (double)coarse;
+	
+	if(tol < 0.03 * freq) tol = 0.03 * freq;
+	
+	if(c->lastLength > 0 && fabs(freq - c->lastFreq) <= tol){
+		if(++c->steady >= STEADY_FRAMES && c->current + 1 < c->numSizes){
+			c->current++;
+			c->steady = 0;
+		}
+	}else{
+		c->current = 0;
+		c->steady = 0;
+	}
+	c->lastFreq = freq;
+	c->lastLength = length;
+	
+	return c->current;
+}
+
+// open (as RMS) 0 leaves the gate open for good
+void gate_init(struct gate * g, double open, double close, double zcr, int hang){
+	g->open = open;
+	g->close = close < open ? close : open;
+	g->zcr = zcr;
+	g->hang = hang;
+	g->state = open <= 0.0;
+	g->count = 0;
+}
+
+/**
+ * Decide on a hop with rms and zcr zero crossings per sample, returns
+ * whether the gate is open after it. It opens on a hop at least open loud
+ * with at most zcr crossings, and closes after more than hang hops quieter
+ * than close or noisier than zcr.
+ */
+int gate_hop(struct gate * g, double rms, double zcr){
+	if(g->open <= 0.0) return 1;
+	
+	if(rms >= g->open && zcr <= g->zcr){
+		g->state = 1;
+		g->count = 0;
+	}else if(g->state && (rms < g->close || zcr > g->zcr) && ++g->count > g->hang){
+		g->state = 0;
+	}
+	
+	return g->state;
+}
+
+// RMS of n samples, with their zero crossings per sample in zcr
+double gate_measure(const double * x, size_t n, double * zcr){
+	double energy = 0.0;
+	size_t crossings = 0, i;
+	
+	for(i = 0; i < n; i++){
+		energy += x[i] * x[i];
+		crossings += i > 0 && (x[i] < 0.0) != (x[i - 1] < 0.0);
+	}
+	*zcr = n > 0 ? (double)crossings / (double)n : 0.0;
+	
+	return n > 0 ? sqrt(energy / (double)n) : 0.0;
+}
+
 static void heap_enqueue(struct heap * h, double item, int addon);
 static void heap_full(struct heap * h);
 static void heap_swap(struct heap * h, int a, int b);
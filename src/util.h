@@ -13,10 +13,51 @@ struct heap{
 	int * addons;
 };
 
+// acquire/release for a value one thread publishes to another, GCC's builtins as C99 has no atomics
+#define ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(p, x) __atomic_store_n((p), (x), __ATOMIC_RELEASE)
+
+#define STEADY_FRAMES 2 // frames at the same pitch before the next larger FFT size
+
+// picks one of a few ascending FFT sizes per frame, by how steady the pitch is
+struct sizeChooser{
+	size_t numSizes;
+	size_t current; // index of the size to use next
+	double lastFreq;
+	size_t lastLength; // 0 before the first frame
+	int steady; // frames in a row at about the same pitch
+};
+
+// the silence gate: opens on a loud and tonal hop, closes after hang quiet or noisy ones
+struct gate{
+	double open; // hop RMS that opens it, 0 disables it
+	double close; // hop RMS under which it starts closing
+	double zcr; // more zero crossings per sample than this isn't a whistle
+	int hang; // quiet or noisy hops before it closes
+	int state; // 1 when open
+	int count;
+};
+
 void * fmalloc(size_t n);
 
 size_t highFreq(fftw_complex * fftOut, int fftSize, double * intens);
 
+double peakInterp(fftw_complex * fftOut, int fftSize, size_t i);
+
+size_t mergeResolutions(const double * freqs, const size_t * lengths, size_t n, int samplerate);
+
+void sizeChooser_init(struct sizeChooser * c, size_t numSizes);
+
+void sizeChooser_onset(struct sizeChooser * c);
+
+size_t sizeChooser_update(struct sizeChooser * c, double freq, size_t length, int samplerate);
+
+void gate_init(struct gate * g, double open, double close, double zcr, int hang);
+
+int gate_hop(struct gate * g, double rms, double zcr);
+
+double gate_measure(const double * x, size_t n, double * zcr);
+
 int * threshFreq(fftw_complex * fftOut, int fftSize, int threshold, int * in, size_t len, struct heap * hin);
 
 struct heap * heap_new(size_t length);
@@ -0,0 +1,130 @@
+#include <math.h>
+
+#include "viterbi.h"
+#include "util.h"
+
+struct viterbi * viterbi_new(int low, int high, int band, size_t lookahead){
+	struct viterbi * ret = fmalloc(sizeof *ret);
+	
+	ret->low = low;
+	ret->numStates = high - low + 1;
+	ret->band = band;
+	ret->lookahead = lookahead;
+	ret->cost = fmalloc(ret->numStates * sizeof *ret->cost);
+	ret->next = fmalloc(ret->numStates * sizeof *ret->next);
+	ret->back = fmalloc((lookahead + 1) * ret->numStates * sizeof *ret->back);
+	viterbi_clear(ret);
+	
+	return ret;
+}
+
+void viterbi_free(struct viterbi * v){
+	if(v == NULL) return;
+	free(v->cost);
+	free(v->next);
+	free(v->back);
+	free(v);
+}
+
+void viterbi_clear(struct viterbi * v){
+	size_t s;
+	
+	for(s = 0; s < v->numStates; s++){
+		v->cost[s] = 0.0;
+	}
+	v->frames = 0;
+}
+
+// how unlikely pitch (in fractional harmonics, NAN if unknown) is when state s is whistled
+static double viterbi_emission(double pitch, int s){
+	double d, best, c;
+	int k;
+	
+	if(isnan(pitch)) return 0.0;
+	
+	d = pitch - s;
+	best = VITERBI_SPREAD * d * d;
+	for(k = -12; k <= 12; k += 24){
+		d = pitch - (s + k);
+		c = VITERBI_OCTAVE + VITERBI_SPREAD * d * d;
+		if(c < best) best = c;
+	}
+	
+	return best;
+}
+
+static int viterbi_best(const struct viterbi * v){
+	size_t s, best = 0;
+	
+	for(s = 1; s < v->numStates; s++){
+		if(v->cost[s] < v->cost[best]) best = s;
+	}
+	
+	return best;
+}
+
+/**
+ * Add a frame with the measured pitch in (fractional) harmonics, or NAN when
+ * there's no measurement. Returns 1 and sets *decided to the note of the
+ * frame pushed lookahead frames ago once there is one.
+ */
+int viterbi_push(struct viterbi * v, double pitch, int * decided){
+	int * back = v->back + (v->frames % (v->lookahead + 1)) * v->numStates;
+	double * tmp, c, best, leap;
+	int s, p, lo, hi, bestState = viterbi_best(v), n = v->numStates;
+	size_t k;
+	
+	leap = v->cost[bestState] + VITERBI_LEAP;
+	for(s = 0; s < n; s++){
+		best = leap;
+		back[s] = bestState;
+		lo = s - v->band < 0 ? 0 : s - v->band;
+		hi = s + v->band >= n ? n - 1 : s + v->band;
+		for(p = lo; p <= hi; p++){
+			c = v->cost[p] + VITERBI_STEP * abs(s - p);
+			if(c < best){
+				best = c;
+				back[s] = p;
+			}
+		}
+		v->next[s] = best + viterbi_emission(pitch, v->low + s);
+	}
+	
+	// keep the costs small
+	tmp = v->cost;
+	v->cost = v->next;
+	v->next = tmp;
+	best = v->cost[viterbi_best(v)];
+	for(s = 0; s < n; s++){
+		v->cost[s] -= best;
+	}
+	v->frames++;
+	
+	if(v->frames <= v->lookahead) return 0;
+	
+	s = viterbi_best(v);
+	for(k = 0; k < v->lookahead; k++){
+		s = v->back[((v->frames - 1 - k) % (v->lookahead + 1)) * v->numStates + s];
+	}
+	*decided = v->low + s;
+	
+	return 1;
+}
+
+/**
+ * The notes of the frames that haven't been decided yet, oldest first, as
+ * the best path through them looks now. Starts over afterwards.
+ * Returns how many there were (at most lookahead).
+ */
+size_t viterbi_flush(struct viterbi * v, int * states){
+	size_t n = v->frames < v->lookahead ? v->frames : v->lookahead, k;
+	int s = viterbi_best(v);
+	
+	for(k = 0; k < n; k++){
+		states[n - 1 - k] = v->low + s;
+		s = v->back[((v->frames - 1 - k) % (v->lookahead + 1)) * v->numStates + s];
+	}
+	viterbi_clear(v);
+	
+	return n;
+}
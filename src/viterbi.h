@@ -0,0 +1,44 @@
+#ifndef HARK_VITERBI_H
+#define HARK_VITERBI_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define VITERBI_BAND 5 // semitones a note moves by stepping, beyond VITERBI_LEAP / VITERBI_STEP leaping is cheaper anyway
+#define VITERBI_STEP 2.0 // cost per semitone moved
+#define VITERBI_LEAP 10.0 // cost of moving further than the band, from anywhere
+#define VITERBI_OCTAVE 12.0 // extra cost of believing the measurement is an octave off
+#define VITERBI_SPREAD 2.0 // cost per squared semitone between a state and the measurement
+
+/**
+ * Fixed-lag Viterbi decoding of a note sequence from measured pitches. The
+ * states are the harmonics low..high, staying is free, moving costs
+ * VITERBI_STEP per semitone within the band and VITERBI_LEAP beyond it. As
+ * only the band around every state (plus the best state overall, for leaps)
+ * is looked at a frame costs states * band, not states^2.
+ * A frame's note is decided lookahead frames after it was pushed, by tracing
+ * back from the best state of the newest frame.
+ */
+struct viterbi{
+	int low;
+	size_t numStates;
+	int band;
+	size_t lookahead;
+	size_t frames; // pushed since the last clear
+	
+	double * cost; // numStates, of the best path ending in every state
+	double * next;
+	int * back; // (lookahead + 1) * numStates, predecessor of every state in recent frames
+};
+
+struct viterbi * viterbi_new(int low, int high, int band, size_t lookahead);
+
+void viterbi_free(struct viterbi * v);
+
+void viterbi_clear(struct viterbi * v);
+
+int viterbi_push(struct viterbi * v, double pitch, int * decided);
+
+size_t viterbi_flush(struct viterbi * v, int * states);
+
+#endif
@@ -0,0 +1,108 @@
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "wav.h"
+
+#define WAV_HEADER 44
+#define WAV_CHUNK 4096
+#define WAV_BUFFER (1024 * 1024) // stdio buffer, so long recordings go to disk in large sequential writes
+
+static void putLE(unsigned char * p, uint32_t x, int bytes){
+	int i;
+	
+	for(i = 0; i < bytes; i++){
+		p[i] = x & 0xFF;
+		x >>= 8;
+	}
+}
+
+static int wav_header(struct wavFile * w){
+	unsigned char h[WAV_HEADER];
+	uint32_t dataSize = w->frames * w->channels * 2;
+	
+	memcpy(h, "RIFF", 4);
+	putLE(h + 4, 36 + dataSize, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	putLE(h + 16, 16, 4); // fmt chunk size
+	putLE(h + 20, 1, 2); // PCM
+	putLE(h + 22, w->channels, 2);
+	putLE(h + 24, w->samplerate, 4);
+	putLE(h + 28, w->samplerate * w->channels * 2, 4); // bytes per second
+	putLE(h + 32, w->channels * 2, 2); // bytes per frame
+	putLE(h + 34, 16, 2); // bits per sample
+	memcpy(h + 36, "data", 4);
+	putLE(h + 40, dataSize, 4);
+	
+	if(fseek(w->fp, 0, SEEK_SET)) return 0;
+	return fwrite(h, 1, WAV_HEADER, w->fp) == WAV_HEADER;
+}
+
+struct wavFile * wav_create(const char * fileName, int samplerate, int channels){
+	struct wavFile * ret = malloc(sizeof *ret);
+	
+	if(ret == NULL){
+		fprintf(stderr, "! malloc failed (%zu)\n", sizeof *ret);
+		return NULL;
+	}
+	
+	ret->fp = fopen(fileName, "wb");
+	if(ret->fp == NULL){
+		fprintf(stderr, "! Can't open %s for writing\n", fileName);
+		free(ret);
+		return NULL;
+	}
+	setvbuf(ret->fp, NULL, _IOFBF, WAV_BUFFER);
+	ret->samplerate = samplerate;
+	ret->channels = channels;
+	ret->frames = 0;
+	ret->maxFrames = (UINT32_MAX - 36) / ((uint32_t)channels * 2);
+	
+	if(!wav_header(ret)){
+		fprintf(stderr, "! Can't write WAV header to %s\n", fileName);
+		fclose(ret->fp);
+		free(ret);
+		return NULL;
+	}
+	
+	return ret;
+}
+
+/**
+ * in is interleaved and clipped to [-1, 1], returns the number of frames
+ * written. Once the file is as long as a WAV can say, nothing more is.
+ */
+size_t wav_writeFloat(struct wavFile * w, const float * in, size_t frames){
+	unsigned char buf[WAV_CHUNK * 2];
+	size_t i, n, done = 0, samples;
+	float x;
+	
+	if(frames > w->maxFrames - w->frames){
+		if(w->frames < w->maxFrames) fprintf(stderr, "! WAV is full at %zu frames, the rest isn't written\n", w->maxFrames);
+		frames = w->maxFrames - w->frames;
+	}
+	samples = frames * w->channels;
+	while(done < samples){
+		n = samples - done < WAV_CHUNK ? samples - done : WAV_CHUNK;
+		for(i = 0; i < n; i++){
+			x = in[done + i];
+			if(x > 1.0f) x = 1.0f;
+			if(x < -1.0f) x = -1.0f;
+			putLE(buf + 2 * i, (uint16_t)(int16_t)lrintf(x * 32767.0f), 2);
+		}
+		if(fwrite(buf, 2, n, w->fp) != n) break;
+		done += n;
+	}
+	
+	w->frames += done / w->channels;
+	return done / w->channels;
+}
+
+int wav_close(struct wavFile * w){
+	int ok = wav_header(w);
+	
+	ok = (fclose(w->fp) == 0) && ok;
+	free(w);
+	
+	return ok;
+}
@@ -0,0 +1,22 @@
+#ifndef HARK_WAV_H
+#define HARK_WAV_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// 16 bit PCM RIFF/WAVE writer, the sizes in the header are filled in on close
+struct wavFile{
+	FILE * fp;
+	int samplerate;
+	int channels;
+	size_t frames;
+	size_t maxFrames; // the header's 32 bit sizes can't count more
+};
+
+struct wavFile * wav_create(const char * fileName, int samplerate, int channels);
+
+size_t wav_writeFloat(struct wavFile * w, const float * in, size_t frames);
+
+int wav_close(struct wavFile * w);
+
+#endif
@@ -0,0 +1,161 @@
+#include <math.h>
+
+#include "zoom.h"
+#include "util.h"
+
+#ifndef M_PI
+#define M_PI 3.1415926538
+#endif
+
+#define ZOOM_TAPS 16 // filter taps per decimated sample
+
+/**
+ * Decimate so the band takes up at most half the new samplerate, which
+ * leaves a low-pass of ZOOM_TAPS * decimation Blackman windowed taps plenty
+ * of room to roll off before anything can alias into the band.
+ * Returns NULL if the band doesn't fit the samplerate.
+ */
+struct zoomPlan * zoomPlan_new(int samplerate, double low, double high, size_t length){
+	struct zoomPlan * ret;
+	size_t i, k;
+	double rate, cut, x, sum = 0.0, * h;
+	fftw_complex * in, * out;
+	
+	if(low < 0.0 || high <= low || high >= samplerate / 2.0 || length < 2){
+		fprintf(stderr, "! Can't zoom into %f..%f Hz at %i Hz\n", low, high, samplerate);
+		return NULL;
+	}
+	
+	ret = fmalloc(sizeof *ret);
+	ret->samplerate = samplerate;
+	ret->low = low;
+	ret->high = high;
+	ret->centre = (low + high) / 2.0;
+	ret->decimation = (size_t)(samplerate / (2.0 * (high - low)));
+	if(ret->decimation < 1) ret->decimation = 1;
+	for(ret->bins = 2; ret->bins * ret->decimation < length; ret->bins *= 2);
+	ret->taps = ZOOM_TAPS * ret->decimation + 1;
+	ret->length = (ret->bins - 1) * ret->decimation + ret->taps;
+	
+	rate = (double)samplerate / ret->decimation;
+	ret->first = (size_t)ceil(ret->bins / 2.0 + (low - ret->centre) * ret->bins / rate);
+	if(ret->first < 1) ret->first = 1;
+	ret->count = (size_t)floor(ret->bins / 2.0 + (high - ret->centre) * ret->bins / rate) + 1 - ret->first;
+	
+	// windowed sinc, cut off at half the decimated rate
+	h = fmalloc(ret->taps * sizeof *h);
+	cut = 0.5 / ret->decimation;
+	for(k = 0; k < ret->taps; k++){
+		x = (double)k - (ret->taps - 1) / 2.0;
+		h[k] = x == 0.0 ? 2.0 * cut : sin(2.0 * M_PI * cut * x) / (M_PI * x);
+		h[k] *= 0.42 - 0.5 * cos(2.0 * M_PI * k / (ret->taps - 1)) + 0.08 * cos(4.0 * M_PI * k / (ret->taps - 1));
+		sum += h[k];
+	}
+	
+	// mixing sample n down is e^(-i w n), n = m * decimation + k splits it into a tap and a rotation
+	ret->tapRe = fmalloc(ret->taps * sizeof *ret->tapRe);
+	ret->tapIm = fmalloc(ret->taps * sizeof *ret->tapIm);
+	for(k = 0; k < ret->taps; k++){
+		x = -2.0 * M_PI * ret->centre * k / samplerate;
+		ret->tapRe[k] = h[k] / sum * cos(x);
+		ret->tapIm[k] = h[k] / sum * sin(x);
+	}
+	ret->rotRe = fmalloc(ret->bins * sizeof *ret->rotRe);
+	ret->rotIm = fmalloc(ret->bins * sizeof *ret->rotIm);
+	ret->window = fmalloc(ret->bins * sizeof *ret->window);
+	for(i = 0; i < ret->bins; i++){
+		// fmod keeps the phase small, centre * decimation * i gets big
+		x = -2.0 * M_PI * fmod(ret->centre * ret->decimation * i / samplerate, 1.0);
+		ret->rotRe[i] = cos(x);
+		ret->rotIm[i] = sin(x);
+		ret->window[i] = 0.5 - 0.5 * cos(2 * M_PI * (double)i / (double)ret->bins);
+	}
+	free(h);
+	
+	in = fftw_malloc(ret->bins * sizeof *in);
+	out = fftw_malloc(ret->bins * sizeof *out);
+	if(in == NULL || out == NULL){
+		fprintf(stderr, "! fftw_malloc failed (%zu)\n", ret->bins * sizeof *out);
+		exit(EXIT_FAILURE);
+	}
+	ret->panama = fftw_plan_dft_1d(ret->bins, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
+	fftw_free(in);
+	fftw_free(out);
+	
+	return ret;
+}
+
+void zoomPlan_free(struct zoomPlan * p){
+	if(p == NULL) return;
+	fftw_destroy_plan(p->panama);
+	free(p->tapRe);
+	free(p->tapIm);
+	free(p->rotRe);
+	free(p->rotIm);
+	free(p->window);
+	free(p);
+}
+
+struct zoomWorker * zoomWorker_new(struct zoomPlan * plan){
+	struct zoomWorker * ret = fmalloc(sizeof *ret);
+	
+	ret->plan = plan;
+	ret->fftIn = fftw_malloc(plan->bins * sizeof *ret->fftIn);
+	ret->fftOut = fftw_malloc(plan->bins * sizeof *ret->fftOut);
+	ret->spectrum = fftw_malloc(plan->bins * sizeof *ret->spectrum);
+	ret->samples = fmalloc(plan->length * sizeof *ret->samples);
+	if(ret->fftIn == NULL || ret->fftOut == NULL || ret->spectrum == NULL){
+		fprintf(stderr, "! fftw_malloc failed (%zu)\n", plan->bins * sizeof *ret->fftOut);
+		exit(EXIT_FAILURE);
+	}
+	
+	return ret;
+}
+
+void zoomWorker_free(struct zoomWorker * w){
+	if(w == NULL) return;
+	fftw_free(w->fftIn);
+	fftw_free(w->fftOut);
+	fftw_free(w->spectrum);
+	free(w->samples);
+	free(w);
+}
+
+/**
+ * Zoom into the band of plan->length samples (oldest first, not windowed),
+ * returns the frequency of the loudest peak in it. intens is its squared
+ * magnitude, which isn't on the same scale as a full band FFT's.
+ */
+double zoom_execute(struct zoomWorker * w, const double * samples, double * intens){
+	struct zoomPlan * p = w->plan;
+	const double * x;
+	double re, im, bin;
+	size_t m, k, half = p->bins / 2;
+	
+	for(m = 0; m < p->bins; m++){
+		x = samples + m * p->decimation;
+		re = 0.0;
+		im = 0.0;
+		for(k = 0; k < p->taps; k++){
+			re += p->tapRe[k] * x[k];
+			im += p->tapIm[k] * x[k];
+		}
+		w->fftIn[m][0] = p->window[m] * (re * p->rotRe[m] - im * p->rotIm[m]);
+		w->fftIn[m][1] = p->window[m] * (re * p->rotIm[m] + im * p->rotRe[m]);
+	}
+	
+	fftw_execute_dft(p->panama, w->fftIn, w->fftOut);
+	
+	// the upper half of the bins are below the centre
+	for(m = 0; m < p->bins; m++){
+		k = m < half ? m + half : m - half;
+		w->spectrum[m][0] = w->fftOut[k][0];
+		w->spectrum[m][1] = w->fftOut[k][1];
+	}
+	
+	// the usual peak picking, over just the bins in the band
+	k = highFreq(w->spectrum + p->first - 1, 2 * p->count, intens);
+	bin = peakInterp(w->spectrum + p->first - 1, 2 * p->count, k) + p->first - 1;
+	
+	return p->centre + (bin - half) * p->samplerate / p->decimation / p->bins;
+}
@@ -0,0 +1,52 @@
+#ifndef HARK_ZOOM_H
+#define HARK_ZOOM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fftw3.h"
+
+/**
+ * Zoom-FFT: the spectrum of just low..high Hz at the resolution of a
+ * length-point full band FFT. The band is mixed down around its centre,
+ * low-pass filtered and decimated (only the samples that are kept are
+ * filtered) and then transformed with a complex FFT decimation times smaller.
+ * Like an anPlan it's made up front and shared, every thread brings its own
+ * zoomWorker.
+ */
+struct zoomPlan{
+	int samplerate;
+	double low, high, centre;
+	size_t decimation;
+	size_t bins; // complex FFT size
+	size_t taps;
+	size_t length; // input samples per frame: (bins - 1) * decimation + taps
+	size_t first, count; // bins that lie in low..high, in ascending order
+	
+	double * tapRe; // the low-pass filter shifted up to the centre
+	double * tapIm;
+	double * rotRe; // what's left of the mixing at each kept sample
+	double * rotIm;
+	double * window; // Hann over bins
+	fftw_plan panama;
+};
+
+struct zoomWorker{
+	struct zoomPlan * plan;
+	fftw_complex * fftIn;
+	fftw_complex * fftOut;
+	fftw_complex * spectrum; // fftOut from the lowest frequency up
+	double * samples; // plan->length, for callers that have to unwrap a ring first
+};
+
+struct zoomPlan * zoomPlan_new(int samplerate, double low, double high, size_t length);
+
+void zoomPlan_free(struct zoomPlan * p);
+
+struct zoomWorker * zoomWorker_new(struct zoomPlan * plan);
+
+void zoomWorker_free(struct zoomWorker * w);
+
+double zoom_execute(struct zoomWorker * w, const double * samples, double * intens);
+
+#endif